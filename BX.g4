@@ -1,6 +1,6 @@
 grammar BX;
 
-program: (globalVar | proc | func | type_abbrev)*;
+program: (globalVar | proc | func | type_abbrev | externVar | externFunc | externProc)*;
 
 type_abbrev: 'type' ID '=' type ';';
 
@@ -19,6 +19,10 @@ globalVarInit: ID '=' (NUM | BOOL);
 func: 'fun' ID '(' parameter_groups? ')' ':' type block; 
 proc: 'proc' ID '(' parameter_groups? ')' block;
 
+externVar: 'extern' 'var' ID (',' ID)* ':' type ';';
+externFunc: 'extern' 'fun' ID '(' parameter_groups? ')' ':' type ';';
+externProc: 'extern' 'proc' ID '(' parameter_groups? ')' ';';
+
 parameter_groups: param (',' param)*;
 param: ID (',' ID)* ':' type;
 
@@ -5,6 +5,8 @@
  * amd64 assembly.
  */
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -50,13 +52,57 @@ struct Pseudo {
   bool operator==(Pseudo const &other) const noexcept { return id == other.id; }
 
 private:
-  static int __last_pseudo_id;
+  static std::atomic<int> __last_pseudo_id;
 };
 std::ostream &operator<<(std::ostream &out, Pseudo const &p);
 
 
 // Assembly
 
+/** What an Asm line does, for the assembler (see amd64_encode.h) */
+enum class Op : uint8_t {
+  // labels and directives
+  LABEL, GLOBL, TEXT, DATA, ALIGN, QUAD,
+  // instructions
+  MOV, LEA, MOVABS, ADD, SUB, AND, OR, XOR, CMP, CQO, IMUL, IDIV, NEG, NOT,
+  INC, PUSH, POP, SAR, SHR, SAL, JMP, JE, JNE, JL, JLE, JG, JGE, CALL, RET,
+};
+
+/** An operand of an Asm line, in the order of its repr_template */
+struct Arg {
+  enum Kind : uint8_t {
+    NONE,    // no operand
+    USE,     // the pseudo use[index]
+    DEF,     // the pseudo def[index]
+    IMM,     // the number imm
+    MEM_USE, // sym+imm(base) where the base is use[index]
+    MEM_DEF, // sym+imm(base) where the base is def[index]
+    SYMBOL,  // the label or symbol sym
+    DEST,    // the label jump_dests[index]
+    CL,      // %cl, the count of the shifts
+  } kind = NONE;
+  int index = 0;
+  int64_t imm = 0;
+  std::string sym;
+
+  static Arg use(int i) { return Arg{USE, i, 0, ""}; }
+  static Arg def(int i) { return Arg{DEF, i, 0, ""}; }
+  static Arg number(int64_t v) { return Arg{IMM, 0, v, ""}; }
+  static Arg symbol(std::string const &s) { return Arg{SYMBOL, 0, 0, s}; }
+  static Arg dest(int i) { return Arg{DEST, i, 0, ""}; }
+  static Arg cl() { return Arg{CL, 0, 0, ""}; }
+  static Arg mem(Kind kind, int i, int64_t disp) {
+    return Arg{kind, i, disp, ""};
+  }
+  /** gv is a symbol, possibly followed by +N or -N */
+  static Arg mem(Kind kind, int i, std::string const &gv) {
+    auto sign = gv.find_first_of("+-", 1);
+    return Arg{kind, i,
+               sign == std::string::npos ? 0 : std::stoll(gv.substr(sign)),
+               gv.substr(0, sign)};
+  }
+};
+
 struct Asm {
   /** pseudos that are read */
   std::vector<Pseudo> use;
@@ -78,6 +124,10 @@ struct Asm {
    */
   const std::string repr_template;
 
+  /** The same line as an operation and its operands (NONE when fewer) */
+  const Op op;
+  const std::array<Arg, 2> args;
+
   using ptr = std::unique_ptr<Asm>;
 
 private:
@@ -86,65 +136,111 @@ private:
    * can be used to build instances
    */
   explicit Asm(std::vector<Pseudo> const &use, std::vector<Pseudo> const &def,
-               std::vector<Label> const &dests, std::string const &repr)
-      : use{use}, def{def}, jump_dests{dests}, repr_template{repr} {}
+               std::vector<Label> const &dests, std::string const &repr, Op op,
+               std::array<Arg, 2> args)
+      : use{use}, def{def}, jump_dests{dests}, repr_template{repr}, op{op},
+        args{std::move(args)} {}
+
+  static ptr directive(std::string const &directive, Op op,
+                       std::array<Arg, 2> args) {
+    return std::unique_ptr<Asm>(new Asm{
+        {}, {}, {}, std::string{"\t"} + directive, op, std::move(args)});
+  }
 
 public:
-  static ptr directive(std::string const &directive) {
-    return std::unique_ptr<Asm>(
-        new Asm{{}, {}, {}, std::string{"\t"} + directive});
+  static ptr globl(std::string const &symbol) {
+    return directive(".globl " + symbol, Op::GLOBL, {Arg::symbol(symbol)});
+  }
+
+  static ptr text() { return directive(".section .text", Op::TEXT, {}); }
+
+  static ptr data() { return directive(".section .data", Op::DATA, {}); }
+
+  static ptr align(int bytes) {
+    return directive(".align " + std::to_string(bytes), Op::ALIGN,
+                     {Arg::number(bytes)});
+  }
+
+  static ptr quad(int64_t value) {
+    return directive(".quad " + std::to_string(value), Op::QUAD,
+                     {Arg::number(value)});
+  }
+
+  /** The absolute address of symbol */
+  static ptr quad(std::string const &symbol) {
+    return directive(".quad " + symbol, Op::QUAD, {Arg::symbol(symbol)});
   }
 
   static ptr set_label(std::string const &label) {
-    return std::unique_ptr<Asm>(new Asm{{}, {}, {}, label + ":"});
+    return std::unique_ptr<Asm>(
+        new Asm{{}, {}, {}, label + ":", Op::LABEL, {Arg::symbol(label)}});
   }
 
-#define ARITH_BINOP(mnemonic)                                                     \
+#define ARITH_BINOP(mnemonic, OP)                                                 \
   static ptr mnemonic##q(int64_t imm, Pseudo const &dest) {                       \
     std::string repr = "\t" #mnemonic "q $" + std::to_string(imm) + ", `d0";      \
-    return std::unique_ptr<Asm>(new Asm{{}, {dest}, {}, repr});                   \
+    return std::unique_ptr<Asm>(new Asm{                                          \
+        {}, {dest}, {}, repr, Op::OP, {Arg::number(imm), Arg::def(0)}});          \
   }                                                                               \
   static ptr mnemonic##q(Pseudo const &src, Pseudo const &dest) {                 \
-    return std::unique_ptr<Asm>(                                                  \
-        new Asm{{src}, {dest}, {}, "\t" #mnemonic "q `s0, `d0"});                 \
+    return std::unique_ptr<Asm>(new Asm{{src},                                    \
+                                        {dest},                                   \
+                                        {},                                       \
+                                        "\t" #mnemonic "q `s0, `d0",              \
+                                        Op::OP,                                   \
+                                        {Arg::use(0), Arg::def(0)}});             \
   }                                                                               \
   static ptr mnemonic##q(int64_t i, Pseudo const &src, Pseudo const &dest) {      \
     std::string repr = "\t" #mnemonic "q " + std::to_string(i) + "(`s0), `d0";    \
-    return std::unique_ptr<Asm>(new Asm{{src}, {dest}, {}, repr});                \
+    return std::unique_ptr<Asm>(                                                  \
+        new Asm{{src}, {dest}, {}, repr, Op::OP,                                  \
+                {Arg::mem(Arg::MEM_USE, 0, i), Arg::def(0)}});                    \
   }                                                                               \
   static ptr mnemonic##q(std::string gv, Pseudo const &src, Pseudo const &dest) { \
     std::string repr = "\t" #mnemonic "q " + gv + "(`s0), `d0";                   \
-    return std::unique_ptr<Asm>(new Asm{{src}, {dest}, {}, repr});                \
+    return std::unique_ptr<Asm>(                                                  \
+        new Asm{{src}, {dest}, {}, repr, Op::OP,                                  \
+                {Arg::mem(Arg::MEM_USE, 0, gv), Arg::def(0)}});                   \
   }                                                                               \
   static ptr mnemonic##q(Pseudo const &src, std::string gv, Pseudo const &dest) { \
     std::string repr = "\t" #mnemonic "q `s0, " + gv + "(`d0)";                   \
-    return std::unique_ptr<Asm>(new Asm{{src}, {dest}, {}, repr});                \
+    return std::unique_ptr<Asm>(                                                  \
+        new Asm{{src}, {dest}, {}, repr, Op::OP,                                  \
+                {Arg::use(0), Arg::mem(Arg::MEM_DEF, 0, gv)}});                   \
   }                                                                               \
   static ptr mnemonic##q(Pseudo const &src, int64_t i, Pseudo const &dest) {      \
     std::string repr = "\t" #mnemonic "q `s0," + std::to_string(i) + "(`d0)";    \
-    return std::unique_ptr<Asm>(new Asm{{src}, {dest}, {}, repr});                \
-  }             
-
-  ARITH_BINOP(mov)
-  ARITH_BINOP(lea)
-  ARITH_BINOP(movabs)
-  ARITH_BINOP(add)
-  ARITH_BINOP(sub)
-  ARITH_BINOP(and)
-  ARITH_BINOP(or)
-  ARITH_BINOP(xor)
+    return std::unique_ptr<Asm>(                                                  \
+        new Asm{{src}, {dest}, {}, repr, Op::OP,                                  \
+                {Arg::use(0), Arg::mem(Arg::MEM_DEF, 0, i)}});                    \
+  }
+
+  ARITH_BINOP(mov, MOV)
+  ARITH_BINOP(lea, LEA)
+  ARITH_BINOP(movabs, MOVABS)
+  ARITH_BINOP(add, ADD)
+  ARITH_BINOP(sub, SUB)
+  ARITH_BINOP(and, AND)
+  ARITH_BINOP(or, OR)
+  ARITH_BINOP(xor, XOR)
 #undef ARITH_BINOP
 
   static ptr cqo() {
-    return std::unique_ptr<Asm>(new Asm{
-        {Pseudo{reg::rax}}, {Pseudo{reg::rax}, Pseudo{reg::rdx}}, {}, "\tcqo"});
+    return std::unique_ptr<Asm>(new Asm{{Pseudo{reg::rax}},
+                                        {Pseudo{reg::rax}, Pseudo{reg::rdx}},
+                                        {},
+                                        "\tcqo",
+                                        Op::CQO,
+                                        {}});
   }
 
   static ptr imulq(Pseudo const &factor) {
     return std::unique_ptr<Asm>(new Asm{{factor, Pseudo{reg::rax}},
                                         {Pseudo{reg::rax}, Pseudo{reg::rdx}},
                                         {},
-                                        "\timulq `s0"});
+                                        "\timulq `s0",
+                                        Op::IMUL,
+                                        {Arg::use(0)}});
   }
 
   static ptr idivq(Pseudo const &divisor) {
@@ -152,72 +248,106 @@ public:
         new Asm{{divisor, Pseudo{reg::rax}, Pseudo{reg::rdx}},
                 {Pseudo{reg::rax}, Pseudo{reg::rdx}},
                 {},
-                "\tidivq `s0"});
+                "\tidivq `s0",
+                Op::IDIV,
+                {Arg::use(0)}});
   }
 
   static ptr cmpq(Pseudo const &arg1, Pseudo const &arg2) {
-    return std::unique_ptr<Asm>(
-        new Asm{{arg1, arg2}, {}, {}, "\tcmpq `s0, `s1"});
+    return std::unique_ptr<Asm>(new Asm{{arg1, arg2},
+                                        {},
+                                        {},
+                                        "\tcmpq `s0, `s1",
+                                        Op::CMP,
+                                        {Arg::use(0), Arg::use(1)}});
   }
 
   static ptr cmpq(int32_t imm, Pseudo const &arg) {
     std::string repr = "cmpq $" + std::to_string(imm) + ", `s0";
-    return std::unique_ptr<Asm>(new Asm{{arg}, {}, {}, repr});
+    return std::unique_ptr<Asm>(new Asm{
+        {arg}, {}, {}, repr, Op::CMP, {Arg::number(imm), Arg::use(0)}});
   }
 
-#define ARITH_UNOP(mnemonic)                                                   \
+#define ARITH_UNOP(mnemonic, OP)                                               \
   static ptr mnemonic##q(Pseudo const &arg) {                                  \
-    return std::unique_ptr<Asm>(                                               \
-        new Asm{{arg}, {arg}, {}, "\t" #mnemonic "q `s0"});                    \
+    return std::unique_ptr<Asm>(new Asm{                                       \
+        {arg}, {arg}, {}, "\t" #mnemonic "q `s0", Op::OP, {Arg::use(0)}});     \
   }
-  ARITH_UNOP(neg)
-  ARITH_UNOP(not)
+  ARITH_UNOP(neg, NEG)
+  ARITH_UNOP(not, NOT)
 #undef ARITH_UNOP
 
+  static ptr incq(std::string gv, Pseudo const &base) {
+    return std::unique_ptr<Asm>(new Asm{{base},
+                                        {},
+                                        {},
+                                        "\tincq " + gv + "(`s0)",
+                                        Op::INC,
+                                        {Arg::mem(Arg::MEM_USE, 0, gv)}});
+  }
+
   static ptr pushq(Pseudo const &arg) {
-    return std::unique_ptr<Asm>(new Asm{{arg}, {}, {}, "\tpushq `s0"});
+    return std::unique_ptr<Asm>(
+        new Asm{{arg}, {}, {}, "\tpushq `s0", Op::PUSH, {Arg::use(0)}});
   }
 
   static ptr popq(Pseudo const &arg) {
-    return std::unique_ptr<Asm>(new Asm{{}, {arg}, {}, "\tpopq `d0"});
+    return std::unique_ptr<Asm>(
+        new Asm{{}, {arg}, {}, "\tpopq `d0", Op::POP, {Arg::def(0)}});
   }
 
-#define SHIFTOP(mnemonic)                                                      \
+#define SHIFTOP(mnemonic, OP)                                                  \
   static ptr mnemonic##q(Pseudo const &dest) {                                 \
-    return std::unique_ptr<Asm>(                                               \
-        new Asm{{Pseudo{reg::rcx}}, {dest}, {}, "\t" #mnemonic "q %cl, `d0"}); \
+    return std::unique_ptr<Asm>(new Asm{{Pseudo{reg::rcx}},                    \
+                                        {dest},                                \
+                                        {},                                    \
+                                        "\t" #mnemonic "q %cl, `d0",           \
+                                        Op::OP,                                \
+                                        {Arg::cl(), Arg::def(0)}});            \
   }
-  SHIFTOP(sar)
-  SHIFTOP(shr) // not really used in this course
-  SHIFTOP(sal)
+  SHIFTOP(sar, SAR)
+  SHIFTOP(shr, SHR) // not really used in this course
+  SHIFTOP(sal, SAL)
 #undef SHIFTOP
 
-#define BRANCH_OP(mnemonic)                                                    \
+#define BRANCH_OP(mnemonic, OP)                                                \
   static ptr mnemonic(Label const &destination) {                              \
-    return std::unique_ptr<Asm>(                                               \
-        new Asm{{}, {}, {destination}, "\t" #mnemonic " `j0"});                \
-  }
-  BRANCH_OP(jmp)
-  BRANCH_OP(je)
-  BRANCH_OP(jne)
-  BRANCH_OP(jl)
-  BRANCH_OP(jle)
-  BRANCH_OP(jg)
-  BRANCH_OP(jge)
+    return std::unique_ptr<Asm>(new Asm{{},                                    \
+                                        {},                                    \
+                                        {destination},                         \
+                                        "\t" #mnemonic " `j0",                 \
+                                        Op::OP,                                \
+                                        {Arg::dest(0)}});                      \
+  }
+  BRANCH_OP(jmp, JMP)
+  BRANCH_OP(je, JE)
+  BRANCH_OP(jne, JNE)
+  BRANCH_OP(jl, JL)
+  BRANCH_OP(jle, JLE)
+  BRANCH_OP(jg, JG)
+  BRANCH_OP(jge, JGE)
 #undef BRANCH_OP
 
   static ptr call(Label const &func) {
-    return std::unique_ptr<Asm>(
-        new Asm{{}, {Pseudo{reg::rax}}, {}, "\tcall " + func});
+    return std::unique_ptr<Asm>(new Asm{{},
+                                        {Pseudo{reg::rax}},
+                                        {},
+                                        "\tcall " + func,
+                                        Op::CALL,
+                                        {Arg::symbol(func)}});
   }
 
   static ptr call_q(Label const &func) {
-    return std::unique_ptr<Asm>(
-        new Asm{{}, {Pseudo{reg::rax}}, {}, "\tcallq " + func});
+    return std::unique_ptr<Asm>(new Asm{{},
+                                        {Pseudo{reg::rax}},
+                                        {},
+                                        "\tcallq " + func,
+                                        Op::CALL,
+                                        {Arg::symbol(func)}});
   }
 
   static ptr ret() {
-    return std::unique_ptr<Asm>(new Asm{{}, {}, {}, "\tret"});
+    return std::unique_ptr<Asm>(new Asm{{}, {}, {}, "\tret", Op::RET, {}});
   }
 };
 
@@ -0,0 +1,609 @@
+/**
+ * This file encodes AMD64 assembly lines into machine code
+ *
+ * The lines are encoded from the operation and operands of each
+ * bx::amd64::Asm (Asm::op and Asm::args), whose pseudos are looked up in its
+ * use/def vectors; the repr_template is only for printing, so no text is
+ * printed and parsed back.
+ *
+ * Classes:
+ *
+ *     bx::amd64::Assembler:
+ *         Accumulates the encoded lines and performs jump relaxation
+ *
+ * Functions:
+ *
+ *     Object bx::amd64::link(std::vector<Object> const &)
+ *         Concatenates separately assembled objects (see cache.h)
+ */
+
+#include "amd64_encode.h"
+
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace bx {
+namespace amd64 {
+
+namespace {
+
+constexpr int RIP = -1;
+
+int reg_number(Reg name) {
+  // clang-format off
+  static const std::unordered_map<std::string_view, int> numbers{
+    {"%rax", 0}, {"%rcx", 1}, {"%rdx", 2},  {"%rbx", 3},
+    {"%rsp", 4}, {"%rbp", 5}, {"%rsi", 6},  {"%rdi", 7},
+    {"%r8", 8},  {"%r9", 9},  {"%r10", 10}, {"%r11", 11},
+    {"%r12", 12}, {"%r13", 13}, {"%r14", 14}, {"%r15", 15},
+    {"%rip", RIP},
+  };
+  // clang-format on
+  auto it = numbers.find(name);
+  if (it == numbers.end())
+    throw std::runtime_error("unknown register " + std::string{name});
+  return it->second;
+}
+
+/** An operand with its pseudos resolved to registers and stack slots */
+struct Operand {
+  enum Kind : uint8_t { REG, IMM, MEM, LABEL } kind = IMM;
+  int reg = 0;     // REG: the register; MEM: the base register
+  int64_t imm = 0; // IMM: the value; MEM: the displacement
+  std::string const *sym = nullptr; // MEM: symbolic displacement; LABEL
+};
+
+Operand pseudo_operand(Pseudo const &p) {
+  if (!p.binding.has_value())
+    throw std::runtime_error("cannot encode an unbound pseudo");
+  auto const &b = p.binding.value();
+  if (auto reg = std::get_if<0>(&b))
+    return Operand{Operand::REG, reg_number(*reg)};
+  return Operand{Operand::MEM, reg_number(reg::rbp), -8 * std::get<1>(b)};
+}
+
+Operand resolve(Asm const &line, Arg const &arg) {
+  auto pseudo = [&]() -> Pseudo const & {
+    bool use = arg.kind == Arg::USE || arg.kind == Arg::MEM_USE;
+    auto const &v = use ? line.use : line.def;
+    if (arg.index < 0 || static_cast<std::size_t>(arg.index) >= v.size())
+      throw std::runtime_error{"bad operand of " + line.repr_template};
+    return v[arg.index];
+  };
+  switch (arg.kind) {
+  case Arg::USE:
+  case Arg::DEF:
+    return pseudo_operand(pseudo());
+  case Arg::IMM:
+    return Operand{Operand::IMM, 0, arg.imm};
+  case Arg::MEM_USE:
+  case Arg::MEM_DEF: {
+    auto base = pseudo_operand(pseudo());
+    if (base.kind != Operand::REG)
+      throw std::runtime_error("memory base must be a register");
+    return Operand{Operand::MEM, base.reg, arg.imm,
+                   arg.sym.empty() ? nullptr : &arg.sym};
+  }
+  case Arg::SYMBOL:
+    return Operand{Operand::LABEL, 0, 0, &arg.sym};
+  case Arg::DEST:
+    if (arg.index < 0 ||
+        static_cast<std::size_t>(arg.index) >= line.jump_dests.size())
+      throw std::runtime_error{"bad operand of " + line.repr_template};
+    return Operand{Operand::LABEL, 0, 0, &line.jump_dests[arg.index]};
+  case Arg::CL:
+    return Operand{Operand::REG, 1};
+  case Arg::NONE:
+    break;
+  }
+  throw std::runtime_error{"bad operand of " + line.repr_template};
+}
+
+bool fits8(int64_t v) { return v >= INT8_MIN && v <= INT8_MAX; }
+bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+/**
+ * A piece of the text section: either the bytes of consecutive instructions
+ * (code[begin, end), with the relocations text_relocs[reloc_begin,
+ * reloc_end)) or a jump/call
+ */
+struct Item {
+  enum Kind : uint8_t { BYTES, JUMP, CALL } kind = BYTES;
+  uint8_t cc = 0;        // JUMP: condition code, or 0xff for jmp
+  bool is_long = false;  // JUMP: rel32 instead of rel8
+  std::size_t begin = 0, end = 0;
+  std::size_t reloc_begin = 0, reloc_end = 0;
+  std::string const *target = nullptr; // JUMP, CALL
+  long target_item = -1; // JUMP, CALL: the item at the target, if local
+
+  std::size_t size() const {
+    switch (kind) {
+    case JUMP:
+      return is_long ? (cc == 0xff ? 5 : 6) : 2;
+    case CALL:
+      return 5;
+    default:
+      return end - begin;
+    }
+  }
+};
+
+void put32(std::vector<uint8_t> &out, int64_t v) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+void put64(std::vector<uint8_t> &out, int64_t v) {
+  for (int i = 0; i < 8; i++)
+    out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+class Assembler {
+  Object obj;
+  Object::Section section = Object::TEXT;
+  std::vector<Item> items;
+  // the bytes of the BYTES items, and their relocations (with offsets in
+  // code)
+  std::vector<uint8_t> code;
+  std::vector<Object::Reloc> text_relocs;
+  bool open = false; // whether the next bytes go in items.back()
+  // text labels point to the item that follows them
+  std::unordered_map<std::string, std::size_t> text_labels;
+  std::unordered_map<std::string, uint64_t> data_labels;
+  std::set<std::string> globals;
+  std::vector<std::string> symbol_order;
+
+  /** Make the next bytes of code part of a BYTES item */
+  void bytes() {
+    if (open)
+      return;
+    Item it;
+    it.begin = code.size();
+    it.reloc_begin = text_relocs.size();
+    items.push_back(it);
+    open = true;
+  }
+
+  /** End the current BYTES item, if any */
+  void close() {
+    if (!open)
+      return;
+    items.back().end = code.size();
+    items.back().reloc_end = text_relocs.size();
+    open = false;
+  }
+
+  /**
+   * Encode an instruction with a ModRM byte: REX.W prefix, opcode, then the
+   * reg field r and the register or memory operand rm. imm_size is the
+   * number of immediate bytes the caller appends afterwards (needed for the
+   * addend of %rip-relative relocations).
+   */
+  void modrm(uint8_t opcode, int r, Operand const &rm, int imm_size = 0) {
+    int base = rm.kind == Operand::MEM && rm.reg == RIP ? 0 : rm.reg;
+    code.push_back(0x48 | ((r >> 3) & 1) << 2 | ((base >> 3) & 1));
+    code.push_back(opcode);
+    if (rm.kind == Operand::REG) {
+      code.push_back(0xc0 | (r & 7) << 3 | (rm.reg & 7));
+      return;
+    }
+    if (rm.kind != Operand::MEM)
+      throw std::runtime_error("bad operand for ModRM");
+    if (rm.reg == RIP) {
+      code.push_back((r & 7) << 3 | 5);
+      if (rm.sym)
+        text_relocs.push_back(Object::Reloc{Object::TEXT, code.size(),
+                                            *rm.sym, R_X86_64_PC32,
+                                            rm.imm - 4 - imm_size});
+      put32(code, rm.sym ? 0 : rm.imm);
+      return;
+    }
+    if (rm.sym)
+      throw std::runtime_error("symbolic displacement needs %rip as base");
+    int mod = rm.imm == 0 && (rm.reg & 7) != 5 ? 0 : fits8(rm.imm) ? 1 : 2;
+    code.push_back(mod << 6 | (r & 7) << 3 | (rm.reg & 7));
+    if ((rm.reg & 7) == 4)
+      code.push_back(0x24); // SIB: no index, base = rm.reg
+    if (mod == 1)
+      code.push_back(static_cast<uint8_t>(rm.imm));
+    else if (mod == 2)
+      put32(code, rm.imm);
+  }
+
+  /** add/or/and/sub/xor/cmp: (opcode r/m <- r, opcode r <- r/m, /ext) */
+  void alu(uint8_t op_mr, uint8_t op_rm, int ext, Operand const &src,
+           Operand const &dst) {
+    if (src.kind == Operand::IMM) {
+      if (fits8(src.imm)) {
+        modrm(0x83, ext, dst, 1);
+        code.push_back(static_cast<uint8_t>(src.imm));
+      } else {
+        check32(src.imm);
+        modrm(0x81, ext, dst, 4);
+        put32(code, src.imm);
+      }
+    } else if (src.kind == Operand::REG) {
+      modrm(op_mr, src.reg, dst);
+    } else if (dst.kind == Operand::REG) {
+      modrm(op_rm, dst.reg, src);
+    } else {
+      throw std::runtime_error("cannot encode a memory-to-memory operation");
+    }
+  }
+
+  static void check32(int64_t v) {
+    if (!fits32(v))
+      throw std::runtime_error("immediate " + std::to_string(v) +
+                               " does not fit in 32 bits");
+  }
+
+  void instruction(Asm const &line) {
+    if (section != Object::TEXT)
+      throw std::runtime_error("instruction outside of .text: " +
+                               line.repr_template);
+    Operand ops[2];
+    std::size_t arity = 0;
+    for (; arity < line.args.size() && line.args[arity].kind != Arg::NONE;
+         arity++)
+      ops[arity] = resolve(line, line.args[arity]);
+    auto expect = [&](std::size_t n) {
+      if (arity != n)
+        throw std::runtime_error("wrong number of operands: " +
+                                 line.repr_template);
+    };
+    auto branch = [&](Item::Kind kind, uint8_t cc) {
+      expect(1);
+      if (ops[0].kind != Operand::LABEL)
+        throw std::runtime_error("bad target: " + line.repr_template);
+      close();
+      Item it;
+      it.kind = kind;
+      it.cc = cc;
+      it.target = ops[0].sym;
+      items.push_back(it);
+    };
+
+    switch (line.op) {
+    case Op::JMP:
+      return branch(Item::JUMP, 0xff);
+    case Op::JE:
+      return branch(Item::JUMP, 0x4);
+    case Op::JNE:
+      return branch(Item::JUMP, 0x5);
+    case Op::JL:
+      return branch(Item::JUMP, 0xc);
+    case Op::JGE:
+      return branch(Item::JUMP, 0xd);
+    case Op::JLE:
+      return branch(Item::JUMP, 0xe);
+    case Op::JG:
+      return branch(Item::JUMP, 0xf);
+    case Op::CALL:
+      return branch(Item::CALL, 0);
+    default:
+      break;
+    }
+
+    bytes();
+    switch (line.op) {
+    case Op::MOV: {
+      expect(2);
+      auto const &src = ops[0], &dst = ops[1];
+      if (src.kind == Operand::IMM) {
+        check32(src.imm);
+        modrm(0xc7, 0, dst, 4);
+        put32(code, src.imm);
+      } else if (src.kind == Operand::REG) {
+        modrm(0x89, src.reg, dst);
+      } else if (dst.kind == Operand::REG) {
+        modrm(0x8b, dst.reg, src);
+      } else {
+        throw std::runtime_error("cannot encode a memory-to-memory move");
+      }
+      break;
+    }
+    case Op::MOVABS:
+      expect(2);
+      if (ops[0].kind != Operand::IMM || ops[1].kind != Operand::REG)
+        throw std::runtime_error("movabsq needs an immediate and a register");
+      code.push_back(0x48 | ((ops[1].reg >> 3) & 1));
+      code.push_back(0xb8 | (ops[1].reg & 7));
+      put64(code, ops[0].imm);
+      break;
+    case Op::LEA:
+      expect(2);
+      if (ops[0].kind != Operand::MEM || ops[1].kind != Operand::REG)
+        throw std::runtime_error("leaq needs a memory operand and a register");
+      modrm(0x8d, ops[1].reg, ops[0]);
+      break;
+    case Op::ADD:
+      expect(2);
+      alu(0x01, 0x03, 0, ops[0], ops[1]);
+      break;
+    case Op::OR:
+      expect(2);
+      alu(0x09, 0x0b, 1, ops[0], ops[1]);
+      break;
+    case Op::AND:
+      expect(2);
+      alu(0x21, 0x23, 4, ops[0], ops[1]);
+      break;
+    case Op::SUB:
+      expect(2);
+      alu(0x29, 0x2b, 5, ops[0], ops[1]);
+      break;
+    case Op::XOR:
+      expect(2);
+      alu(0x31, 0x33, 6, ops[0], ops[1]);
+      break;
+    case Op::CMP:
+      expect(2);
+      alu(0x39, 0x3b, 7, ops[0], ops[1]);
+      break;
+    case Op::NOT:
+    case Op::NEG:
+    case Op::IMUL:
+    case Op::IDIV:
+      expect(1);
+      modrm(0xf7,
+            line.op == Op::NOT    ? 2
+            : line.op == Op::NEG  ? 3
+            : line.op == Op::IMUL ? 5
+                                  : 7,
+            ops[0]);
+      break;
+    case Op::INC:
+      expect(1);
+      modrm(0xff, 0, ops[0]);
+      break;
+    case Op::SAL:
+    case Op::SHR:
+    case Op::SAR:
+      expect(2); // the count is always %cl
+      modrm(0xd3, line.op == Op::SAL ? 4 : line.op == Op::SHR ? 5 : 7,
+            ops[1]);
+      break;
+    case Op::CQO:
+      code.insert(code.end(), {0x48, 0x99});
+      break;
+    case Op::PUSH:
+    case Op::POP: {
+      expect(1);
+      bool push = line.op == Op::PUSH;
+      if (ops[0].kind == Operand::REG) {
+        if (ops[0].reg >= 8)
+          code.push_back(0x41);
+        code.push_back((push ? 0x50 : 0x58) | (ops[0].reg & 7));
+        break;
+      }
+      // push/pop default to 64 bits: drop the REX.W added by modrm()
+      auto start = code.size();
+      auto reloc = text_relocs.size();
+      modrm(push ? 0xff : 0x8f, push ? 6 : 0, ops[0]);
+      code[start] &= ~0x08;
+      if (code[start] == 0x40) {
+        code.erase(code.begin() + start);
+        for (auto r = reloc; r < text_relocs.size(); r++)
+          text_relocs[r].offset--;
+      }
+      break;
+    }
+    case Op::RET:
+      code.push_back(0xc3);
+      break;
+    default:
+      throw std::runtime_error("cannot encode instruction: " +
+                               line.repr_template);
+    }
+  }
+
+  void directive(Asm const &line) {
+    auto const *arg = &line.args[0];
+    switch (line.op) {
+    case Op::GLOBL:
+      globals.insert(arg->sym);
+      break;
+    case Op::TEXT:
+      section = Object::TEXT;
+      break;
+    case Op::DATA:
+      section = Object::DATA;
+      break;
+    case Op::ALIGN:
+      // jump relaxation moves the code around, so only data can be aligned
+      if (section != Object::DATA)
+        throw std::runtime_error("unsupported alignment in .text");
+      while (obj.data.size() % static_cast<std::size_t>(arg->imm))
+        obj.data.push_back(0);
+      break;
+    case Op::QUAD: {
+      if (section == Object::TEXT)
+        bytes();
+      auto &out = section == Object::DATA ? obj.data : code;
+      if (arg->kind == Arg::IMM) {
+        put64(out, arg->imm);
+        break;
+      }
+      // an absolute address: resolved by the linker or the loader
+      auto reloc = Object::Reloc{section, out.size(), arg->sym, R_X86_64_64, 0};
+      (section == Object::DATA ? obj.relocs : text_relocs).push_back(reloc);
+      put64(out, 0);
+      break;
+    }
+    default:
+      throw std::runtime_error("unsupported directive " + line.repr_template);
+    }
+  }
+
+  void label(std::string const &name) {
+    close();
+    bool fresh = section == Object::TEXT
+                     ? text_labels.emplace(name, items.size()).second
+                     : data_labels.emplace(name, obj.data.size()).second;
+    if (!fresh || (section == Object::TEXT && data_labels.count(name)) ||
+        (section == Object::DATA && text_labels.count(name)))
+      throw std::runtime_error("label " + name + " defined twice");
+    if (name.rfind(".L", 0) != 0)
+      symbol_order.push_back(name);
+  }
+
+  /**
+   * Lay out the items, turning short jumps whose target is too far into
+   * long ones until nothing changes. Returns the offset of every item
+   * (with one extra entry for the end of the section).
+   */
+  std::vector<uint64_t> layout() {
+    for (auto &it : items)
+      if (it.kind != Item::BYTES) {
+        auto target = text_labels.find(*it.target);
+        if (target != text_labels.end())
+          it.target_item = static_cast<long>(target->second);
+        else
+          it.is_long = true;
+      }
+    std::vector<uint64_t> offsets(items.size() + 1);
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (std::size_t i = 0; i < items.size(); i++)
+        offsets[i + 1] = offsets[i] + items[i].size();
+      for (std::size_t i = 0; i < items.size(); i++) {
+        auto &it = items[i];
+        if (it.kind != Item::JUMP || it.is_long)
+          continue;
+        int64_t disp = static_cast<int64_t>(offsets[it.target_item]) -
+                       static_cast<int64_t>(offsets[i] + 2);
+        if (!fits8(disp))
+          it.is_long = changed = true;
+      }
+    }
+    return offsets;
+  }
+
+public:
+  void line(Asm const &line) {
+    switch (line.op) {
+    case Op::LABEL:
+      return label(line.args[0].sym);
+    case Op::GLOBL:
+    case Op::TEXT:
+    case Op::DATA:
+    case Op::ALIGN:
+    case Op::QUAD:
+      return directive(line);
+    default:
+      return instruction(line);
+    }
+  }
+
+  Object finish() {
+    close();
+    auto offsets = layout();
+    obj.text.reserve(offsets.back());
+    for (std::size_t i = 0; i < items.size(); i++) {
+      auto &it = items[i];
+      uint64_t here = obj.text.size();
+      if (it.kind == Item::BYTES) {
+        for (auto r = it.reloc_begin; r < it.reloc_end; r++) {
+          obj.relocs.push_back(std::move(text_relocs[r]));
+          obj.relocs.back().offset += here - it.begin;
+        }
+        obj.text.insert(obj.text.end(), code.begin() + it.begin,
+                        code.begin() + it.end);
+        continue;
+      }
+      if (it.kind == Item::JUMP) {
+        if (it.cc == 0xff) {
+          obj.text.push_back(it.is_long ? 0xe9 : 0xeb);
+        } else if (it.is_long) {
+          obj.text.push_back(0x0f);
+          obj.text.push_back(0x80 | it.cc);
+        } else {
+          obj.text.push_back(0x70 | it.cc);
+        }
+      } else {
+        obj.text.push_back(0xe8);
+      }
+      if (it.target_item < 0) {
+        obj.relocs.push_back(Object::Reloc{
+            Object::TEXT, obj.text.size(), *it.target,
+            it.kind == Item::CALL ? R_X86_64_PLT32 : R_X86_64_PC32, -4});
+        put32(obj.text, 0);
+        continue;
+      }
+      int64_t disp = static_cast<int64_t>(offsets[it.target_item]) -
+                     static_cast<int64_t>(here + it.size());
+      if (it.kind == Item::JUMP && !it.is_long)
+        obj.text.push_back(static_cast<uint8_t>(disp));
+      else
+        put32(obj.text, disp);
+    }
+    for (auto const &name : symbol_order) {
+      auto t = text_labels.find(name);
+      if (t != text_labels.end())
+        obj.symbols.push_back(Object::Symbol{name, Object::TEXT,
+                                             offsets[t->second],
+                                             globals.count(name) > 0});
+      else
+        obj.symbols.push_back(Object::Symbol{name, Object::DATA,
+                                             data_labels.at(name),
+                                             globals.count(name) > 0});
+    }
+    return std::move(obj);
+  }
+};
+
+} // namespace
+
+Object assemble(std::vector<std::vector<std::unique_ptr<Asm>>> const &prog) {
+  Assembler as;
+  for (auto const &fun : prog)
+    for (auto const &l : fun)
+      as.line(*l);
+  return as.finish();
+}
+
+Object link(std::vector<Object> const &parts) {
+  Object obj;
+  std::unordered_map<std::string, uint64_t> text_symbols;
+  std::set<std::string> defined;
+  for (auto const &part : parts) {
+    // the data of every part was laid out from an 8-aligned start
+    while (obj.data.size() % 8)
+      obj.data.push_back(0);
+    uint64_t base[2] = {obj.text.size(), obj.data.size()};
+    obj.text.insert(obj.text.end(), part.text.begin(), part.text.end());
+    obj.data.insert(obj.data.end(), part.data.begin(), part.data.end());
+    for (auto sym : part.symbols) {
+      if (!defined.insert(sym.name).second)
+        throw std::runtime_error("label " + sym.name + " defined twice");
+      sym.offset += base[sym.section];
+      if (sym.section == Object::TEXT)
+        text_symbols.emplace(sym.name, sym.offset);
+      obj.symbols.push_back(std::move(sym));
+    }
+    for (auto r : part.relocs) {
+      r.offset += base[r.section];
+      obj.relocs.push_back(std::move(r));
+    }
+  }
+  std::vector<Object::Reloc> kept;
+  for (auto &r : obj.relocs) {
+    auto target = text_symbols.find(r.symbol);
+    if (r.section != Object::TEXT || r.type == R_X86_64_64 ||
+        target == text_symbols.end()) {
+      kept.push_back(std::move(r));
+      continue;
+    }
+    auto disp = static_cast<int64_t>(target->second) + r.addend -
+                static_cast<int64_t>(r.offset);
+    for (int i = 0; i < 4; i++)
+      obj.text[r.offset + i] = static_cast<uint8_t>(disp >> (8 * i));
+  }
+  obj.relocs = std::move(kept);
+  return obj;
+}
+
+} // namespace amd64
+} // namespace bx
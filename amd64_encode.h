@@ -0,0 +1,66 @@
+#pragma once
+
+/**
+ * An in-process assembler for the subset of AMD64 that bx::amd64::Asm can
+ * produce. It turns assembly lines directly into machine code, from their
+ * operation and operands (Asm::op and Asm::args), with the symbols and
+ * relocations needed to write an object file (see elf_object.h) or to load
+ * the code in memory.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "amd64.h"
+
+namespace bx {
+namespace amd64 {
+
+/** Relocation types, with the numbering of the AMD64 ELF psABI */
+enum RelocType : uint32_t {
+  R_X86_64_64 = 1,    // absolute 64-bit address
+  R_X86_64_PC32 = 2,  // 32-bit pc-relative (data references)
+  R_X86_64_PLT32 = 4, // 32-bit pc-relative (calls)
+};
+
+struct Object {
+  enum Section : uint8_t { TEXT, DATA };
+
+  struct Symbol {
+    std::string name;
+    Section section;
+    uint64_t offset;
+    bool global;
+  };
+
+  /** A reference to a symbol that could not be resolved by the assembler */
+  struct Reloc {
+    Section section;
+    uint64_t offset;
+    std::string symbol;
+    RelocType type;
+    int64_t addend;
+  };
+
+  std::vector<uint8_t> text, data;
+  std::vector<Symbol> symbols; // defined symbols (.L labels are not kept)
+  std::vector<Reloc> relocs;
+};
+
+/**
+ * Assemble the lines in order, as gas would if they were printed to a .s
+ * file. Jumps to local labels are resolved (using short jumps when they
+ * fit); references to other symbols become relocations.
+ */
+Object assemble(std::vector<std::vector<std::unique_ptr<Asm>>> const &prog);
+
+/**
+ * Concatenate objects assembled separately, as if their lines had been
+ * assembled together: the calls and jumps from the text of one part to a
+ * text symbol of another are resolved, the other relocations are kept.
+ */
+Object link(std::vector<Object> const &parts);
+
+} // namespace amd64
+} // namespace bx
@@ -1,7 +1,11 @@
 #include "ast.h"
 
+#include <fstream>
+
+#ifdef BX_ANTLR
 #include "BXLexer.h"
 #include "BXParser.h"
+#endif
 
 namespace bx {
 
@@ -43,6 +47,14 @@ int sizeOf(Type* typ){
   return 0;
 }
 
+bool holdsPointers(Type* typ){
+  if (dynamic_cast<POINTER *>(typ))
+    return true;
+  if (auto lst = dynamic_cast<LIST *>(typ))
+    return holdsPointers(lst->typ);
+  return false;
+}
+
 std::ostream &operator<<(std::ostream &out, const Binop op) {
   switch (op) {
     // clang-format off
@@ -258,6 +270,8 @@ std::ostream &Callable::print(std::ostream &out) const {
   out << ") ";
   if ( dynamic_cast<UNKNOWN * const >(return_ty) == NULL)
     out << " : " << *return_ty << ' ';
+  if (!body)
+    return out << ';';
   return out << *body;
 }
 
@@ -268,7 +282,27 @@ std::ostream &GlobalVar::print(std::ostream &out) const {
   return out << " : " << *ty << ';';
 }
 
+Callable const *Program::find_callable(std::string const &name) const {
+  auto cbl = callables.find(name);
+  if (cbl != callables.end())
+    return cbl->second.get();
+  auto ext = extern_callables.find(name);
+  return ext != extern_callables.end() ? ext->second.get() : nullptr;
+}
+
+GlobalVar const *Program::find_global(std::string const &name) const {
+  auto gv = global_vars.find(name);
+  if (gv != global_vars.end())
+    return gv->second.get();
+  auto ext = extern_vars.find(name);
+  return ext != extern_vars.end() ? ext->second.get() : nullptr;
+}
+
 std::ostream &operator<<(std::ostream &out, Program const &prog) {
+  for (auto const &v : prog.extern_vars)
+    out << "extern " << *v.second << '\n';
+  for (auto const &cbl : prog.extern_callables)
+    out << "extern " << *cbl.second << '\n';
   for (auto const &v : prog.global_vars)
     out << *v.second << '\n';
   for (auto const &cbl : prog.callables)
@@ -276,16 +310,20 @@ std::ostream &operator<<(std::ostream &out, Program const &prog) {
   return out;
 }
 
+#ifdef BX_ANTLR
+
 class ASTCreator {
 public:
   Program read_program(BXParser::ProgramContext *ctx) {
-    Program::CallTable callables;
-    Program::GlobalVarTable global_vars;
+    Program::CallTable callables, extern_callables;
+    Program::GlobalVarTable global_vars, extern_vars;
     auto check_unique_name = [&](auto const &name) {
-      if (global_vars.find(name) != global_vars.end())
+      if (global_vars.find(name) != global_vars.end() ||
+          extern_vars.find(name) != extern_vars.end())
         throw std::runtime_error("Redeclaration of existing global var " +
                                  name);
-      if (callables.find(name) != callables.end())
+      if (callables.find(name) != callables.end() ||
+          extern_callables.find(name) != extern_callables.end())
         throw std::runtime_error("Redeclaration of existing callable " + name +
                                  "()");
     };
@@ -303,10 +341,35 @@ public:
         auto c = read_func(func_ctx);
         check_unique_name(c->name);
         callables.insert_or_assign(c->name, std::move(c));
+      } else if (auto ev_ctx =
+                     dynamic_cast<BXParser::ExternVarContext *>(child)) {
+        Type *ty = read_type(ev_ctx->type());
+        for (auto *id : ev_ctx->ID()) {
+          auto name = id->getText();
+          check_unique_name(name);
+          extern_vars.insert_or_assign(
+              name, GlobalVar::make(name, ty, ExprPtr{nullptr}));
+        }
+      } else if (auto ep_ctx =
+                     dynamic_cast<BXParser::ExternProcContext *>(child)) {
+        auto name = ep_ctx->ID()->getText();
+        check_unique_name(name);
+        extern_callables.insert_or_assign(
+            name, Callable::make(name, read_params(ep_ctx->parameter_groups()),
+                                 BlockPtr{nullptr}, new UNKNOWN()));
+      } else if (auto ef_ctx =
+                     dynamic_cast<BXParser::ExternFuncContext *>(child)) {
+        auto name = ef_ctx->ID()->getText();
+        check_unique_name(name);
+        extern_callables.insert_or_assign(
+            name, Callable::make(name, read_params(ef_ctx->parameter_groups()),
+                                 BlockPtr{nullptr},
+                                 read_type(ef_ctx->type())));
       } else
         throw new std::runtime_error("Unknown top level declaration");
     }
-    return Program{std::move(global_vars), std::move(callables)};
+    return Program{std::move(global_vars), std::move(callables),
+                   std::move(extern_vars), std::move(extern_callables)};
   }
 
 private:
@@ -333,6 +396,15 @@ private:
     return vars;
   }
 
+  Callable::Params read_params(BXParser::Parameter_groupsContext *ctx) {
+    Callable::Params params;
+    if (ctx)
+      for (auto *param_ctx : ctx->param())
+        for (auto &p : read_param(param_ctx))
+          params.push_back(p);
+    return params;
+  }
+
   CallablePtr read_proc(BXParser::ProcContext *ctx) {
     std::string name = ctx->ID()->getText();
     Callable::Params params;
@@ -547,7 +619,7 @@ private:
   }
 };
 
-Program read_program(std::string file) {
+Program read_program_antlr(std::string file) {
   std::ifstream stream;
   stream.open(file);
   antlr4::ANTLRInputStream input(stream);
@@ -558,6 +630,8 @@ Program read_program(std::string file) {
   return ASTCreator{}.read_program(prog_ctx);
 }
 
+#endif // BX_ANTLR
+
 } // namespace source
 
 } // namespace bx
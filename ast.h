@@ -1,10 +1,11 @@
 #pragma once
 
+#include <climits>
 #include <memory>
 #include <ostream>
 #include <string>
-
-#include "antlr4-runtime.h"
+#include <unordered_map>
+#include <vector>
 
 #ifndef DECLARE_HEAP_STRUCT
 #define DECLARE_HEAP_STRUCT(Cls)                                               \
@@ -68,6 +69,8 @@ struct LIST: Type{
 };
 
 int sizeOf(Type* typ);
+/** Whether a value of type typ may hold the address of a heap block */
+bool holdsPointers(Type* typ);
 //std::ostream &operator<<(std::ostream &out, Type const ty);
 
 
@@ -421,16 +424,34 @@ struct Program {
   GlobalVarTable global_vars;
   using CallTable = std::unordered_map<std::string, CallablePtr>;
   CallTable callables;
-  explicit Program(GlobalVarTable &&global_vars, CallTable &&callables)
-      : global_vars{std::move(global_vars)}, callables{std::move(callables)} {}
+  // declared extern: defined in another module, without init or body
+  GlobalVarTable extern_vars;
+  CallTable extern_callables;
+  explicit Program(GlobalVarTable &&global_vars, CallTable &&callables,
+                   GlobalVarTable &&extern_vars = {},
+                   CallTable &&extern_callables = {})
+      : global_vars{std::move(global_vars)}, callables{std::move(callables)},
+        extern_vars{std::move(extern_vars)},
+        extern_callables{std::move(extern_callables)} {}
+
+  /** The callable or extern callable called name, or nullptr */
+  Callable const *find_callable(std::string const &name) const;
+  /** The global or extern variable called name, or nullptr */
+  GlobalVar const *find_global(std::string const &name) const;
 };
 std::ostream &operator<<(std::ostream &out, Program const &prog);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Parsing
 
+/** Parse a file with the hand-written parser of parser.h */
 source::Program read_program(std::string file);
 
+#ifdef BX_ANTLR
+/** Parse a file with the parser that ANTLR generates from BX.g4 */
+source::Program read_program_antlr(std::string file);
+#endif
+
 } // namespace source
 } // namespace bx
 
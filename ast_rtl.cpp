@@ -1,7 +1,9 @@
+#include <set>
 #include <stdexcept>
 
 #include "amd64.h"
 #include "ast_rtl.h"
+#include "checks.h"
 
 namespace bx {
 
@@ -9,12 +11,6 @@ namespace rtl {
 
 using source::Type;
 
-int last_pseudo = 0;
-inline rtl::Pseudo fresh_pseudo() { return rtl::Pseudo{last_pseudo++}; }
-
-int last_label = 0;
-inline rtl::Label fresh_label() { return rtl::Label{last_label++}; }
-
 /**
  * List of global variable initializations
  */
@@ -25,11 +21,25 @@ std::map<std::string, int> global_var_init;
  */
 std::map<std::string, int> global_var_offset;
 
+/**
+ * Global variables declared extern, defined by another module
+ */
+std::set<std::string> global_var_extern;
+
+static bool is_global(std::string const &v) {
+  return global_var_init.count(v) || global_var_extern.count(v);
+}
+
 /**
  * Size of heap
  */
 int globaloffset = 0;
 
+/**
+ * Largest local list zeroed with inline stores rather than a memset() call
+ */
+constexpr int INLINE_ZERO_MAX = 64;
+
 /**
  * A common generator for both expressions and statements
  *
@@ -64,9 +74,18 @@ struct RtlGen : public source::StmtVisitor,
    */
   rtl::Pseudo address{-1};
 
+  /** The run-time checks emitted and avoided */
+  checks::Stats check_stats;
+
 private:
   source::Program const &source_prog;
   rtl::Callable rtl_cbl;
+  checks::Options const &options;
+  checks::Facts facts;
+  /** lists whose zero initialization is dead */
+  std::unordered_set<source::Declare const *> overwritten;
+  /** The call of bx_panic() that failed checks jump to, if any yet */
+  rtl::Label panic_label{-1};
 
   /**
    * Mapping from variables to pseudos
@@ -78,6 +97,12 @@ private:
    */
   std::unordered_map<std::string, int> var_offset;
 
+  /**
+   * The local variables stored in the frame rather than in their pseudo:
+   * the lists, and the variables whose address is taken
+   */
+  std::set<std::string> in_memory;
+
   /**
    * List of global variables
    */
@@ -93,7 +118,7 @@ private:
    * mapping. Return the pseudo in either case.
    */
   rtl::Pseudo get_pseudo(std::string const &v, int offset) {
-    if (global_var_init.find(v) != global_var_init.end()) {
+    if (is_global(v)) {
       if (gvar_table.find(v) == gvar_table.end()) {
         auto ps = fresh_pseudo();
         lastoffset += offset;
@@ -108,10 +133,42 @@ private:
       var_table.insert_or_assign(v, fresh_pseudo());
       var_offset.insert_or_assign(v, lastoffset);
       lastoffset += offset;
+      if (in_memory.count(v)) {
+        // going down from -var_offset(%rbp), clear of the pseudos
+        var_offset.insert_or_assign(v, rtl_cbl.locals + 8);
+        rtl_cbl.locals += offset;
+      }
     }
     return var_table.at(v);
   }
 
+  /** Record r as a root of the garbage collector if its type needs it */
+  void note_root(rtl::Pseudo r, Type *ty) {
+    if (source::holdsPointers(ty))
+      rtl_cbl.roots.push_back(r);
+  }
+
+  /** The same for local variable v and the frame words where it is stored */
+  void note_variable_root(std::string const &v, Type *ty) {
+    if (!source::holdsPointers(ty) || var_table.find(v) == var_table.end())
+      return;
+    rtl_cbl.roots.push_back(var_table.at(v));
+    if (in_memory.count(v))
+      for (int k = 0; k < source::sizeOf(ty); k += 8)
+        rtl_cbl.frame_roots.push_back(-var_offset.at(v) - k);
+  }
+
+  /** Write the pseudo of local variable v to its frame slot, if it has one */
+  void store_variable(std::string const &v) {
+    if (!in_memory.count(v))
+      return;
+    auto pr = var_table.at(v);
+    add_sequential([&](auto next) {
+      return Store::make(pr, "", discard_pr, bx::amd64::reg::rbp,
+                         -var_offset.at(v), next);
+    });
+  }
+
   rtl::Pseudo get_pseudo(source::Variable const &v) {
     return get_pseudo(v.label, source::sizeOf(v.meta->ty));
   }
@@ -142,6 +199,9 @@ private:
     in_label = next_label;
   }
 
+  rtl::Label fresh_label() { return rtl_cbl.fresh_label(); }
+  rtl::Pseudo fresh_pseudo() { return rtl_cbl.fresh_pseudo(); }
+
   /**
    * Get a fresh copy of the result to avoid clobbering it
    */
@@ -153,18 +213,21 @@ private:
   }
 
 public:
-  RtlGen(source::Program const &source_prog, std::string const &name)
-      : source_prog{source_prog}, rtl_cbl{name} {
-
-    // Store the number of pseudos to computer later the number of tmps
-    int pseudoCounter = last_pseudo;
+  RtlGen(source::Program const &source_prog, std::string const &name,
+         checks::Options const &options)
+      : source_prog{source_prog}, rtl_cbl{name}, options{options} {
 
     // Source callable
     auto &cbl = source_prog.callables.at(rtl_cbl.name);
+    if (options.bounds || options.null)
+      facts = checks::analyze(source_prog, *cbl);
+    overwritten = checks::overwritten_lists(*cbl);
+    in_memory = checks::address_taken(*cbl);
 
     // input pseudos
     for (auto const &param : cbl->args) {
       Pseudo reg = get_pseudo(param.first, source::sizeOf(param.second));
+      note_variable_root(param.first, param.second);
       rtl_cbl.input_regs.push_back(reg);
     }
 
@@ -224,12 +287,14 @@ public:
           return CopyMP::make(regargs[i], rtl_cbl.input_regs[i], next);
         });
       }
-      for (int i = 6; i < nArgs + 1; i++) {
+      for (int i = 6; i < nArgs; i++) {
         add_sequential([&](auto next) {
           return LoadParam::make(i - 5, rtl_cbl.input_regs[i], next);
         });
       }
     }
+    for (auto const &param : cbl->args)
+      store_variable(param.first);
     // Process all the statements
     cbl->body->accept(*this);
 
@@ -248,7 +313,6 @@ public:
       });
     }
     // Update the size of NewFrame
-    pseudoCounter -= last_pseudo;
     rtl_cbl.add_instr(tmpin, NewFrame::make(fresh, lastoffset));
 
     // Insert a Delframe
@@ -265,6 +329,78 @@ public:
 
   rtl::Callable &&deliver() { return std::move(rtl_cbl); }
 
+  rtl::Label panic() {
+    if (panic_label.id < 0) {
+      panic_label = fresh_label();
+      auto after = fresh_label();
+      rtl_cbl.add_instr(panic_label, Call::make("bx_panic", 0, after));
+      rtl_cbl.add_instr(after, Goto::make(rtl_cbl.leave));
+    }
+    return panic_label;
+  }
+
+  /**
+   * With --checked, panic unless 0 <= idx < the length of the list that
+   * lelm indexes, when this is not proven already
+   */
+  void check_bounds(source::ListElem const &lelm, rtl::Pseudo idx) {
+    auto lst = dynamic_cast<source::LIST *>(lelm.lst->meta->ty);
+    if (!options.bounds || !lst)
+      return;
+    if (facts.in_bounds.count(&lelm)) {
+      check_stats.bounds_proven++;
+      return;
+    }
+    check_stats.bounds++;
+    source::IntConstant::make(0)->accept(*this);
+    auto zero = result;
+    add_sequential([&](auto next) {
+      return Bbranch::make(Bbranch::JL, idx, zero, panic(), next);
+    });
+    source::IntConstant::make(lst->length)->accept(*this);
+    auto length = result;
+    add_sequential([&](auto next) {
+      return Bbranch::make(Bbranch::JGE, idx, length, panic(), next);
+    });
+  }
+
+  /**
+   * With --checked, panic if the pointer ptr that access goes through is
+   * null, when it is not proven otherwise
+   */
+  void check_null(source::Expr const &access, rtl::Pseudo ptr) {
+    if (!options.null)
+      return;
+    if (facts.non_null.count(&access)) {
+      check_stats.null_proven++;
+      return;
+    }
+    check_stats.null++;
+    add_sequential([&](auto next) {
+      return Ubranch::make(Ubranch::JZ, ptr, panic(), next);
+    });
+  }
+
+  /** A pseudo with the address of the element of a pointer, p[i] */
+  rtl::Pseudo pointer_element(source::ListElem const &lelm,
+                              source::POINTER *ptr) {
+    lelm.lst->accept(*this);
+    auto elem = copy_of_result();
+    rtl_cbl.roots.push_back(elem);
+    check_null(lelm, elem);
+    lelm.idx->accept(*this);
+    auto offset = copy_of_result();
+    source::IntConstant::make(source::sizeOf(ptr->typ))->accept(*this);
+    auto scale = result;
+    add_sequential([&](auto next) {
+      return Binop::make(rtl::Binop::MUL, scale, offset, next);
+    });
+    add_sequential([&](auto next) {
+      return Binop::make(rtl::Binop::ADD, offset, elem, next);
+    });
+    return elem;
+  }
+
   void addMemset(int offset, int size) {
     //auto offset = lastoffset;
     /*auto rbp = fresh_pseudo();
@@ -301,27 +437,51 @@ public:
     });
     add_sequential([&](auto next) { return Call::make("memset", 3, next); });
   }
+  /**
+   * Zero the elements of the local list at -offset(%rbp): element k is at
+   * -offset - 8k(%rbp), so the list spans down to -offset - size + 8
+   */
+  void addZero(int offset, int size) {
+    if (size > INLINE_ZERO_MAX) {
+      addMemset(offset + size - 8, size);
+      return;
+    }
+    source::IntConstant::make(0)->accept(*this);
+    auto pzero = result;
+    for (int k = 0; k < size; k += 8)
+      add_sequential([&](auto next) {
+        return Store::make(pzero, "", discard_pr, bx::amd64::reg::rbp,
+                           -offset - k, next);
+      });
+  }
+
   void visit(source::Declare const &dec) override {
     if (dynamic_cast<source::BOOL *>(dec.ty)) {
       auto pr = get_pseudo(dec.var, 8);
       dec.init->accept(*this);
       intify();
       add_sequential([&](auto next) { return Copy::make(result, pr, next); });
+      store_variable(dec.var);
     }
     if (dynamic_cast<source::INT64 *>(dec.ty)) {
       auto pr = get_pseudo(dec.var, 8);
       dec.init->accept(*this);
       add_sequential([&](auto next) { return Copy::make(result, pr, next); });
+      store_variable(dec.var);
     }
     if (dynamic_cast<source::POINTER *>(dec.ty)) {
       auto pr = get_pseudo(dec.var, 8);
+      note_variable_root(dec.var, dec.ty);
       dec.init->accept(*this);
       add_sequential([&](auto next) { return Copy::make(result, pr, next); });
+      store_variable(dec.var);
     }
     if (auto lst = dynamic_cast<source::LIST *>(dec.ty)) {
+      in_memory.insert(dec.var);
       auto pr = get_pseudo(dec.var, source::sizeOf(lst));
-      std::cout << pr << std::endl;
-      addMemset(var_offset.at(dec.var), source::sizeOf(lst));
+      note_variable_root(dec.var, dec.ty);
+      if (!overwritten.count(&dec))
+        addZero(var_offset.at(dec.var), source::sizeOf(lst));
       dec.init->accept(*this);
       add_sequential([&](auto next) { return Copy::make(result, pr, next);
       });
@@ -329,6 +489,15 @@ public:
   }
 
   void visit(source::Assign const &mv) override {
+    auto var = dynamic_cast<source::Variable const *>(mv.left.get());
+    if (var && var_table.count(var->label) && !in_memory.count(var->label)) {
+      auto pr = var_table.at(var->label);
+      mv.right->accept(*this);
+      if (dynamic_cast<source::BOOL *>(mv.right->meta->ty))
+        intify();
+      add_sequential([&](auto next) { return Copy::make(result, pr, next); });
+      return;
+    }
     mv.left->acceptAddress(*this);
     auto source_reg = address;
     mv.right->accept(*this);
@@ -423,7 +592,20 @@ public:
   }
 
   void visit(source::Variable const &v) override {
-    result = get_pseudo(v);
+    if (is_global(v.label) ||
+        (in_memory.count(v.label) &&
+         !dynamic_cast<source::LIST *>(v.meta->ty))) {
+      // read it each time: calls and stores through pointers can change it
+      v.acceptAddress(*this);
+      result = fresh_pseudo();
+      lastoffset += 8;
+      add_sequential([&](auto next) {
+        return Load::make("", 0, result, address, bx::amd64::reg::rip, next);
+      });
+    } else {
+      result = get_pseudo(v);
+    }
+    note_root(result, v.meta->ty);
     if (dynamic_cast<source::BOOL *>(v.meta->ty)) {
       false_label = fresh_label();
       add_sequential([&](auto next) {
@@ -575,6 +757,7 @@ public:
                              bx::amd64::reg::rdx, bx::amd64::reg::rcx,
                              bx::amd64::reg::r8,  bx::amd64::reg::r9};
     bool stackParams = nArgs > 6;
+    int stackWords = stackParams ? (nArgs - 6 + 1) / 2 * 2 : 0;
     if (!stackParams) {
       for (int i = 0; i < nArgs; i++) {
         add_sequential(
@@ -585,25 +768,38 @@ public:
         add_sequential(
             [&](auto next) { return CopyPM::make(args[i], regargs[i], next); });
       }
-      for (int i = 0; i < nArgs - 5; i++) {
+      // the seventh argument ends on top of the stack; an odd number of
+      // them sits on a padding word, so that %rsp stays 16-byte aligned
+      if (stackWords % 2)
+        add_sequential(
+            [&](auto next) { return Push::make(args[nArgs - 1], next); });
+      for (int i = nArgs - 1; i >= 6; i--) {
         add_sequential(
-            [&](auto next) { return Push::make(args[nArgs - i], next); });
+            [&](auto next) { return Push::make(args[i], next); });
       }
     }
     if (dynamic_cast<source::UNKNOWN *>(
-            source_prog.callables.at(ca.func)->return_ty)) {
+            source_prog.find_callable(ca.func)->return_ty)) {
       result = rtl::discard_pr;
     } else {
       result = fresh_pseudo();
       lastoffset += 8;
+      note_root(result, source_prog.find_callable(ca.func)->return_ty);
     }
     add_sequential([&](auto next) { return Call::make(ca.func, nArgs, next); });
     if (!dynamic_cast<source::UNKNOWN *>(
-            source_prog.callables.at(ca.func)->return_ty)) {
+            source_prog.find_callable(ca.func)->return_ty)) {
       add_sequential([&](auto next) {
         return CopyMP::make(bx::amd64::reg::rax, result, next);
       });
     }
+    // drop the stack arguments
+    if (stackWords > 0) {
+      auto popped = fresh_pseudo();
+      lastoffset += 8;
+      for (int i = 0; i < stackWords; i++)
+        add_sequential([&](auto next) { return Pop::make(popped, next); });
+    }
   }
 
   void visit(source::Alloc const &al) override {
@@ -611,17 +807,20 @@ public:
     iscale->accept(*this);
     auto scale = result;
     al.size->accept(*this);
-    auto length = result;
+    auto length = copy_of_result(); // scaled in place
     add_sequential([&](auto next) {
       return Binop::make(rtl::Binop::MUL, scale, length, next);
     });
     add_sequential([&](auto next) {
       return CopyPM::make(length, bx::amd64::reg::rdi, next);
     });
-    std::string func = "malloc";
+    // the collector only scans the blocks that may hold pointers
+    std::string func =
+        source::holdsPointers(al.typ) ? "bx_alloc_refs" : "bx_alloc";
     add_sequential([&](auto next) { return Call::make(func, 1, next); });
     auto ps = fresh_pseudo();
     lastoffset += 8;
+    rtl_cbl.roots.push_back(ps);
     add_sequential(
         [&](auto next) { return CopyMP::make(bx::amd64::reg::rax, ps, next); });
     result = ps;
@@ -638,10 +837,22 @@ public:
   }
 
   void visit(source::ListElem const &lelm) override {
+    if (auto ptr = dynamic_cast<source::POINTER *>(lelm.lst->meta->ty)) {
+      auto elem = pointer_element(lelm, ptr);
+      auto ps = fresh_pseudo();
+      lastoffset += 8;
+      note_root(ps, lelm.meta->ty);
+      add_sequential([&](auto next) {
+        return Load::make("", 0, ps, elem, bx::amd64::reg::rip, next);
+      });
+      result = ps;
+      return;
+    }
     lelm.lst->acceptAddress(*this);
     auto lstaddress = address;
     lelm.idx->accept(*this);
-    auto idx = result;
+    auto idx = copy_of_result(); // scaled in place
+    check_bounds(lelm, idx);
     source::IntConstantPtr iscale;
     if (auto lst = dynamic_cast<source::LIST *>(lelm.lst->meta->ty)) {
       iscale = source::IntConstant::make(sizeOf(lst->typ));
@@ -656,6 +867,7 @@ public:
     });
     auto ps = fresh_pseudo();
     lastoffset += 8;
+    note_root(ps, lelm.meta->ty);
     add_sequential([&](auto next) {
       return Load::make("", 0, ps, lstaddress, bx::amd64::reg::rip, next);
     });
@@ -663,18 +875,21 @@ public:
   }
 
   void visit(source::Deref const &drf) override {
-    drf.ptr->acceptAddress(*this);
+    drf.ptr->accept(*this);
+    auto ptr = result;
+    check_null(drf, ptr);
     auto ps = fresh_pseudo();
     lastoffset += 8;
+    note_root(ps, drf.meta->ty);
     add_sequential([&](auto next) {
-      return Load::make("", 0, ps, address, bx::amd64::reg::rip, next);
+      return Load::make("", 0, ps, ptr, bx::amd64::reg::rip, next);
     });
     result = ps;
   }
 
   void visitAddress(source::Variable const &va) override {
     auto v = va.label;
-    if (global_var_init.find(v) != global_var_init.end()) {
+    if (is_global(v)) {
       auto ps = fresh_pseudo();
       lastoffset += 8;
       add_sequential([&](auto next) {
@@ -694,10 +909,15 @@ public:
   }
 
   void visitAddress(source::ListElem const &lelm) override {
+    if (auto ptr = dynamic_cast<source::POINTER *>(lelm.lst->meta->ty)) {
+      address = pointer_element(lelm, ptr);
+      return;
+    }
     lelm.lst->acceptAddress(*this);
     auto tmpaddr = address;
     lelm.idx->accept(*this);
-    auto tmpidx = result;
+    auto tmpidx = copy_of_result(); // scaled in place
+    check_bounds(lelm, tmpidx);
     source::IntConstantPtr ioffset;
     if (auto lst = dynamic_cast<source::LIST *>(lelm.lst->meta->ty)) {
       ioffset = source::IntConstant::make(source::sizeOf(lst->typ));
@@ -718,17 +938,16 @@ public:
   }
 
   void visitAddress(source::Deref const &drf) override {
-    drf.ptr->acceptAddress(*this);
-    auto ps = fresh_pseudo();
-    lastoffset += 8;
-    add_sequential([&](auto next) {
-      return Load::make("", 0, ps, address, bx::amd64::reg::rbp, next);
-    });
-    address = ps;
+    drf.ptr->accept(*this);
+    address = copy_of_result();
+    rtl_cbl.roots.push_back(address);
+    check_null(drf, address);
   }
 };
 
 std::map<std::string, int> getGlobals(source::Program const &src_prog) {
+  for (auto &glb : src_prog.extern_vars)
+    global_var_extern.insert(glb.first);
   for (auto &glb : src_prog.global_vars) {
     // Seperated the cases for debgging
     if (dynamic_cast<source::INT64 *>(glb.second->ty) ||
@@ -772,12 +991,32 @@ std::map<std::string, int> getGlobals(source::Program const &src_prog) {
   return global_var_init;
 }
 
-rtl::Program transform(source::Program const &src_prog) {
+rtl::Program transform(source::Program const &src_prog,
+                       sched::Scheduler &sched, checks::Options const &checks,
+                       checks::Stats *check_stats) {
+  std::vector<std::string> names;
+  for (auto const &cbl : src_prog.callables)
+    names.push_back(cbl.first);
+  return transform(src_prog, names, sched, checks, check_stats);
+}
+
+rtl::Program transform(source::Program const &src_prog,
+                       std::vector<std::string> const &names,
+                       sched::Scheduler &sched, checks::Options const &checks,
+                       checks::Stats *check_stats) {
   rtl::Program rtl_prog;
-  for (auto const &cbl : src_prog.callables) {
-    RtlGen gen{src_prog, cbl.first};
-    rtl_prog.push_back(gen.deliver());
-  }
+  for (auto const &name : names)
+    rtl_prog.emplace_back(name);
+  std::vector<checks::Stats> stats(rtl_prog.size());
+  // every callable is generated independently of the others
+  sched::parallel_for(sched, static_cast<int>(rtl_prog.size()), [&](int i) {
+    RtlGen gen{src_prog, rtl_prog[i].name, checks};
+    stats[i] = gen.check_stats;
+    rtl_prog[i] = gen.deliver();
+  });
+  if (check_stats)
+    for (auto const &s : stats)
+      *check_stats += s;
   return rtl_prog;
   // return std::make_pair(rtl_prog, global_var_init);
 }
@@ -1,13 +1,24 @@
 #pragma once
 
 #include "ast.h"
+#include "checks.h"
 #include "rtl.h"
+#include "scheduler.h"
 
 namespace bx {
 namespace rtl {
 
 std::map<std::string, int> getGlobals(source::Program const &src_prog);
-rtl::Program transform(source::Program const &prog);
+/** The RTL of prog, with the run-time checks asked for (see checks.h) */
+rtl::Program transform(source::Program const &prog, sched::Scheduler &sched,
+                       checks::Options const &checks = {},
+                       checks::Stats *check_stats = nullptr);
+/** The RTL of the callables names of prog only, in that order */
+rtl::Program transform(source::Program const &prog,
+                       std::vector<std::string> const &names,
+                       sched::Scheduler &sched,
+                       checks::Options const &checks = {},
+                       checks::Stats *check_stats = nullptr);
 
 } // namespace rtl
 } // namespace bx
\ No newline at end of file
@@ -0,0 +1,103 @@
+#!/bin/sh
+# Times the benchmark programs compiled with bx.
+#
+#     benchmarks/bench.sh [-f FLAGS] [-r RUNS] [-o csv|json] [file.bx ...]
+#
+# Run it from the top of the tree, where bx finds build/libbxrt.so (make
+# bench does). Every program (by default all of benchmarks/*.bx) is compiled
+# with build/bx.exe FLAGS (or $BX FLAGS), then run RUNS times with its output
+# thrown away. The report has, per program, the median and smallest wall
+# clock times, the instructions retired in user space when perf can count
+# them, the size of the executable and a checksum of the output, so that a
+# faster but wrong program does not go unnoticed. With FLAGS containing
+# --run or --interp-rtl, there is no executable: the compiler run is timed.
+
+BX=${BX:-build/bx.exe}
+flags=
+runs=5
+format=csv
+
+usage() {
+  echo "Usage: $0 [-f FLAGS] [-r RUNS] [-o csv|json] [file.bx ...]" >&2
+  exit 1
+}
+
+while getopts f:r:o: opt; do
+  case $opt in
+  f) flags=$OPTARG ;;
+  r) runs=$OPTARG ;;
+  o) format=$OPTARG ;;
+  *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+case $format in csv | json) ;; *) usage ;; esac
+[ $# -gt 0 ] || set -- benchmarks/*.bx
+
+# the flags as a quoted CSV field, and inside a JSON string
+flags_csv=\"$(printf '%s' "$flags" | sed 's/"/""/g')\"
+flags_json=$(printf '%s' "$flags" | sed 's/[\\"]/\\&/g')
+
+perf_ok=
+if perf stat -x, -e instructions:u true > /dev/null 2>&1; then
+  perf_ok=1
+fi
+
+now_us() { echo $(($(date +%s%N) / 1000)); }
+
+# the median and the minimum of the numbers on standard input
+summarize() {
+  sort -n | awk '{ v[NR] = $1 }
+    END { m = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+          printf "%.3f %.3f\n", m / 1000, v[1] / 1000 }'
+}
+
+first=1
+report() { # name median min instructions size cksum
+  if [ $format = csv ]; then
+    [ -z "$first" ] || echo "benchmark,flags,runs,median_ms,min_ms,instructions,size_bytes,output_cksum"
+    printf '%s\n' "$1,$flags_csv,$runs,$2,$3,$4,$5,$6"
+  else
+    if [ -n "$first" ]; then printf '[\n'; else printf ',\n'; fi
+    printf '  {"benchmark": "%s", "flags": "%s", "runs": %s, "median_ms": %s, "min_ms": %s, "instructions": %s, "size_bytes": %s, "output_cksum": "%s"}' \
+      "$1" "$flags_json" "$runs" "$2" "$3" "${4:-null}" "${5:-null}" "$6"
+  fi
+  first=
+}
+
+status=0
+for f in "$@"; do
+  name=$(basename "$f" .bx)
+  case " $flags " in
+  *" --run "* | *" --interp-rtl "*)
+    cmd="$BX $flags $f"
+    exe= ;;
+  *)
+    # shellcheck disable=SC2086
+    if ! $BX $flags "$f" > /dev/null; then
+      echo "$0: cannot compile $f" >&2
+      status=1
+      continue
+    fi
+    exe=${f%.bx}.exe
+    cmd=./$exe ;;
+  esac
+  cksum=$($cmd 2> /dev/null | cksum | cut -d' ' -f1)
+  times=$(i=0; while [ $i -lt "$runs" ]; do
+    start=$(now_us)
+    $cmd > /dev/null 2>&1
+    echo $(($(now_us) - start))
+    i=$((i + 1))
+  done | summarize)
+  instructions=
+  if [ -n "$perf_ok" ]; then
+    instructions=$(perf stat -x, -e instructions:u $cmd 2>&1 > /dev/null |
+      awk -F, '/instructions/ { print $1 }')
+  fi
+  size=
+  [ -z "$exe" ] || size=$(wc -c < "$exe" | tr -d ' ')
+  # shellcheck disable=SC2086
+  report "$name" $times "$instructions" "$size" "$cksum"
+done
+[ $format = csv ] || [ -n "$first" ] || printf '\n]\n'
+exit $status
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Measures how the phases of the compiler scale with the size of the input.
+#
+#     benchmarks/throughput.sh [-r RUNS] [-f FLAGS] [-- BXGEN-OPTIONS] [SIZE ...]
+#
+# Run it from the top of the tree (make throughput does). For every SIZE
+# (by default 50 100 200 400 800 1600 callables), build/bxgen (or $BXGEN)
+# generates a program, build/bx.exe --time-report FLAGS compiles it RUNS
+# times (default 3), and the smallest time of every phase goes to stdout as
+# CSV: phase, callables, lines, seconds and microseconds per line. On stderr,
+# every phase gets one line with its microseconds per line across the sizes
+# and the growth from the smallest size to the largest: a linear phase
+# stays near x1, a superlinear one grows with the sizes.
+
+BX=${BX:-build/bx.exe}
+BXGEN=${BXGEN:-build/bxgen}
+runs=3
+flags=
+gen_opts=
+
+while getopts r:f: opt; do
+  case $opt in
+  r) runs=$OPTARG ;;
+  f) flags=$OPTARG ;;
+  *)
+    echo "Usage: $0 [-r RUNS] [-f FLAGS] [-- BXGEN-OPTIONS] [SIZE ...]" >&2
+    exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+# bxgen options, up to the first size
+while [ $# -gt 0 ] && [ "${1#-}" != "$1" ]; do
+  gen_opts="$gen_opts $1 $2"
+  shift 2
+done
+[ $# -gt 0 ] || set -- 50 100 200 400 800 1600
+
+dir=benchmarks/throughput
+mkdir -p $dir
+results=$dir/results.csv
+: > $results
+
+echo "phase,callables,lines,seconds,us_per_line"
+for n in "$@"; do
+  src=$dir/gen$n.bx
+  # shellcheck disable=SC2086
+  $BXGEN -n "$n" $gen_opts > $src || exit 1
+  lines=$(wc -l < $src | tr -d ' ')
+  i=0
+  while [ $i -lt "$runs" ]; do
+    # shellcheck disable=SC2086
+    $BX --time-report $flags $src 2>&1 > /dev/null |
+      awk '/^  / { print $1, $2 }'
+    i=$((i + 1))
+  done | awk -v n="$n" -v lines="$lines" '
+    !($1 in best) { order[++k] = $1; best[$1] = $2 }
+    $2 < best[$1] { best[$1] = $2 }
+    END { for (i = 1; i <= k; i++)
+            printf "%s,%d,%d,%.6f,%.3f\n", order[i], n, lines, best[order[i]],
+                   1e6 * best[order[i]] / lines }' | tee -a $results
+done
+
+awk -F, '
+  !($1 in seen) { seen[$1] = 1; order[++k] = $1 }
+  { cost[$1] = cost[$1] " " $5
+    if (!($1 in first)) first[$1] = $5
+    last[$1] = $5 }
+  END { print "us/line by size:" > "/dev/stderr"
+        for (i = 1; i <= k; i++) {
+          p = order[i]
+          printf "  %-14s%s  x%.2f\n", p, cost[p],
+                 (first[p] > 0 ? last[p] / first[p] : 0) > "/dev/stderr"
+        } }' $results
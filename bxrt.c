@@ -1,20 +1,674 @@
+#include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
-void bx_panic()
+#include "bxrt.h"
+
+/*
+ * Output of the print functions. BX programs are single-threaded, so the
+ * output goes to a plain buffer instead of through the locks and format
+ * parsing of stdio, and is written when the buffer is full, at exit, and
+ * before a panic. On a terminal every line is written right away.
+ *
+ * The generated code appends to the buffer itself while bx_out_len is
+ * below bx_out_limit (see bxrt.h), so the limit stays 0 until the first
+ * call here, and on a terminal.
+ */
+#define OUT_MAX_LINE 24 /* "-9223372036854775808\n" */
+
+char bx_out_buf[BX_OUT_SIZE];
+int64_t bx_out_len;
+int64_t bx_out_limit;
+static int out_started, out_tty;
+
+void bx_flush(void)
+{
+  int64_t done = 0;
+  while (done < bx_out_len) {
+    ssize_t n = write(STDOUT_FILENO, bx_out_buf + done,
+                      (size_t)(bx_out_len - done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  bx_out_len = 0;
+}
+
+static void out_start(void)
+{
+  /* anything printed before through stdio comes first */
+  fflush(stdout);
+  out_started = 1;
+  out_tty = isatty(STDOUT_FILENO);
+  bx_out_limit = out_tty ? 0 : BX_OUT_SIZE - OUT_MAX_LINE;
+  atexit(bx_flush);
+}
+
+static inline char *out_reserve(void)
+{
+  if (bx_out_len >= bx_out_limit) {
+    if (!out_started)
+      out_start();
+    else
+      bx_flush();
+  }
+  return bx_out_buf + bx_out_len;
+}
+
+static inline void out_commit(char *end)
+{
+  bx_out_len = end - bx_out_buf;
+  if (out_tty)
+    bx_flush();
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void bx_panic(void)
 {
+  bx_flush();
   fprintf(stderr, "RUNTIME PANIC!\n");
   exit(-1);
 }
 
 void bx_print_int(int64_t x)
 {
-  printf("%ld\n", x);
+  char tmp[20], *p = tmp + sizeof tmp, *out = out_reserve();
+  /* the magnitude as unsigned, which also works for INT64_MIN */
+  uint64_t u = x < 0 ? -(uint64_t)x : (uint64_t)x;
+  size_t len;
+  while (u >= 100) {
+    const char *d = digit_pairs + 2 * (u % 100);
+    u /= 100;
+    *--p = d[1];
+    *--p = d[0];
+  }
+  if (u >= 10) {
+    *--p = digit_pairs[2 * u + 1];
+    *--p = digit_pairs[2 * u];
+  } else
+    *--p = (char)('0' + u);
+  if (x < 0)
+    *out++ = '-';
+  len = (size_t)(tmp + sizeof tmp - p);
+  memcpy(out, p, len);
+  out += len;
+  *out++ = '\n';
+  out_commit(out);
 }
 
 void bx_print_bool(int64_t x)
 {
-  printf("%s\n", x == 0 ? "false" : "true");
+  char *out = out_reserve();
+  if (x == 0) {
+    memcpy(out, "false\n", 6);
+    out += 6;
+  } else {
+    memcpy(out, "true\n", 5);
+    out += 5;
+  }
+  out_commit(out);
+}
+
+
+/*
+ * The heap of the BX alloc expressions: regions obtained from mmap, in
+ * which blocks are carved by bumping bx_heap.next through a free span.
+ * A block is 16 bytes of header (see bxrt.h) followed by its payload,
+ * rounded up to 16 bytes, and the blocks larger than a quarter of a
+ * region get a mapping of their own. Every byte of a region belongs to a
+ * block, live or free, so the regions can be walked block by block.
+ *
+ * Once the program has registered its stack maps (bx_gc_start, bx --gc),
+ * the heap is collected by mark-sweep when the allocations since the last
+ * collection exceed a threshold. The roots are the global variables and
+ * the frame slots listed in the stack maps; the words of the roots and of
+ * the blocks allocated with BX_HEADER_REFS are traced if they point into
+ * a block, so that a slot holding an old or uninitialized value only
+ * keeps a block alive. The dead blocks are zeroed and become the free
+ * spans of the next allocations. Blocks do not move.
+ *
+ * With BX_HEAP_STATS set, the totals are printed on stderr at exit.
+ * BX_GC_THRESHOLD sets the minimum number of bytes allocated between two
+ * collections.
+ */
+#define HEAP_REGION_SIZE (4 << 20)
+#define HEAP_MIN_SPAN 64
+#define GC_DEFAULT_THRESHOLD (16 << 20)
+
+#define HEADER_MARK 1
+#define HEADER_FREE 4
+#define HEADER_FLAGS 15
+
+struct bx_heap bx_heap;
+
+struct region {
+  char *base;
+  size_t size;
+  int large;
+  uint64_t *starts; /* one bit per 16 bytes: the blocks, while collecting */
+};
+
+struct span {
+  char *start, *end;
+};
+
+struct frame_map {
+  uintptr_t start; /* the code of the callable */
+  int64_t entry;   /* nonzero for the entry procedure */
+  int64_t n;       /* the number of slots */
+  const int64_t *slots; /* their offsets from the frame pointer */
+};
+
+static struct {
+  struct region *regions;
+  size_t nregions, cap_regions;
+  struct span *spans;
+  size_t nspans, next_span, cap_spans;
+  uint64_t mapped, max_mapped;
+} heap;
+
+static struct {
+  int enabled;
+  const int64_t *globals;
+  int64_t nglobals;
+  struct frame_map *frames;
+  int64_t nframes;
+  uint64_t threshold, min_threshold, last_bytes;
+  char **work;
+  size_t nwork, cap_work;
+  uint64_t collections, live, freed;
+  double pause_total, pause_max;
+} gc;
+
+static uint64_t *header(char *block)
+{
+  return (uint64_t *)(block + 8);
+}
+
+static void heap_report(void)
+{
+  fprintf(stderr,
+          "heap: %llu allocations, %llu bytes, %llu bytes mapped (max %llu)\n",
+          (unsigned long long)bx_heap.allocs,
+          (unsigned long long)bx_heap.bytes,
+          (unsigned long long)heap.mapped,
+          (unsigned long long)heap.max_mapped);
+  if (gc.enabled)
+    fprintf(stderr,
+            "gc: %llu collections, %llu bytes live, %llu bytes freed, "
+            "pauses %.3f ms total, %.3f ms max\n",
+            (unsigned long long)gc.collections,
+            (unsigned long long)gc.live, (unsigned long long)gc.freed,
+            gc.pause_total * 1e3, gc.pause_max * 1e3);
+}
+
+static void out_of_memory(void)
+{
+  bx_flush();
+  fprintf(stderr, "OUT OF MEMORY!\n");
+  exit(-1);
+}
+
+/* Grow *array of *cap elements of the given size to hold n */
+static void reserve(void *array, size_t *cap, size_t n, size_t size)
+{
+  void **a = array;
+  size_t c = *cap ? *cap : 16;
+  if (n <= *cap)
+    return;
+  while (c < n)
+    c *= 2;
+  if (!(*a = realloc(*a, c * size)))
+    out_of_memory();
+  *cap = c;
+}
+
+static char *heap_map(size_t size, int large)
+{
+  static int reporting = 0;
+  size_t i;
+  char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    out_of_memory();
+  if (!reporting && getenv("BX_HEAP_STATS")) {
+    atexit(heap_report);
+    reporting = 1;
+  }
+  /* the regions are sorted by address */
+  reserve(&heap.regions, &heap.cap_regions, heap.nregions + 1,
+          sizeof *heap.regions);
+  for (i = heap.nregions; i > 0 && heap.regions[i - 1].base > p; i--)
+    heap.regions[i] = heap.regions[i - 1];
+  heap.regions[i].base = p;
+  heap.regions[i].size = size;
+  heap.regions[i].large = large;
+  heap.regions[i].starts = NULL;
+  heap.nregions++;
+  heap.mapped += size;
+  if (heap.mapped > heap.max_mapped)
+    heap.max_mapped = heap.mapped;
+  return p;
+}
+
+/* Make [start, end) a free block, so that the region stays walkable */
+static void heap_free_block(char *start, char *end)
+{
+  if (start < end)
+    *header(start) = (uint64_t)(end - start) | HEADER_FREE;
+}
+
+/* Leave the current span; what remains of it becomes a free block */
+static void heap_retire_span(void)
+{
+  heap_free_block(bx_heap.next, bx_heap.limit);
+  bx_heap.next = bx_heap.limit = NULL;
+}
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+static struct region *region_of(uintptr_t p)
+{
+  size_t lo = 0, hi = heap.nregions;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if ((uintptr_t)heap.regions[mid].base <= p)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return NULL;
+  struct region *r = &heap.regions[lo - 1];
+  return p < (uintptr_t)r->base + r->size ? r : NULL;
+}
+
+/* Mark the block that v points into, if any */
+static void gc_mark(uint64_t v)
+{
+  struct region *r = region_of((uintptr_t)v);
+  char *block;
+  uint64_t *h;
+  if (!r)
+    return;
+  if (r->large) {
+    block = r->base;
+  } else {
+    size_t bit = ((uintptr_t)v - (uintptr_t)r->base) / 16;
+    while (!(r->starts[bit / 64] & (uint64_t)1 << bit % 64)) {
+      if (bit-- == 0)
+        return;
+    }
+    block = r->base + 16 * bit;
+  }
+  h = header(block);
+  if (*h & (HEADER_MARK | HEADER_FREE) || (char *)(uintptr_t)v < block + 16)
+    return;
+  *h |= HEADER_MARK;
+  if (*h & BX_HEADER_REFS) {
+    reserve(&gc.work, &gc.cap_work, gc.nwork + 1, sizeof *gc.work);
+    gc.work[gc.nwork++] = block;
+  }
 }
 
+static const struct frame_map *gc_frame_of(uintptr_t ret)
+{
+  int64_t lo = 0, hi = gc.nframes;
+  while (lo < hi) {
+    int64_t mid = (lo + hi) / 2;
+    if (gc.frames[mid].start <= ret)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo == 0 ? NULL : &gc.frames[lo - 1];
+}
+
+/*
+ * Mark from the roots: the globals, then the frames from the one of the
+ * caller of the allocation, which returns to ret, up to the one of the
+ * entry procedure. The frames are linked by their saved %rbp, with the
+ * return address above it.
+ */
+static void gc_mark_roots(int64_t *frame, uintptr_t ret)
+{
+  int64_t i;
+  for (i = 0; i < gc.nglobals; i++)
+    gc_mark(*(uint64_t *)(uintptr_t)gc.globals[i]);
+  while (frame) {
+    const struct frame_map *f = gc_frame_of(ret);
+    if (!f)
+      break;
+    for (i = 0; i < f->n; i++)
+      gc_mark((uint64_t)frame[f->slots[i] / 8]);
+    if (f->entry)
+      break;
+    ret = (uintptr_t)frame[1];
+    frame = (int64_t *)frame[0];
+  }
+  while (gc.nwork > 0) {
+    char *block = gc.work[--gc.nwork];
+    uint64_t *p = (uint64_t *)(block + 16);
+    uint64_t *end = (uint64_t *)(block + (*header(block) & ~(uint64_t)HEADER_FLAGS));
+    for (; p < end; p++)
+      gc_mark(*p);
+  }
+}
+
+/* Record the start of the blocks of the regions */
+static void gc_find_blocks(void)
+{
+  size_t i;
+  for (i = 0; i < heap.nregions; i++) {
+    struct region *r = &heap.regions[i];
+    char *b;
+    if (r->large)
+      continue;
+    r->starts = calloc(r->size / 16 / 64, sizeof *r->starts);
+    if (!r->starts)
+      out_of_memory();
+    for (b = r->base; b < r->base + r->size;
+         b += *header(b) & ~(uint64_t)HEADER_FLAGS) {
+      size_t bit = (size_t)(b - r->base) / 16;
+      r->starts[bit / 64] |= (uint64_t)1 << bit % 64;
+    }
+  }
+}
+
+/* Zero [start, end), giving the whole pages back to the system */
+static void gc_zero(char *start, char *end)
+{
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  char *first = (char *)(((uintptr_t)start + page - 1) & ~(page - 1)),
+       *last = (char *)((uintptr_t)end & ~(page - 1));
+  if (last - first >= (ptrdiff_t)(16 * page) &&
+      madvise(first, (size_t)(last - first), MADV_DONTNEED) == 0) {
+    memset(start, 0, (size_t)(first - start));
+    memset(last, 0, (size_t)(end - last));
+  } else {
+    memset(start, 0, (size_t)(end - start));
+  }
+}
+
+static void gc_add_span(char *start, char *end)
+{
+  gc_zero(start, end);
+  heap_free_block(start, end);
+  if (end - start >= HEAP_MIN_SPAN) {
+    reserve(&heap.spans, &heap.cap_spans, heap.nspans + 1, sizeof *heap.spans);
+    heap.spans[heap.nspans].start = start;
+    heap.spans[heap.nspans].end = end;
+    heap.nspans++;
+  }
+}
+
+/*
+ * Free the unmarked blocks: the large ones are unmapped, and the runs of
+ * dead blocks in the regions become free spans
+ */
+static void gc_sweep(void)
+{
+  size_t i, kept = 0;
+  gc.live = 0;
+  heap.nspans = heap.next_span = 0;
+  for (i = 0; i < heap.nregions; i++) {
+    struct region r = heap.regions[i];
+    free(r.starts);
+    r.starts = NULL;
+    if (r.large) {
+      if (*header(r.base) & HEADER_MARK) {
+        *header(r.base) &= ~(uint64_t)HEADER_MARK;
+        gc.live += r.size;
+        heap.regions[kept++] = r;
+      } else {
+        gc.freed += r.size;
+        heap.mapped -= r.size;
+        munmap(r.base, r.size);
+      }
+      continue;
+    }
+    char *b = r.base, *run = NULL, *end = r.base + r.size;
+    while (b < end) {
+      uint64_t *h = header(b);
+      size_t size = *h & ~(uint64_t)HEADER_FLAGS;
+      if (*h & HEADER_MARK) {
+        *h &= ~(uint64_t)HEADER_MARK;
+        gc.live += size;
+        if (run)
+          gc_add_span(run, b);
+        run = NULL;
+      } else {
+        if (!(*h & HEADER_FREE))
+          gc.freed += size;
+        if (!run)
+          run = b;
+      }
+      b += size;
+    }
+    if (run)
+      gc_add_span(run, end);
+    heap.regions[kept++] = r;
+  }
+  heap.nregions = kept;
+}
+
+static void gc_collect(int64_t *frame, uintptr_t ret)
+{
+  double start = now(), pause;
+  heap_retire_span();
+  gc_find_blocks();
+  gc_mark_roots(frame, ret);
+  gc_sweep();
+  gc.collections++;
+  gc.last_bytes = bx_heap.bytes;
+  gc.threshold = gc.live > gc.min_threshold ? gc.live : gc.min_threshold;
+  pause = now() - start;
+  gc.pause_total += pause;
+  if (pause > gc.pause_max)
+    gc.pause_max = pause;
+}
+
+static int gc_due(void)
+{
+  return gc.enabled && bx_heap.bytes - gc.last_bytes >= gc.threshold;
+}
+
+static char *heap_alloc(int64_t size, uint64_t flags, int64_t *frame,
+                        uintptr_t ret)
+{
+  size_t total;
+  char *p;
+  if (size < 0)
+    bx_panic();
+  total = 16 + (((size_t)size + 15) & ~(size_t)15);
+  if (total > HEAP_REGION_SIZE / 4) {
+    if (frame && gc_due())
+      gc_collect(frame, ret);
+    p = heap_map(total, 1);
+  } else {
+    while (!bx_heap.next || total >= (size_t)(bx_heap.limit - bx_heap.next)) {
+      heap_retire_span();
+      if (heap.next_span < heap.nspans) {
+        bx_heap.next = heap.spans[heap.next_span].start;
+        bx_heap.limit = heap.spans[heap.next_span].end;
+        heap.next_span++;
+      } else if (frame && gc_due()) {
+        gc_collect(frame, ret);
+      } else {
+        bx_heap.next = heap_map(HEAP_REGION_SIZE, 0);
+        bx_heap.limit = bx_heap.next + HEAP_REGION_SIZE;
+      }
+    }
+    p = bx_heap.next;
+    bx_heap.next += total;
+  }
+  bx_heap.allocs++;
+  bx_heap.bytes += total;
+  *header(p) = total | flags;
+  return p + 16;
+}
+
+void *bx_alloc(int64_t size, int64_t *frame)
+{
+  return heap_alloc(size, 0, frame, (uintptr_t)__builtin_return_address(0));
+}
+
+void *bx_alloc_refs(int64_t size, int64_t *frame)
+{
+  return heap_alloc(size, BX_HEADER_REFS, frame,
+                    (uintptr_t)__builtin_return_address(0));
+}
+
+static int compare_frames(const void *a, const void *b)
+{
+  uintptr_t x = ((const struct frame_map *)a)->start,
+            y = ((const struct frame_map *)b)->start;
+  return x < y ? -1 : x > y;
+}
+
+void bx_gc_start(const int64_t *stackmaps)
+{
+  const char *threshold = getenv("BX_GC_THRESHOLD");
+  const int64_t *p = stackmaps;
+  int64_t i;
+  if (gc.enabled)
+    return;
+  gc.nglobals = *p++;
+  gc.globals = p;
+  p += gc.nglobals;
+  gc.nframes = *p++;
+  gc.frames = calloc((size_t)gc.nframes + 1, sizeof *gc.frames);
+  if (!gc.frames)
+    out_of_memory();
+  for (i = 0; i < gc.nframes; i++) {
+    gc.frames[i].start = (uintptr_t)*p++;
+    gc.frames[i].entry = *p++;
+    gc.frames[i].n = *p++;
+    gc.frames[i].slots = p;
+    p += gc.frames[i].n;
+  }
+  qsort(gc.frames, (size_t)gc.nframes, sizeof *gc.frames, compare_frames);
+  gc.min_threshold = threshold && *threshold
+                         ? strtoull(threshold, NULL, 10)
+                         : GC_DEFAULT_THRESHOLD;
+  gc.threshold = gc.min_threshold;
+  gc.last_bytes = bx_heap.bytes;
+  gc.enabled = 1;
+}
+
+
+static int64_t *profile_counters;
+static uint64_t profile_size;
+static uint64_t profile_checksum;
+static const unsigned char profile_magic[8] = {'B', 'X', 'P', 'R', 'O', 'F', 1, 0};
+
+void bx_profile_start(int64_t *counters, int64_t n, int64_t checksum)
+{
+  static int registered = 0;
+  profile_counters = counters;
+  profile_size = (uint64_t)n;
+  profile_checksum = (uint64_t)checksum;
+  if (!registered) {
+    atexit(bx_profile_dump);
+    registered = 1;
+  }
+}
+
+static int read_uleb(FILE *f, uint64_t *v)
+{
+  int shift, c;
+  *v = 0;
+  for (shift = 0; shift < 64; shift += 7) {
+    if ((c = fgetc(f)) == EOF)
+      return 0;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return 1;
+  }
+  return 0;
+}
+
+static void write_uleb(FILE *f, uint64_t v)
+{
+  do {
+    int byte = v & 0x7f;
+    v >>= 7;
+    fputc(v ? byte | 0x80 : byte, f);
+  } while (v);
+}
+
+/* Add the counts of earlier runs of the same program to sum */
+static void read_profile(const char *path, uint64_t *sum)
+{
+  unsigned char header[16];
+  uint64_t checksum = 0, n, i, c;
+  int k;
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return;
+  if (fread(header, 1, 16, f) == 16 && memcmp(header, profile_magic, 8) == 0) {
+    for (k = 7; k >= 0; k--)
+      checksum = checksum << 8 | header[8 + k];
+    if (checksum == profile_checksum && read_uleb(f, &n) && n == profile_size)
+      for (i = 0; i < n && read_uleb(f, &c); i++)
+        sum[i] += c;
+  }
+  fclose(f);
+}
+
+void bx_profile_dump(void)
+{
+  const char *path = getenv("BX_PROFILE");
+  uint64_t *sum, i;
+  int k;
+  FILE *f;
+  if (!profile_counters)
+    return;
+  if (!path || !*path)
+    path = "bxprof.out";
+  sum = calloc(profile_size + 1, sizeof *sum);
+  if (!sum)
+    return;
+  read_profile(path, sum);
+  for (i = 0; i < profile_size; i++)
+    sum[i] += (uint64_t)profile_counters[i];
+  profile_counters = NULL;
+  f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "cannot write the profile %s\n", path);
+    free(sum);
+    return;
+  }
+  fwrite(profile_magic, 1, 8, f);
+  for (k = 0; k < 8; k++)
+    fputc((int)(profile_checksum >> (8 * k)) & 0xff, f);
+  write_uleb(f, profile_size);
+  for (i = 0; i < profile_size; i++)
+    write_uleb(f, sum[i]);
+  fclose(f);
+  free(sum);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+/**
+ * The BX runtime (bxrt.c). It is linked into the generated executables,
+ * and into the compiler itself for the in-memory execution modes.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bx_panic(void);
+void bx_print_int(int64_t x);
+void bx_print_bool(int64_t x);
+/* The print functions buffer their output, which this writes out */
+void bx_flush(void);
+
+/*
+ * The output buffer. While bx_out_len < bx_out_limit, the buffer has room
+ * for a line of at least 8 bytes, and the generated code may append one
+ * there and add its length to bx_out_len instead of calling the print
+ * functions (see rtl_asm.cpp).
+ */
+#define BX_OUT_SIZE 65536
+extern char bx_out_buf[BX_OUT_SIZE];
+extern int64_t bx_out_len;
+extern int64_t bx_out_limit;
+
+/*
+ * Zeroed memory for the alloc expressions. Panics if size is negative.
+ * frame is the frame pointer of the caller, from which the collector finds
+ * the roots in the stack; NULL if the caller has no stack map, in which
+ * case the heap is not collected. bx_alloc_refs is for the blocks that
+ * hold pointers, which are traced by the collector.
+ */
+void *bx_alloc(int64_t size, int64_t *frame);
+void *bx_alloc_refs(int64_t size, int64_t *frame);
+
+/*
+ * The heap descriptor. A block of n bytes is preceded by a 16-byte header:
+ * a word for the runtime, then the size of the block, header included and
+ * rounded up to 16, or'ed with flags such as BX_HEADER_REFS. The generated
+ * code allocates a block itself when next plus its size is below limit,
+ * writes the header and counts the block in allocs and bytes; otherwise it
+ * calls bx_alloc. next is always 16-aligned. The offsets of the fields are
+ * part of the code generator (rtl_asm.cpp).
+ */
+struct bx_heap {
+  char *next;     /* offset 0 */
+  char *limit;    /* offset 8 */
+  uint64_t allocs; /* offset 16 */
+  uint64_t bytes;  /* offset 24 */
+};
+extern struct bx_heap bx_heap;
+#define BX_HEADER_REFS 2
+
+/*
+ * Garbage collection (bx --gc). Until the program registers its stack
+ * maps, the heap only grows. The table is laid out as
+ *
+ *   nglobals, the addresses of the globals holding pointers,
+ *   nfuncs, then for each function:
+ *     its address, 1 for the entry procedure (0 otherwise), n, and the
+ *     offsets from the frame pointer of the n slots that may hold pointers
+ *
+ * and must outlive the program.
+ */
+void bx_gc_start(const int64_t *stackmaps);
+
+/*
+ * Profiling (bx --profile, see profile.h in the compiler). The counters
+ * registered by the instrumented program are added to the profile file
+ * ($BX_PROFILE, or bxprof.out) when it exits.
+ */
+void bx_profile_start(int64_t *counters, int64_t n, int64_t checksum);
+/* Write the profile now and forget the counters; nothing if there are none */
+void bx_profile_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,271 @@
+#include "cache.h"
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "ast_rtl.h"
+#include "encoding.h"
+#include "rtl_io.h"
+#include "rtl_asm.h"
+
+namespace bx {
+namespace cache {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char entry_magic[8] = {'B', 'X', 'C', 'A', 'C', 'H', 'E', 2};
+
+std::string file_name(std::string const &key) {
+  std::ostringstream out;
+  out << std::hex << std::setw(16) << std::setfill('0') << encoding::fnv1a(key);
+  return out.str();
+}
+
+/** Changes whenever bx.exe is rebuilt */
+std::string exe_stamp() {
+  std::error_code ec;
+  auto size = fs::file_size("/proc/self/exe", ec);
+  auto time = fs::last_write_time("/proc/self/exe", ec);
+  if (ec)
+    return "unknown";
+  return std::to_string(size) + '.' +
+         std::to_string(time.time_since_epoch().count());
+}
+
+std::string signature(source::Callable const &cbl) {
+  std::ostringstream out;
+  out << cbl.name << '(';
+  for (auto const &p : cbl.args)
+    out << *p.second << ',';
+  out << ')';
+  if (!dynamic_cast<source::UNKNOWN *>(cbl.return_ty))
+    out << " : " << *cbl.return_ty;
+  return out.str();
+}
+
+bool is_id_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+class Writer {
+  std::string &out;
+
+public:
+  explicit Writer(std::string &out) : out{out} {}
+
+  void uleb(uint64_t v) { encoding::put_uleb(out, v); }
+
+  template <typename Bytes> void bytes(Bytes const &s) {
+    uleb(s.size());
+    out.append(reinterpret_cast<char const *>(s.data()), s.size());
+  }
+};
+
+class Reader {
+  std::string const &in;
+  std::size_t pos = 0;
+
+public:
+  explicit Reader(std::string const &in, std::size_t pos)
+      : in{in}, pos{pos} {}
+
+  uint64_t uleb() {
+    return encoding::get_uleb(in, pos, "truncated cache entry",
+                              "bad number in a cache entry");
+  }
+
+  template <typename Bytes> void bytes(Bytes &s) {
+    auto n = uleb();
+    if (n > in.size() - pos)
+      throw std::runtime_error("truncated cache entry");
+    auto first = reinterpret_cast<uint8_t const *>(in.data() + pos);
+    s.assign(first, first + n);
+    pos += n;
+  }
+
+  bool at_end() const { return pos == in.size(); }
+};
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  return out << stats.reused << " callables reused, " << stats.compiled
+             << " compiled";
+}
+
+Cache::Cache(std::string dir, Options opts)
+    : dir{std::move(dir)}, opts{std::move(opts)} {
+  std::error_code ec;
+  fs::create_directories(this->dir, ec);
+  std::ostringstream out;
+  out << "bx " << exe_stamp() << " checks=" << this->opts.checks.bounds
+      << this->opts.checks.null << " passes=";
+  for (auto const &p : this->opts.passes)
+    out << p << ',';
+  config = out.str();
+}
+
+std::string Cache::key(source::Program const &prog,
+                       source::Callable const &cbl) const {
+  std::ostringstream src;
+  src << cbl;
+  auto text = src.str();
+  // every name in the source, whatever it stands for
+  std::set<std::string> names;
+  for (std::size_t i = 0; i < text.size();) {
+    if (!is_id_char(text[i])) {
+      i++;
+      continue;
+    }
+    auto start = i;
+    while (i < text.size() && is_id_char(text[i]))
+      i++;
+    names.insert(text.substr(start, i - start));
+  }
+  std::ostringstream out;
+  out << config << '\n' << text << '\n';
+  for (auto const &name : names) {
+    if (auto gv = prog.find_global(name))
+      out << "global " << name << " : " << *gv->ty << '\n';
+    if (auto callee = prog.find_callable(name))
+      out << "callable " << signature(*callee) << '\n';
+  }
+  return out.str();
+}
+
+bool Cache::load(std::string const &key, Entry &entry) const {
+  std::ifstream in{fs::path{dir} / file_name(key), std::ios::binary};
+  if (!in)
+    return false;
+  std::string contents{std::istreambuf_iterator<char>{in}, {}};
+  if (contents.compare(0, sizeof entry_magic, entry_magic,
+                       sizeof entry_magic) != 0)
+    return false;
+  try {
+    Reader r{contents, sizeof entry_magic};
+    std::string entry_key;
+    r.bytes(entry_key);
+    if (entry_key != key)
+      return false;
+    r.bytes(entry.rtl);
+    auto &obj = entry.object;
+    r.bytes(obj.text);
+    r.bytes(obj.data);
+    obj.symbols.resize(r.uleb());
+    for (auto &sym : obj.symbols) {
+      r.bytes(sym.name);
+      sym.section = static_cast<amd64::Object::Section>(r.uleb());
+      sym.offset = r.uleb();
+      sym.global = r.uleb() != 0;
+    }
+    obj.relocs.resize(r.uleb());
+    for (auto &rel : obj.relocs) {
+      rel.section = static_cast<amd64::Object::Section>(r.uleb());
+      rel.offset = r.uleb();
+      r.bytes(rel.symbol);
+      rel.type = static_cast<amd64::RelocType>(r.uleb());
+      rel.addend = static_cast<int64_t>(r.uleb());
+    }
+    return r.at_end();
+  } catch (std::runtime_error const &) {
+    return false;
+  }
+}
+
+void Cache::store(std::string const &key, Entry const &entry) const {
+  std::string contents{entry_magic, sizeof entry_magic};
+  Writer w{contents};
+  w.bytes(key);
+  w.bytes(entry.rtl);
+  auto const &obj = entry.object;
+  w.bytes(obj.text);
+  w.bytes(obj.data);
+  w.uleb(obj.symbols.size());
+  for (auto const &sym : obj.symbols) {
+    w.bytes(sym.name);
+    w.uleb(sym.section);
+    w.uleb(sym.offset);
+    w.uleb(sym.global);
+  }
+  w.uleb(obj.relocs.size());
+  for (auto const &rel : obj.relocs) {
+    w.uleb(rel.section);
+    w.uleb(rel.offset);
+    w.bytes(rel.symbol);
+    w.uleb(rel.type);
+    w.uleb(static_cast<uint64_t>(rel.addend));
+  }
+
+  auto path = fs::path{dir} / file_name(key);
+  auto tmp = path;
+  tmp += ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out{tmp, std::ios::binary};
+    if (!out.write(contents.data(), contents.size()))
+      return;
+  }
+  std::error_code ec;
+  fs::rename(tmp, path, ec);
+  if (ec)
+    fs::remove(tmp, ec);
+}
+
+std::vector<Entry> compile(Cache const &cache, source::Program const &prog,
+                           sched::Scheduler &sched, passes::Stats &pass_log,
+                           checks::Stats &check_stats, Stats &stats) {
+  std::vector<std::string> names;
+  for (auto const &cbl : prog.callables)
+    names.push_back(cbl.first);
+  int n = static_cast<int>(names.size());
+  std::vector<std::string> keys(n);
+  std::vector<Entry> entries(n);
+  std::vector<char> found(n);
+  sched::parallel_for(sched, n, [&](int i) {
+    keys[i] = cache.key(prog, *prog.callables.at(names[i]));
+    found[i] = cache.load(keys[i], entries[i]);
+  });
+
+  std::vector<std::string> missing;
+  std::vector<int> slot; // of the missing callables in entries
+  for (int i = 0; i < n; i++)
+    if (!found[i]) {
+      missing.push_back(names[i]);
+      slot.push_back(i);
+    }
+  stats.reused += n - static_cast<int>(missing.size());
+  stats.compiled += static_cast<int>(missing.size());
+  if (missing.empty())
+    return entries;
+
+  auto const &opts = cache.options();
+  auto rtl_prog = rtl::transform(prog, missing, sched, opts.checks,
+                                 &check_stats);
+  if (!opts.passes.empty())
+    passes::run_rtl(rtl_prog, opts.passes, sched, opts.verify_passes,
+                    pass_log);
+  auto asm_prog = rtl_to_asm(rtl_prog, sched);
+  passes::run_asm(asm_prog, opts.passes, pass_log);
+  sched::parallel_for(sched, static_cast<int>(missing.size()), [&](int j) {
+    auto &entry = entries[slot[j]];
+    std::ostringstream rtl_out;
+    rtl::write_program(rtl_out, {rtl_prog[j]}, {});
+    entry.rtl = rtl_out.str();
+    std::vector<AsmProgram> alone;
+    alone.push_back(std::move(asm_prog[j]));
+    entry.object = amd64::assemble(alone);
+    cache.store(keys[slot[j]], entry);
+  });
+  return entries;
+}
+
+} // namespace cache
+} // namespace bx
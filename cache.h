@@ -0,0 +1,89 @@
+#pragma once
+
+/**
+ * The incremental compilation cache (bx --cache[=DIR]).
+ *
+ * The code of every callable is kept in DIR, in an entry named after the
+ * hash of its key. The key is made of the configuration of the compiler
+ * (its executable and the options that change the code), the source of the
+ * callable, and what its code depends on in the rest of the program: the
+ * signatures of the callables and the types of the global variables whose
+ * names appear in it. The bodies of the callees are not part of the key, as
+ * the code of a callable never depends on them.
+ *
+ * compile() only generates the callables whose key has no entry. The others
+ * are read back: their RTL, in the binary format of rtl_io.h, and their
+ * machine code, assembled on its own, which amd64::link() joins with the rest of the
+ * program. An entry holds its whole key, so a hash collision is a miss.
+ *
+ * An entry is binary: the 8 bytes "BXCACHE" <version>, then the key, the
+ * RTL and the object (text, data, symbols and relocations), with the
+ * numbers as unsigned LEB128 and the strings as their length and bytes.
+ * Unreadable entries are misses, and entries are written to a temporary
+ * file then renamed, so concurrent compilations can share a directory.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "amd64_encode.h"
+#include "ast.h"
+#include "checks.h"
+#include "passes.h"
+#include "scheduler.h"
+
+namespace bx {
+namespace cache {
+
+/** The options of the compilation that change the generated code */
+struct Options {
+  checks::Options checks;
+  std::vector<std::string> passes;
+  bool verify_passes = false;
+};
+
+struct Entry {
+  std::string rtl;      // the callable alone, see rtl_io.h
+  amd64::Object object; // the callable assembled alone
+};
+
+struct Stats {
+  int reused = 0;   // callables read from the cache
+  int compiled = 0; // callables generated and stored
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+class Cache {
+  std::string dir;
+  std::string config;
+  Options opts;
+
+public:
+  /** A cache in the directory dir, created if needed */
+  Cache(std::string dir, Options opts);
+
+  Options const &options() const { return opts; }
+
+  /** The key of the callable cbl of prog */
+  std::string key(source::Program const &prog,
+                  source::Callable const &cbl) const;
+
+  /** Read the entry of key into entry; false if there is none */
+  bool load(std::string const &key, Entry &entry) const;
+
+  /** Write the entry of key; failures are ignored */
+  void store(std::string const &key, Entry const &entry) const;
+};
+
+/**
+ * The entries of all the callables of prog, in the order of
+ * rtl::transform(), generating and storing the ones missing from cache.
+ * The statistics of the checks and passes only cover the generated ones.
+ */
+std::vector<Entry> compile(Cache const &cache, source::Program const &prog,
+                           sched::Scheduler &sched, passes::Stats &pass_log,
+                           checks::Stats &check_stats, Stats &stats);
+
+} // namespace cache
+} // namespace bx
@@ -0,0 +1,537 @@
+#include "checks.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace bx {
+namespace checks {
+
+Stats &Stats::operator+=(Stats const &other) {
+  bounds += other.bounds;
+  bounds_proven += other.bounds_proven;
+  null += other.null;
+  null_proven += other.null_proven;
+  return *this;
+}
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  return out << stats.bounds << " bounds checks (" << stats.bounds_proven
+             << " proven unnecessary), " << stats.null << " null checks ("
+             << stats.null_proven << " proven unnecessary)";
+}
+
+namespace {
+
+using namespace source;
+
+// holds the exact result of an operation on int64 values
+__extension__ typedef __int128 wide;
+
+/** The values an int64 variable can take, bounds included */
+struct Range {
+  int64_t lo = INT64_MIN, hi = INT64_MAX;
+};
+
+Range hull(Range a, Range b) {
+  return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+
+int64_t saturate(wide v) {
+  return v < INT64_MIN ? INT64_MIN : v > INT64_MAX ? INT64_MAX
+                                                   : static_cast<int64_t>(v);
+}
+
+/** The range [lo, hi] of a result, or anything if it may wrap around */
+Range exact(wide lo, wide hi) {
+  if (lo < INT64_MIN || hi > INT64_MAX)
+    return {};
+  return {static_cast<int64_t>(lo), static_cast<int64_t>(hi)};
+}
+
+/** What is known about the tracked variables at a point of the callable */
+struct Env {
+  std::map<std::string, Range> ranges; // the others can be anything
+  std::set<std::string> non_null;      // pointers
+};
+
+Env join(Env const &a, Env const &b) {
+  Env j;
+  for (auto const &v : a.ranges) {
+    auto it = b.ranges.find(v.first);
+    if (it != b.ranges.end())
+      j.ranges[v.first] = hull(v.second, it->second);
+  }
+  for (auto const &x : a.non_null)
+    if (b.non_null.count(x))
+      j.non_null.insert(x);
+  return j;
+}
+
+Range range(Expr const &e, Env const &env) {
+  if (auto k = dynamic_cast<IntConstant const *>(&e))
+    return {k->value, k->value};
+  if (auto v = dynamic_cast<Variable const *>(&e)) {
+    auto it = env.ranges.find(v->label);
+    return it == env.ranges.end() ? Range{} : it->second;
+  }
+  if (auto uo = dynamic_cast<UnopApp const *>(&e)) {
+    if (uo->op != Unop::Negate)
+      return {};
+    auto r = range(*uo->arg, env);
+    return exact(-static_cast<wide>(r.hi), -static_cast<wide>(r.lo));
+  }
+  auto bo = dynamic_cast<BinopApp const *>(&e);
+  if (!bo)
+    return {};
+  auto l = range(*bo->left_arg, env), r = range(*bo->right_arg, env);
+  switch (bo->op) {
+  case Binop::Add:
+    return exact(static_cast<wide>(l.lo) + r.lo,
+                 static_cast<wide>(l.hi) + r.hi);
+  case Binop::Subtract:
+    return exact(static_cast<wide>(l.lo) - r.hi,
+                 static_cast<wide>(l.hi) - r.lo);
+  case Binop::Modulus:
+    // the remainder has the sign of the dividend
+    if (r.lo == r.hi && r.lo > 0)
+      return {l.lo >= 0 ? 0 : 1 - r.lo, l.hi <= 0 ? 0 : r.lo - 1};
+    return {};
+  case Binop::BitAnd:
+    if (r.lo == r.hi && r.lo >= 0)
+      return {0, r.lo};
+    if (l.lo == l.hi && l.lo >= 0)
+      return {0, l.lo};
+    return {};
+  default:
+    return {};
+  }
+}
+
+Binop negation(Binop op) {
+  switch (op) {
+  case Binop::Lt:  return Binop::Geq;
+  case Binop::Leq: return Binop::Gt;
+  case Binop::Gt:  return Binop::Leq;
+  case Binop::Geq: return Binop::Lt;
+  case Binop::Eq:  return Binop::Neq;
+  default:         return Binop::Eq;
+  }
+}
+
+/** a op b is b mirror(op) a */
+Binop mirror(Binop op) {
+  switch (op) {
+  case Binop::Lt:  return Binop::Gt;
+  case Binop::Leq: return Binop::Geq;
+  case Binop::Gt:  return Binop::Lt;
+  case Binop::Geq: return Binop::Leq;
+  default:         return op;
+  }
+}
+
+/** Whether the value of pointer expression e cannot be null */
+bool non_null(Expr const &e, Env const &env) {
+  if (dynamic_cast<Alloc const *>(&e) || dynamic_cast<Address const *>(&e))
+    return true;
+  auto v = dynamic_cast<Variable const *>(&e);
+  return v && env.non_null.count(v->label);
+}
+
+/** Narrow what is known of variable x knowing that x op e */
+void narrow(Env &env, std::string const &x, Binop op, Expr const &e,
+            Range b) {
+  if (op == Binop::Neq && dynamic_cast<Null const *>(&e))
+    env.non_null.insert(x);
+  auto it = env.ranges.find(x);
+  if (it == env.ranges.end())
+    return; // not tracked
+  auto &r = it->second;
+  switch (op) {
+  case Binop::Lt:
+    r.hi = std::min(r.hi, saturate(static_cast<wide>(b.hi) - 1));
+    break;
+  case Binop::Leq:
+    r.hi = std::min(r.hi, b.hi);
+    break;
+  case Binop::Gt:
+    r.lo = std::max(r.lo, saturate(static_cast<wide>(b.lo) + 1));
+    break;
+  case Binop::Geq:
+    r.lo = std::max(r.lo, b.lo);
+    break;
+  case Binop::Eq:
+    r.lo = std::max(r.lo, b.lo);
+    r.hi = std::min(r.hi, b.hi);
+    break;
+  default:
+    break;
+  }
+}
+
+/** What env becomes when condition evaluates to truth */
+Env refine(Env env, Expr const &condition, bool truth) {
+  if (auto uo = dynamic_cast<UnopApp const *>(&condition)) {
+    if (uo->op == Unop::LogNot)
+      return refine(env, *uo->arg, !truth);
+    return env;
+  }
+  auto bo = dynamic_cast<BinopApp const *>(&condition);
+  if (!bo)
+    return env;
+  if (bo->op == Binop::BoolAnd || bo->op == Binop::BoolOr) {
+    // when the left operand decides, the right one is not evaluated
+    bool decides = bo->op == Binop::BoolOr;
+    if (truth == decides)
+      return join(refine(env, *bo->left_arg, decides),
+                  refine(refine(env, *bo->left_arg, !decides),
+                         *bo->right_arg, decides));
+    return refine(refine(env, *bo->left_arg, !decides), *bo->right_arg,
+                  !decides);
+  }
+  switch (bo->op) {
+  case Binop::Lt:
+  case Binop::Leq:
+  case Binop::Gt:
+  case Binop::Geq:
+  case Binop::Eq:
+  case Binop::Neq:
+    break;
+  default:
+    return env;
+  }
+  auto op = truth ? bo->op : negation(bo->op);
+  auto l = range(*bo->left_arg, env), r = range(*bo->right_arg, env);
+  if (auto x = dynamic_cast<Variable const *>(bo->left_arg.get()))
+    narrow(env, x->label, op, *bo->right_arg, r);
+  if (auto y = dynamic_cast<Variable const *>(bo->right_arg.get()))
+    narrow(env, y->label, mirror(op), *bo->left_arg, l);
+  return env;
+}
+
+/** Visits all the statements and expressions of a callable */
+struct Walker : public StmtVisitor, public ExprVisitor {
+  void visit(Assign const &a) override {
+    a.left->accept(*this);
+    a.right->accept(*this);
+  }
+  void visit(Eval const &e) override { e.expr->accept(*this); }
+  void visit(Print const &p) override { p.arg->accept(*this); }
+  void visit(Block const &b) override {
+    for (auto const &s : b.body)
+      s->accept(*this);
+  }
+  void visit(IfElse const &ie) override {
+    ie.condition->accept(*this);
+    ie.true_branch->accept(*this);
+    ie.false_branch->accept(*this);
+  }
+  void visit(While const &w) override {
+    w.condition->accept(*this);
+    w.loop_body->accept(*this);
+  }
+  void visit(Declare const &d) override { d.init->accept(*this); }
+  void visit(Return const &r) override {
+    if (r.arg)
+      r.arg->accept(*this);
+  }
+
+  void visit(Variable const &) override {}
+  void visit(IntConstant const &) override {}
+  void visit(BoolConstant const &) override {}
+  void visit(UnopApp const &uo) override { uo.arg->accept(*this); }
+  void visit(BinopApp const &bo) override {
+    bo.left_arg->accept(*this);
+    bo.right_arg->accept(*this);
+  }
+  void visit(Call const &c) override {
+    for (auto const &a : c.args)
+      a->accept(*this);
+  }
+  void visit(Alloc const &a) override { a.size->accept(*this); }
+  void visit(Null const &) override {}
+  void visit(Address const &a) override { a.src->accept(*this); }
+  void visit(ListElem const &le) override {
+    le.lst->accept(*this);
+    le.idx->accept(*this);
+  }
+  void visit(Deref const &d) override { d.ptr->accept(*this); }
+};
+
+/** The variables whose address is taken: they can change behind our back */
+struct AddressTaken : public Walker {
+  std::set<std::string> vars;
+  using Walker::visit;
+  void visit(Address const &a) override {
+    if (auto v = dynamic_cast<Variable const *>(a.src.get()))
+      vars.insert(v->label);
+    Walker::visit(a);
+  }
+};
+
+/** How a loop body changes the variables it assigns */
+struct Motion : public Walker {
+  enum Direction { UP, DOWN, ANY };
+  std::map<std::string, Direction> vars;
+  std::set<std::string> nullable; // assigned a pointer that may be null
+
+  void note(std::string const &x, Direction d) {
+    auto it = vars.find(x);
+    if (it == vars.end())
+      vars[x] = d;
+    else if (it->second != d)
+      it->second = ANY;
+  }
+
+  /** The direction of x = e, if e is x plus or minus a constant */
+  static Direction direction(std::string const &x, Expr const &e) {
+    auto bo = dynamic_cast<BinopApp const *>(&e);
+    if (!bo || (bo->op != Binop::Add && bo->op != Binop::Subtract))
+      return ANY;
+    auto is_x = [&](Expr const &a) {
+      auto v = dynamic_cast<Variable const *>(&a);
+      return v && v->label == x;
+    };
+    auto k = dynamic_cast<IntConstant const *>(bo->right_arg.get());
+    bool x_left = is_x(*bo->left_arg);
+    if (!x_left && bo->op == Binop::Add && is_x(*bo->right_arg))
+      k = dynamic_cast<IntConstant const *>(bo->left_arg.get());
+    else if (!x_left)
+      return ANY;
+    if (!k)
+      return ANY;
+    bool up = bo->op == Binop::Add ? k->value >= 0 : k->value <= 0;
+    return up ? UP : DOWN;
+  }
+
+  using Walker::visit;
+  void visit(Assign const &a) override {
+    if (auto v = dynamic_cast<Variable const *>(a.left.get())) {
+      note(v->label, direction(v->label, *a.right));
+      if (!non_null(*a.right, Env{}))
+        nullable.insert(v->label);
+    }
+    Walker::visit(a);
+  }
+  void visit(Declare const &d) override {
+    note(d.var, ANY);
+    if (!non_null(*d.init, Env{}))
+      nullable.insert(d.var);
+    Walker::visit(d);
+  }
+};
+
+struct Analysis : public Walker {
+  Facts facts;
+  Env env;
+  std::set<std::string> untracked;
+
+  Analysis(Program const &prog, Callable const &cbl) {
+    for (auto const &gv : prog.global_vars)
+      untracked.insert(gv.first);
+    for (auto const &gv : prog.extern_vars)
+      untracked.insert(gv.first);
+    AddressTaken taken;
+    cbl.body->accept(taken);
+    untracked.insert(taken.vars.begin(), taken.vars.end());
+  }
+
+  void assign(std::string const &x, Type *ty, Expr const &e) {
+    bool tracked = !untracked.count(x);
+    if (dynamic_cast<INT64 *>(ty) && tracked)
+      env.ranges[x] = range(e, env);
+    else
+      env.ranges.erase(x);
+    if (dynamic_cast<POINTER *>(ty) && tracked && non_null(e, env))
+      env.non_null.insert(x);
+    else
+      env.non_null.erase(x);
+  }
+
+  /** Record whether the pointer ptr is known not to be null at access */
+  void dereference(Expr const &access, Expr const &ptr) {
+    if (non_null(ptr, env))
+      facts.non_null.insert(&access);
+    // past the access, or its check, the pointer is not null
+    auto v = dynamic_cast<Variable const *>(&ptr);
+    if (v && !untracked.count(v->label))
+      env.non_null.insert(v->label);
+  }
+
+  using Walker::visit;
+
+  void visit(Declare const &d) override {
+    Walker::visit(d);
+    assign(d.var, d.ty, *d.init);
+  }
+
+  void visit(Assign const &a) override {
+    Walker::visit(a);
+    if (auto v = dynamic_cast<Variable const *>(a.left.get()))
+      assign(v->label, v->meta->ty, *a.right);
+  }
+
+  void visit(IfElse const &ie) override {
+    ie.condition->accept(*this);
+    auto entry = env;
+    env = refine(entry, *ie.condition, true);
+    ie.true_branch->accept(*this);
+    auto after_true = env;
+    env = refine(entry, *ie.condition, false);
+    ie.false_branch->accept(*this);
+    env = join(after_true, env);
+  }
+
+  void visit(While const &w) override {
+    // the ranges at the head of the loop: a variable that the body only
+    // increases keeps its lower bound, and conversely
+    Motion motion;
+    w.loop_body->accept(motion);
+    for (auto const &m : motion.vars) {
+      auto it = env.ranges.find(m.first);
+      if (it == env.ranges.end())
+        continue;
+      if (m.second == Motion::UP)
+        it->second.hi = INT64_MAX;
+      else if (m.second == Motion::DOWN)
+        it->second.lo = INT64_MIN;
+      else
+        env.ranges.erase(it);
+    }
+    for (auto const &x : motion.nullable)
+      env.non_null.erase(x);
+    auto head = env;
+    w.condition->accept(*this);
+    env = refine(head, *w.condition, true);
+    w.loop_body->accept(*this);
+    env = refine(head, *w.condition, false);
+  }
+
+  void visit(BinopApp const &bo) override {
+    if (bo.op != Binop::BoolAnd && bo.op != Binop::BoolOr) {
+      Walker::visit(bo);
+      return;
+    }
+    // the right operand only runs when the left one does not decide
+    bo.left_arg->accept(*this);
+    auto saved = env;
+    env = refine(env, *bo.left_arg, bo.op == Binop::BoolAnd);
+    bo.right_arg->accept(*this);
+    env = saved;
+  }
+
+  void visit(ListElem const &le) override {
+    Walker::visit(le);
+    if (dynamic_cast<POINTER *>(le.lst->meta->ty))
+      dereference(le, *le.lst);
+    auto lst = dynamic_cast<LIST *>(le.lst->meta->ty);
+    if (!lst)
+      return;
+    auto r = range(*le.idx, env);
+    if (r.lo >= 0 && r.hi < lst->length)
+      facts.in_bounds.insert(&le);
+  }
+
+  void visit(Deref const &d) override {
+    Walker::visit(d);
+    dereference(d, *d.ptr);
+  }
+};
+
+/** Whether the statements or expressions visited use the variable var */
+struct Mentions : public Walker {
+  std::string const &var;
+  bool found = false;
+  explicit Mentions(std::string const &var) : var{var} {}
+  using Walker::visit;
+  void visit(Variable const &v) override { found = found || v.label == var; }
+  void visit(Declare const &d) override {
+    found = found || d.var == var; // shadowing: stop there too
+    Walker::visit(d);
+  }
+};
+
+template <typename Node> bool mentions(Node const &node, std::string const &var) {
+  Mentions m{var};
+  node.accept(m);
+  return m.found;
+}
+
+/**
+ * The declarations of int64 and bool lists followed, in their block, by
+ * assignments to all their elements y[k] with constant indices k, before
+ * anything else reads y or leaves the straight-line code
+ */
+struct Overwritten : public Walker {
+  std::unordered_set<Declare const *> decls;
+  using Walker::visit;
+
+  void visit(Block const &b) override {
+    for (std::size_t i = 0; i < b.body.size(); i++)
+      if (auto d = dynamic_cast<Declare const *>(b.body[i].get()))
+        if (overwritten(*d, b.body, i + 1))
+          decls.insert(d);
+    Walker::visit(b);
+  }
+
+  static bool overwritten(Declare const &d, std::vector<StmtPtr> const &body,
+                          std::size_t from) {
+    auto lst = dynamic_cast<LIST *>(d.ty);
+    if (!lst || sizeOf(lst->typ) != 8 || holdsPointers(lst->typ))
+      return false; // the collector scans pointer lists from the start
+    std::vector<bool> written(lst->length, false);
+    auto left = lst->length;
+    for (auto i = from; i < body.size() && left > 0; i++) {
+      auto const *stmt = body[i].get();
+      auto as = dynamic_cast<Assign const *>(stmt);
+      if (!as && !dynamic_cast<Eval const *>(stmt) &&
+          !dynamic_cast<Print const *>(stmt) &&
+          !dynamic_cast<Declare const *>(stmt))
+        return false; // control flow
+      if (as && !mentions(*as->right, d.var)) {
+        auto le = dynamic_cast<ListElem const *>(as->left.get());
+        auto v = le ? dynamic_cast<Variable const *>(le->lst.get()) : nullptr;
+        auto k = le ? dynamic_cast<IntConstant const *>(le->idx.get()) : nullptr;
+        if (v && k && v->label == d.var) {
+          if (k->value < 0 || k->value >= lst->length)
+            return false;
+          if (!written[k->value]) {
+            written[k->value] = true;
+            left--;
+          }
+          continue;
+        }
+      }
+      if (mentions(*stmt, d.var))
+        return false;
+    }
+    return left == 0;
+  }
+};
+
+} // namespace
+
+std::set<std::string> address_taken(Callable const &cbl) {
+  AddressTaken taken;
+  cbl.body->accept(taken);
+  return taken.vars;
+}
+
+std::unordered_set<Declare const *> overwritten_lists(Callable const &cbl) {
+  Overwritten walker;
+  cbl.body->accept(walker);
+  return walker.decls;
+}
+
+Facts analyze(Program const &prog, Callable const &cbl) {
+  Analysis analysis{prog, cbl};
+  // the parameters can be anything, and are not in env
+  cbl.body->accept(analysis);
+  return analysis.facts;
+}
+
+} // namespace checks
+} // namespace bx
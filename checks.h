@@ -0,0 +1,69 @@
+#pragma once
+
+/**
+ * Run-time checks of the generated code (bx --checked).
+ *
+ * With bounds checks, every access lst[i] to a list of length n tests
+ * 0 <= i < n and calls bx_panic() otherwise; the accesses through pointers
+ * have no length to compare with and stay unchecked. With null checks,
+ * the dereferences *p and p[i] of pointers call bx_panic() if p is null.
+ *
+ * analyze() finds the checks that cannot fail with a range analysis of
+ * the int64 local variables over the source of a callable: the ranges
+ * come from the constants assigned to the variables, from the conditions
+ * of the enclosing if and while statements, and, for loops, from the
+ * direction in which the body moves each variable. An index in [0, n)
+ * needs no check, which removes the checks of the loops that walk a list
+ * with an induction variable bounded by its length.
+ *
+ * The same analysis follows the pointer variables that cannot be null: the
+ * ones assigned an alloc expression or an address, or tested against null,
+ * and the ones already dereferenced, since their check would have failed
+ * before.
+ *
+ * overwritten_lists() is the definite-assignment analysis that lets the
+ * code generator skip the zeroing of the local lists whose elements are
+ * all assigned before their first use.
+ */
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <unordered_set>
+
+#include "ast.h"
+
+namespace bx {
+namespace checks {
+
+struct Options {
+  bool bounds = false;
+  bool null = false;
+};
+
+struct Stats {
+  int bounds = 0;        // emitted
+  int bounds_proven = 0; // not needed
+  int null = 0;
+  int null_proven = 0;
+  Stats &operator+=(Stats const &other);
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+/** What analyze() proves about the expressions of a callable */
+struct Facts {
+  std::unordered_set<source::Expr const *> in_bounds; // ListElem nodes
+  std::unordered_set<source::Expr const *> non_null;  // Deref, ListElem
+};
+
+Facts analyze(source::Program const &prog, source::Callable const &cbl);
+
+/** The variables of cbl whose address is taken with & */
+std::set<std::string> address_taken(source::Callable const &cbl);
+
+/** The declarations of lists whose zero initialization is dead */
+std::unordered_set<source::Declare const *>
+overwritten_lists(source::Callable const &cbl);
+
+} // namespace checks
+} // namespace bx
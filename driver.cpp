@@ -0,0 +1,124 @@
+#include "driver.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+#include "lto.h"
+
+extern char **environ;
+
+namespace bx {
+namespace driver {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+char const *const self_exe = "/proc/self/exe";
+
+/** The flags an object was compiled with, one per line */
+std::string flags_file(std::string const &obj) { return obj + ".flags"; }
+
+std::string joined(std::vector<std::string> const &flags) {
+  std::string s;
+  for (auto const &f : flags)
+    s += f + '\n';
+  return s;
+}
+
+bool same_flags(std::string const &obj, std::string const &flags) {
+  std::ifstream in{flags_file(obj)};
+  std::string recorded{std::istreambuf_iterator<char>{in}, {}};
+  return in && recorded == flags;
+}
+
+bool up_to_date(std::string const &obj, std::string const &src) {
+  std::error_code ec;
+  auto obj_time = fs::last_write_time(obj, ec);
+  if (ec)
+    return false;
+  auto src_time = fs::last_write_time(src, ec);
+  if (ec || src_time > obj_time)
+    return false;
+  auto exe_time = fs::last_write_time(self_exe, ec);
+  return !ec && exe_time <= obj_time;
+}
+
+pid_t spawn(std::vector<std::string> const &args) {
+  std::vector<char *> argv;
+  for (auto const &a : args)
+    argv.push_back(const_cast<char *>(a.c_str()));
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (posix_spawn(&pid, self_exe, nullptr, nullptr, argv.data(), environ) !=
+      0)
+    throw std::runtime_error("cannot start the compilation of " +
+                             args.back());
+  return pid;
+}
+
+} // namespace
+
+std::vector<std::string> compile_modules(std::vector<std::string> const &files,
+                                         std::vector<std::string> const &flags,
+                                         int jobs, bool emit_asm, bool lto,
+                                         std::ostream &log) {
+  std::vector<std::string> objs;
+  std::vector<std::size_t> todo;
+  auto const flag_lines = joined(flags);
+  for (std::size_t i = 0; i < files.size(); i++) {
+    auto const &f = files[i];
+    auto root = f.substr(0, f.size() - 3);
+    objs.push_back(root + (emit_asm ? ".s" : ".o"));
+    if (up_to_date(objs.back(), f) && same_flags(objs.back(), flag_lines) &&
+        (!lto || up_to_date(root + lto::module_suffix, f)))
+      log << objs.back() << " is up to date.\n";
+    else
+      todo.push_back(i);
+  }
+
+  std::map<pid_t, std::size_t> running;
+  std::vector<std::string> failed;
+  auto wait_one = [&] {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    auto it = running.find(pid);
+    if (it == running.end())
+      return;
+    auto const &obj = objs[it->second];
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      failed.push_back(files[it->second]);
+      std::error_code ec;
+      fs::remove(flags_file(obj), ec);
+    } else {
+      std::ofstream out{flags_file(obj)};
+      out << flag_lines;
+    }
+    running.erase(it);
+  };
+  for (auto i : todo) {
+    while (static_cast<int>(running.size()) >= jobs)
+      wait_one();
+    std::vector<std::string> args{"bx.exe", "-c"};
+    args.insert(args.end(), flags.begin(), flags.end());
+    args.push_back(files[i]);
+    running.emplace(spawn(args), i);
+  }
+  while (!running.empty())
+    wait_one();
+  if (!failed.empty()) {
+    std::string msg = "cannot compile";
+    for (auto const &f : failed)
+      msg += " " + f;
+    throw std::runtime_error(msg);
+  }
+  return objs;
+}
+
+} // namespace driver
+} // namespace bx
@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * Separate compilation of the modules of a program (bx a.bx b.bx ...).
+ *
+ * Every .bx file is a module, compiled to its own object file by a bx -c
+ * process, so that the modules are compiled in parallel and the global
+ * state of the code generator stays per module. A module names what it uses
+ * from the others with extern declarations:
+ *
+ *     extern var counter : int64;
+ *     extern fun square(x : int64) : int64;
+ *     extern proc report(n : int64);
+ *
+ * and exactly one module defines main(). The object of a module is only
+ * rebuilt when it is older than the module or than bx itself, as make
+ * would do, or when it was compiled with other flags: these are recorded
+ * next to it, in file.o.flags.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bx {
+namespace driver {
+
+/**
+ * Compile the modules files, at most jobs at a time, by running
+ * "bx -c flags file" for every file whose object is out of date. Returns
+ * the object files (.s files with emit_asm) in the order of files; throws
+ * std::runtime_error when a compilation fails. With lto, the flags contain
+ * --lto and a module is also out of date without its RTL (see lto.h).
+ */
+std::vector<std::string> compile_modules(std::vector<std::string> const &files,
+                                         std::vector<std::string> const &flags,
+                                         int jobs, bool emit_asm, bool lto,
+                                         std::ostream &log);
+
+} // namespace driver
+} // namespace bx
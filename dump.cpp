@@ -0,0 +1,164 @@
+#include "dump.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <streambuf>
+#include <vector>
+
+namespace bx {
+namespace dump {
+
+namespace {
+
+struct KindInfo {
+  Kind kind;
+  char const *name, *suffix;
+};
+
+constexpr KindInfo kinds[] = {
+    {Kind::PARSED, "parsed", ".parsed"},
+    {Kind::RTL, "rtl", ".rtl"},
+    {Kind::ASM, "asm", ".s"},
+};
+
+} // namespace
+
+std::string Options::path(Kind kind, std::string const &file_root) const {
+  auto const &p = paths.at(kind);
+  if (!p.empty())
+    return p;
+  for (auto const &k : kinds)
+    if (k.kind == kind)
+      return file_root + k.suffix;
+  return file_root;
+}
+
+bool Options::to_stdout() const {
+  for (auto const &p : paths)
+    if (p.second == "-")
+      return true;
+  return false;
+}
+
+void parse(std::string const &list, Options &opts) {
+  std::size_t start = 0;
+  while (start <= list.size()) {
+    auto end = std::min(list.find(',', start), list.size());
+    auto item = list.substr(start, end - start);
+    start = end + 1;
+    if (item.empty())
+      continue;
+    auto colon = item.find(':');
+    auto name = item.substr(0, colon);
+    auto path = colon == std::string::npos ? "" : item.substr(colon + 1);
+    bool known = false;
+    for (auto const &k : kinds)
+      if (name == k.name) {
+        opts.paths[k.kind] = path;
+        known = true;
+      }
+    if (!known)
+      throw std::runtime_error("unknown dump " + name);
+  }
+}
+
+class Output::Buffer : public std::streambuf {
+  int fd;
+  bool own_fd;
+  std::vector<char> data;
+
+  bool write_all(char const *p, std::size_t n) {
+    while (n > 0) {
+      auto k = ::write(fd, p, n);
+      if (k < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      p += k;
+      n -= static_cast<std::size_t>(k);
+    }
+    return true;
+  }
+
+  bool drain() {
+    bool ok = write_all(pbase(), static_cast<std::size_t>(pptr() - pbase()));
+    setp(data.data(), data.data() + data.size());
+    return ok;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!drain())
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      sputc(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(char const *s, std::streamsize n) override {
+    if (n > epptr() - pptr()) {
+      // too large for what is left: no copy for what does not fit at all
+      if (!drain())
+        return 0;
+      if (n >= static_cast<std::streamsize>(data.size()))
+        return write_all(s, static_cast<std::size_t>(n)) ? n : 0;
+    }
+    std::memcpy(pptr(), s, static_cast<std::size_t>(n));
+    pbump(static_cast<int>(n));
+    return n;
+  }
+
+  int sync() override { return drain() ? 0 : -1; }
+
+public:
+  explicit Buffer(std::string const &path)
+      : fd{path == "-" ? STDOUT_FILENO
+                       : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                0644)},
+        own_fd{path != "-"}, data(buffer_size) {
+    if (fd < 0)
+      throw std::runtime_error("cannot open " + path + ": " +
+                               std::strerror(errno));
+    setp(data.data(), data.data() + data.size());
+  }
+
+  ~Buffer() override { close(); }
+
+  /** Writes what is left and closes the file; false if anything failed */
+  bool close() {
+    bool ok = drain();
+    if (own_fd) {
+      ok = ::close(fd) == 0 && ok;
+      own_fd = false;
+      fd = -1;
+    }
+    return ok;
+  }
+};
+
+Output::Output(std::string const &path)
+    : std::ostream{nullptr}, buffer{std::make_unique<Buffer>(path)} {
+  if (path == "-")
+    std::cout.flush(); // what was printed before goes first
+  rdbuf(buffer.get());
+}
+
+Output::~Output() {
+  flush();
+  rdbuf(nullptr);
+}
+
+void Output::close() {
+  // a failed write leaves data in the buffer: drop it, but report it
+  flush();
+  if (!buffer->close())
+    setstate(std::ios::badbit);
+}
+
+} // namespace dump
+} // namespace bx
@@ -0,0 +1,71 @@
+#pragma once
+
+/**
+ * The dumps of the intermediate representations (bx --emit=...).
+ *
+ * A compilation only writes what it needs: its object file, or its .s file
+ * with -S. The dumps are asked for by kind, each to its default file next
+ * to the source or to a path given after a colon, "-" being the standard
+ * output:
+ *
+ *   parsed  the program after type checking (.parsed)
+ *   rtl     the RTL, after the optimization passes (.rtl)
+ *   asm     the assembly, even when the object is encoded in-process (.s)
+ *
+ * so that "bx --emit=rtl:-,parsed f.bx", like "bx --emit=rtl:- --emit=parsed
+ * f.bx", prints the RTL and writes f.parsed. An Output goes through a large buffer of its own, written with
+ * write(2) when full: printing a whole program makes a few large system
+ * calls, and a named pipe works as well as a file.
+ */
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace bx {
+namespace dump {
+
+enum class Kind { PARSED, RTL, ASM };
+
+/** The dumps asked for: their paths, "" for the default file */
+struct Options {
+  std::map<Kind, std::string> paths;
+
+  bool wants(Kind kind) const { return paths.count(kind) != 0; }
+  /** The path of the dump of kind for the source file_root.bx */
+  std::string path(Kind kind, std::string const &file_root) const;
+  /** Whether a dump goes to the standard output */
+  bool to_stdout() const;
+};
+
+/**
+ * Add the dumps of a comma-separated list of kind[:path] to opts, a later
+ * path of a kind replacing an earlier one; throws std::runtime_error
+ */
+void parse(std::string const &list, Options &opts);
+
+constexpr std::size_t buffer_size = 1 << 20;
+
+/** An output stream on path, or on the standard output for "-" */
+class Output : public std::ostream {
+public:
+  /** Throws std::runtime_error if path cannot be opened */
+  explicit Output(std::string const &path);
+  /** Flushes the buffer, and closes the file, ignoring any error */
+  ~Output() override;
+  /**
+   * Flushes the buffer and closes the file; the stream is bad if anything
+   * could not be written. Nothing can be written after.
+   */
+  void close();
+  Output(Output const &) = delete;
+  Output &operator=(Output const &) = delete;
+
+private:
+  class Buffer;
+  std::unique_ptr<Buffer> buffer;
+};
+
+} // namespace dump
+} // namespace bx
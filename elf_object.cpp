@@ -0,0 +1,170 @@
+#include "elf_object.h"
+
+#include <elf.h>
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+namespace bx {
+namespace elf {
+
+namespace {
+
+// clang-format off
+enum SectionIndex : uint16_t {
+  NUL, TEXT, DATA, RELA_TEXT, RELA_DATA, SYMTAB, STRTAB, SHSTRTAB, NOTE_STACK,
+  NUM_SECTIONS
+};
+// clang-format on
+
+struct StringTable {
+  std::string bytes{'\0'};
+  uint32_t add(std::string const &s) {
+    auto off = static_cast<uint32_t>(bytes.size());
+    bytes += s;
+    bytes += '\0';
+    return off;
+  }
+};
+
+template <typename T> void append(std::string &out, T const &v) {
+  out.append(reinterpret_cast<char const *>(&v), sizeof v);
+}
+
+void align(std::string &out, std::size_t a) {
+  while (out.size() % a)
+    out += '\0';
+}
+
+} // namespace
+
+void write_object(std::ostream &out, amd64::Object const &obj) {
+  auto section_of = [](amd64::Object::Section s) -> uint16_t {
+    return s == amd64::Object::TEXT ? TEXT : DATA;
+  };
+
+  // Symbol table: null, the two section symbols, the local symbols, then
+  // the global symbols (defined first, then undefined ones)
+  StringTable strtab;
+  std::vector<Elf64_Sym> syms(3, Elf64_Sym{});
+  for (uint16_t s : {TEXT, DATA}) {
+    syms[s].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    syms[s].st_shndx = s;
+  }
+  std::map<std::string, amd64::Object::Symbol const *> defined;
+  for (auto const &sym : obj.symbols)
+    defined.emplace(sym.name, &sym);
+  std::map<std::string, uint32_t> index;
+  auto add_symbol = [&](std::string const &name, unsigned char bind,
+                        uint16_t shndx, uint64_t value) {
+    Elf64_Sym s{};
+    s.st_name = strtab.add(name);
+    s.st_info = ELF64_ST_INFO(bind, STT_NOTYPE);
+    s.st_shndx = shndx;
+    s.st_value = value;
+    index[name] = static_cast<uint32_t>(syms.size());
+    syms.push_back(s);
+  };
+  for (auto const &sym : obj.symbols)
+    if (!sym.global)
+      add_symbol(sym.name, STB_LOCAL, section_of(sym.section), sym.offset);
+  auto first_global = static_cast<uint32_t>(syms.size());
+  for (auto const &sym : obj.symbols)
+    if (sym.global)
+      add_symbol(sym.name, STB_GLOBAL, section_of(sym.section), sym.offset);
+  for (auto const &r : obj.relocs)
+    if (!defined.count(r.symbol) && !index.count(r.symbol))
+      add_symbol(r.symbol, STB_GLOBAL, SHN_UNDEF, 0);
+
+  // Relocations: local symbols are referenced through their section
+  std::string rela[2];
+  for (auto const &r : obj.relocs) {
+    Elf64_Rela rel{};
+    rel.r_offset = r.offset;
+    rel.r_addend = r.addend;
+    uint32_t sym = index.at(r.symbol);
+    auto d = defined.find(r.symbol);
+    if (d != defined.end() && !d->second->global) {
+      sym = section_of(d->second->section);
+      rel.r_addend += static_cast<int64_t>(d->second->offset);
+    }
+    rel.r_info = ELF64_R_INFO(sym, r.type);
+    append(rela[r.section == amd64::Object::TEXT ? 0 : 1], rel);
+  }
+
+  std::string symtab;
+  for (auto const &s : syms)
+    append(symtab, s);
+
+  StringTable shstrtab;
+  Elf64_Shdr shdrs[NUM_SECTIONS] = {};
+  auto set_header = [&](SectionIndex i, char const *name, uint32_t type,
+                        uint64_t flags, uint64_t align) {
+    shdrs[i].sh_name = shstrtab.add(name);
+    shdrs[i].sh_type = type;
+    shdrs[i].sh_flags = flags;
+    shdrs[i].sh_addralign = align;
+  };
+  set_header(TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16);
+  set_header(DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8);
+  set_header(RELA_TEXT, ".rela.text", SHT_RELA, SHF_INFO_LINK, 8);
+  set_header(RELA_DATA, ".rela.data", SHT_RELA, SHF_INFO_LINK, 8);
+  set_header(SYMTAB, ".symtab", SHT_SYMTAB, 0, 8);
+  set_header(STRTAB, ".strtab", SHT_STRTAB, 0, 1);
+  set_header(SHSTRTAB, ".shstrtab", SHT_STRTAB, 0, 1);
+  set_header(NOTE_STACK, ".note.GNU-stack", SHT_PROGBITS, 0, 1);
+  for (auto i : {RELA_TEXT, RELA_DATA}) {
+    shdrs[i].sh_link = SYMTAB;
+    shdrs[i].sh_info = i == RELA_TEXT ? TEXT : DATA;
+    shdrs[i].sh_entsize = sizeof(Elf64_Rela);
+  }
+  shdrs[SYMTAB].sh_link = STRTAB;
+  shdrs[SYMTAB].sh_info = first_global;
+  shdrs[SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+  // Lay out the file: header, section contents, section header table
+  std::string file(sizeof(Elf64_Ehdr), '\0');
+  auto place = [&](SectionIndex i, char const *bytes, std::size_t size) {
+    align(file, shdrs[i].sh_addralign);
+    shdrs[i].sh_offset = file.size();
+    shdrs[i].sh_size = size;
+    file.append(bytes, size);
+  };
+  place(TEXT, reinterpret_cast<char const *>(obj.text.data()),
+        obj.text.size());
+  place(DATA, reinterpret_cast<char const *>(obj.data.data()),
+        obj.data.size());
+  place(RELA_TEXT, rela[0].data(), rela[0].size());
+  place(RELA_DATA, rela[1].data(), rela[1].size());
+  place(SYMTAB, symtab.data(), symtab.size());
+  place(STRTAB, strtab.bytes.data(), strtab.bytes.size());
+  place(NOTE_STACK, "", 0);
+  place(SHSTRTAB, shstrtab.bytes.data(), shstrtab.bytes.size());
+  align(file, 8);
+
+  Elf64_Ehdr ehdr{};
+  std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_shoff = file.size();
+  ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr.e_shentsize = sizeof(Elf64_Shdr);
+  ehdr.e_shnum = NUM_SECTIONS;
+  ehdr.e_shstrndx = SHSTRTAB;
+  std::memcpy(&file[0], &ehdr, sizeof ehdr);
+  for (auto const &sh : shdrs)
+    append(file, sh);
+
+  out.write(file.data(), static_cast<std::streamsize>(file.size()));
+  if (!out)
+    throw std::runtime_error("could not write the object file");
+}
+
+} // namespace elf
+} // namespace bx
@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * Writer for ELF64 relocatable object files (x86-64), so that the output of
+ * the in-process assembler can be linked without going through a .s file.
+ */
+
+#include <ostream>
+
+#include "amd64_encode.h"
+
+namespace bx {
+namespace elf {
+
+void write_object(std::ostream &out, amd64::Object const &obj);
+
+} // namespace elf
+} // namespace bx
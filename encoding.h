@@ -0,0 +1,62 @@
+#pragma once
+
+/**
+ * The encodings shared by the files the compiler writes: the FNV-1a hash,
+ * of the keys of the compilation cache (see cache.h) and of the profile map
+ * (see profile.h), and the unsigned LEB128 numbers of the RTL files (see
+ * rtl_io.h), of the cache entries and of the profiles.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace bx {
+namespace encoding {
+
+constexpr uint64_t fnv_basis = 0xcbf29ce484222325ull;
+
+/** The FNV-1a hash of s, continuing the hash h of what came before it */
+inline uint64_t fnv1a(std::string const &s, uint64_t h = fnv_basis) {
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+/** Append v to out as unsigned LEB128 */
+inline void put_uleb(std::string &out, uint64_t v) {
+  if (v < 0x80) {
+    out += static_cast<char>(v);
+    return;
+  }
+  do {
+    uint8_t b = v & 0x7f;
+    v >>= 7;
+    out += static_cast<char>(v ? b | 0x80 : b);
+  } while (v);
+}
+
+/**
+ * Read the unsigned LEB128 number at pos in in, and move pos past it;
+ * throws std::runtime_error with the message truncated if in ends first,
+ * or bad if the number does not fit in 64 bits
+ */
+inline uint64_t get_uleb(std::string const &in, std::size_t &pos,
+                         char const *truncated, char const *bad) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos == in.size())
+      throw std::runtime_error(truncated);
+    auto c = static_cast<uint8_t>(in[pos++]);
+    v |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return v;
+  }
+  throw std::runtime_error(bad);
+}
+
+} // namespace encoding
+} // namespace bx
@@ -0,0 +1,46 @@
+#include "gc.h"
+
+#include "amd64.h"
+
+namespace bx {
+namespace gc {
+
+char const *const stackmaps_symbol = "__bx_stackmaps";
+
+std::vector<std::string> global_roots(source::Program const &prog) {
+  std::vector<std::string> roots;
+  for (auto const &gv : prog.global_vars)
+    if (source::holdsPointers(gv.second->ty))
+      roots.push_back(gv.first);
+  return roots;
+}
+
+void register_stackmaps(rtl::Program &prog, std::string const &entry) {
+  for (auto &cbl : prog) {
+    if (cbl.name != entry || cbl.schedule.empty())
+      continue;
+    auto maps = cbl.fresh_pseudo();
+    auto start = cbl.fresh_label(), in_label = cbl.fresh_label();
+    auto old_entry = cbl.schedule.front();
+    cbl.schedule.insert(cbl.schedule.begin(), start);
+    cbl.body.insert_or_assign(start, rtl::Goto::make(in_label));
+    auto add_sequential = [&](auto use_label) {
+      auto next = cbl.fresh_label();
+      cbl.add_instr(in_label, use_label(next));
+      in_label = next;
+    };
+    add_sequential([&](auto next) {
+      return rtl::CopyAP::make(stackmaps_symbol, -1, amd64::reg::rip,
+                               rtl::discard_pr, maps, next);
+    });
+    add_sequential([&](auto next) {
+      return rtl::CopyPM::make(maps, amd64::reg::rdi, next);
+    });
+    add_sequential(
+        [&](auto next) { return rtl::Call::make("bx_gc_start", 1, next); });
+    cbl.add_instr(in_label, rtl::Goto::make(old_entry));
+  }
+}
+
+} // namespace gc
+} // namespace bx
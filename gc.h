@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * Garbage collection of the heap of the alloc expressions (bx --gc).
+ *
+ * The collector is in the runtime (bxrt.c): a non-moving mark-sweep that
+ * runs in bx_alloc when enough memory was allocated since the last
+ * collection. It finds the roots with the stack maps the compiler emits:
+ * for every callable, the frame slots of Callable::roots and
+ * Callable::frame_roots (rtl.h), which are the pseudos and variables whose
+ * type may hold the address of a heap block, and the global variables of
+ * such types. A slot may hold a stale value at the time of a collection,
+ * so the runtime only follows the values that point into a block.
+ *
+ * The table is in the data section at stackmaps_symbol, in the format of
+ * bx_gc_start() (bxrt.h), and written by stackmaps_to_asm() (rtl_asm.h).
+ * Without a call to bx_gc_start(), the heap is never collected.
+ */
+
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "rtl.h"
+
+namespace bx {
+namespace gc {
+
+extern char const *const stackmaps_symbol;
+
+/** The global variables of prog that may hold the address of a heap block */
+std::vector<std::string> global_roots(source::Program const &prog);
+
+/**
+ * Call bx_gc_start() with the stack maps at the start of the entry
+ * procedure. No pseudo is added to the existing code, so the frame layout
+ * of the callables does not change.
+ */
+void register_stackmaps(rtl::Program &prog, std::string const &entry = "main");
+
+} // namespace gc
+} // namespace bx
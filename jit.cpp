@@ -0,0 +1,160 @@
+#include "jit.h"
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "bxrt.h"
+
+namespace bx {
+namespace jit {
+
+namespace {
+
+/** The runtime entry points and data, resolved without going through dlsym() */
+void *runtime_symbol(std::string const &name) {
+  static const std::unordered_map<std::string, void *> runtime{
+      {"bx_panic", reinterpret_cast<void *>(&bx_panic)},
+      {"bx_print_int", reinterpret_cast<void *>(&bx_print_int)},
+      {"bx_print_bool", reinterpret_cast<void *>(&bx_print_bool)},
+      {"bx_alloc", reinterpret_cast<void *>(&bx_alloc)},
+      {"bx_alloc_refs", reinterpret_cast<void *>(&bx_alloc_refs)},
+      {"bx_gc_start", reinterpret_cast<void *>(&bx_gc_start)},
+      {"bx_profile_start", reinterpret_cast<void *>(&bx_profile_start)},
+      {"malloc", reinterpret_cast<void *>(&malloc)},
+      {"memset", reinterpret_cast<void *>(&memset)},
+      {"bx_out_buf", reinterpret_cast<void *>(bx_out_buf)},
+      {"bx_out_len", reinterpret_cast<void *>(&bx_out_len)},
+      {"bx_out_limit", reinterpret_cast<void *>(&bx_out_limit)},
+      {"bx_heap", reinterpret_cast<void *>(&bx_heap)},
+  };
+  auto it = runtime.find(name);
+  if (it != runtime.end())
+    return it->second;
+  void *addr = dlsym(RTLD_DEFAULT, name.c_str());
+  if (!addr)
+    throw std::runtime_error("undefined symbol " + name);
+  return addr;
+}
+
+constexpr std::size_t STUB_SIZE = 16;
+
+std::size_t round_up(std::size_t n, std::size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+/**
+ * The loaded image: text, then one call stub per external function (used
+ * when the function is too far for a rel32 call), then the data.
+ */
+class Image {
+  uint8_t *base = nullptr;
+  std::size_t size = 0, code_size = 0;
+  uint8_t *text = nullptr, *stubs = nullptr, *data = nullptr;
+  std::unordered_map<std::string, uint8_t *> stub_of;
+  std::unordered_map<std::string, uint8_t *> symbols;
+
+  uint8_t *stub(std::string const &name, uint8_t *target) {
+    auto it = stub_of.find(name);
+    if (it != stub_of.end())
+      return it->second;
+    uint8_t *s = stubs + STUB_SIZE * stub_of.size();
+    // movabs $target, %r11; jmp *%r11
+    uint8_t code[] = {0x49, 0xbb, 0, 0, 0, 0, 0, 0, 0, 0, 0x41, 0xff, 0xe3};
+    std::memcpy(code + 2, &target, 8);
+    std::memcpy(s, code, sizeof code);
+    stub_of.emplace(name, s);
+    return s;
+  }
+
+public:
+  explicit Image(amd64::Object const &obj) {
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t nstubs = 0;
+    for (auto const &r : obj.relocs)
+      if (r.type == amd64::R_X86_64_PLT32)
+        nstubs++;
+    code_size = round_up(obj.text.size() + STUB_SIZE * nstubs, page);
+    size = code_size + round_up(obj.data.size() + 1, page);
+    // ask for memory close to the runtime, so that rel32 references to it
+    // are in range
+    auto near = reinterpret_cast<uintptr_t>(&bx_print_int) & ~(page - 1);
+    auto hint = reinterpret_cast<void *>(near - (uintptr_t{1} << 28));
+    void *mem = mmap(hint, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+      throw std::runtime_error("cannot allocate memory for the code");
+    base = static_cast<uint8_t *>(mem);
+    text = base;
+    stubs = base + round_up(obj.text.size(), STUB_SIZE);
+    data = base + code_size;
+    std::memcpy(text, obj.text.data(), obj.text.size());
+    std::memcpy(data, obj.data.data(), obj.data.size());
+
+    for (auto const &sym : obj.symbols)
+      symbols[sym.name] =
+          (sym.section == amd64::Object::TEXT ? text : data) + sym.offset;
+
+    for (auto const &r : obj.relocs) {
+      uint8_t *where = (r.section == amd64::Object::TEXT ? text : data) +
+                       r.offset;
+      auto def = symbols.find(r.symbol);
+      uint8_t *target = def != symbols.end()
+                            ? def->second
+                            : static_cast<uint8_t *>(runtime_symbol(r.symbol));
+      if (r.type == amd64::R_X86_64_64) {
+        auto value = reinterpret_cast<int64_t>(target) + r.addend;
+        std::memcpy(where, &value, 8);
+        continue;
+      }
+      auto pcrel = [&] {
+        return reinterpret_cast<int64_t>(target) + r.addend -
+               reinterpret_cast<int64_t>(where);
+      };
+      if (!fits32(pcrel()) && r.type == amd64::R_X86_64_PLT32)
+        target = stub(r.symbol, target);
+      int64_t value = pcrel();
+      if (!fits32(value))
+        throw std::runtime_error("symbol " + r.symbol +
+                                 " is out of range of the loaded code");
+      auto value32 = static_cast<int32_t>(value);
+      std::memcpy(where, &value32, 4);
+    }
+    if (mprotect(base, code_size, PROT_READ | PROT_EXEC) != 0)
+      throw std::runtime_error("cannot make the code executable");
+  }
+
+  ~Image() { munmap(base, size); }
+  Image(Image const &) = delete;
+  Image &operator=(Image const &) = delete;
+
+  void *lookup(std::string const &name) const {
+    auto it = symbols.find(name);
+    return it == symbols.end() ? nullptr : it->second;
+  }
+};
+
+} // namespace
+
+int run(amd64::Object const &obj, std::string const &entry) {
+  Image image{obj};
+  auto fn = reinterpret_cast<void (*)()>(image.lookup(entry));
+  if (!fn)
+    throw std::runtime_error("cannot find the " + entry + "() procedure");
+  std::fflush(stdout);
+  fn();
+  bx_profile_dump(); // before the counters are unmapped
+  bx_flush();
+  return 0;
+}
+
+} // namespace jit
+} // namespace bx
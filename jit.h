@@ -0,0 +1,23 @@
+#pragma once
+
+/**
+ * In-memory execution of assembled BX programs: the code is loaded into
+ * executable memory, linked against the runtime that is part of the
+ * compiler (bxrt.h), and called directly.
+ */
+
+#include <string>
+
+#include "amd64_encode.h"
+
+namespace bx {
+namespace jit {
+
+/**
+ * Load obj, run its entry procedure, and flush the output.
+ * Returns the exit status for the compiler (0 on success).
+ */
+int run(amd64::Object const &obj, std::string const &entry = "main");
+
+} // namespace jit
+} // namespace bx
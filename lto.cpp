@@ -0,0 +1,172 @@
+#include "lto.h"
+
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "pgo.h"
+#include "rtl_io.h"
+
+namespace bx {
+namespace lto {
+
+namespace {
+
+/** The callables that main() can reach through calls */
+std::set<std::string> reachable(rtl::Program const &prog) {
+  std::unordered_map<std::string, rtl::Callable const *> callables;
+  for (auto const &cbl : prog)
+    callables[cbl.name] = &cbl;
+  std::set<std::string> seen{"main"};
+  std::vector<std::string> todo{"main"};
+  while (!todo.empty()) {
+    auto it = callables.find(todo.back());
+    todo.pop_back();
+    if (it == callables.end())
+      continue;
+    auto const &cbl = *it->second;
+    for (auto const &l : cbl.schedule)
+      if (auto call = dynamic_cast<rtl::Call *>(cbl.body.at(l)))
+        if (seen.insert(call->func).second)
+          todo.push_back(call->func);
+  }
+  return seen;
+}
+
+int remove_unreachable(rtl::Program &prog) {
+  auto live = reachable(prog);
+  auto size = prog.size();
+  rtl::Program kept;
+  for (auto &cbl : prog)
+    if (live.count(cbl.name))
+      kept.push_back(std::move(cbl));
+  prog = std::move(kept);
+  return static_cast<int>(size - prog.size());
+}
+
+/**
+ * Replace the reads of the global variables that keep their initial value
+ * by moves of that value. The code generator reads a global through a
+ * pseudo holding its address, and writes it through such a pseudo too: a
+ * global keeps its value if the pseudos holding its address are only ever
+ * loaded from, and no store names it.
+ */
+int propagate_constants(rtl::Program &prog,
+                        std::map<std::string, int> const &globals) {
+  // by callable, the global whose address every pseudo holds
+  std::vector<std::unordered_map<int, std::string>> addresses(prog.size());
+  std::set<std::string> written;
+  for (std::size_t i = 0; i < prog.size(); i++) {
+    auto const &cbl = prog[i];
+    auto &addr = addresses[i];
+    for (auto const &l : cbl.schedule) {
+      auto instr = cbl.body.at(l);
+      if (auto ap = dynamic_cast<rtl::CopyAP *>(instr)) {
+        if (!globals.count(ap->goffset))
+          continue;
+        if (ap->pbase != rtl::discard_pr || addr.count(ap->dst.id))
+          written.insert(ap->goffset);
+        addr[ap->dst.id] = ap->goffset;
+      } else if (auto st = dynamic_cast<rtl::Store *>(instr))
+        written.insert(st->dest);
+    }
+    for (auto const &l : cbl.schedule) {
+      auto instr = cbl.body.at(l);
+      auto ap = dynamic_cast<rtl::CopyAP *>(instr);
+      auto ld = dynamic_cast<rtl::Load *>(instr);
+      for (auto const &p : rtl::pseudos(*instr)) {
+        auto it = addr.find(p.id);
+        if (it == addr.end())
+          continue;
+        bool read = (ap && ap->dst == p && ap->goffset == it->second) ||
+                    (ld && ld->pbase == p && ld->dest != p && ld->offset == 0);
+        if (!read)
+          written.insert(it->second);
+      }
+    }
+  }
+
+  int replaced = 0;
+  for (std::size_t i = 0; i < prog.size(); i++) {
+    auto &cbl = prog[i];
+    auto const &addr = addresses[i];
+    for (auto const &l : cbl.schedule) {
+      auto ld = dynamic_cast<rtl::Load *>(cbl.body.at(l));
+      if (!ld || ld->offset != 0)
+        continue;
+      std::string name = ld->src;
+      if (ld->pbase != rtl::discard_pr) {
+        auto it = addr.find(ld->pbase.id);
+        if (it == addr.end())
+          continue;
+        name = it->second;
+      }
+      auto it = globals.find(name);
+      if (it == globals.end() || written.count(name))
+        continue;
+      cbl.body.insert_or_assign(l,
+                                rtl::Move::make(it->second, ld->dest, ld->succ));
+      replaced++;
+    }
+  }
+  return replaced;
+}
+
+} // namespace
+
+Module read_module(std::string const &file) {
+  std::ifstream in{file, std::ios::binary};
+  if (!in)
+    throw std::runtime_error("cannot open " + file);
+  Module mod;
+  try {
+    mod.prog = rtl::read_program(in, mod.globals);
+  } catch (std::runtime_error const &e) {
+    throw std::runtime_error(file + ": " + e.what());
+  }
+  return mod;
+}
+
+void write_module(std::string const &file, rtl::Program const &prog,
+                  std::map<std::string, int> const &globals) {
+  std::ofstream out{file, std::ios::binary};
+  rtl::write_program(out, prog, globals);
+  if (!out)
+    throw std::runtime_error("cannot write " + file);
+}
+
+Module merge(std::vector<Module> modules) {
+  Module whole;
+  std::set<std::string> names;
+  for (auto &mod : modules) {
+    for (auto &cbl : mod.prog) {
+      if (!names.insert(cbl.name).second)
+        throw std::runtime_error(cbl.name + " is defined twice");
+      whole.prog.push_back(std::move(cbl));
+    }
+    for (auto const &glb : mod.globals)
+      if (!whole.globals.insert(glb).second)
+        throw std::runtime_error(glb.first + " is defined twice");
+  }
+  if (!names.count("main"))
+    throw std::runtime_error("main is not defined");
+  return whole;
+}
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  return out << stats.inlined << " calls inlined, " << stats.removed
+             << " callables removed, " << stats.constants
+             << " reads of globals made constant";
+}
+
+Stats optimize(Module &whole, sched::Scheduler &sched) {
+  Stats stats;
+  stats.inlined = pgo::inline_small(whole.prog, sched);
+  stats.removed = remove_unreachable(whole.prog);
+  stats.constants = propagate_constants(whole.prog, whole.globals);
+  return stats;
+}
+
+} // namespace lto
+} // namespace bx
@@ -0,0 +1,62 @@
+#pragma once
+
+/**
+ * Link-time optimization of the modules of a program (bx --lto a.bx b.bx
+ * ...).
+ *
+ * With --lto, the compilation of a module also writes its RTL, after the
+ * optimization passes, to a .bxl file next to its object (see rtl_io.h).
+ * The link step then reads the RTL of all the modules, merges it into one
+ * program and optimizes it as a whole before generating its code:
+ *
+ *   - inlining of the call sites whose callee is small, across modules
+ *     (see pgo::inline_small);
+ *   - removal of the callables that main() cannot reach;
+ *   - propagation of the initial value of the global variables that are
+ *     never written nor have their address taken, into their reads.
+ *
+ * The object files of the modules are not used by the link step, only
+ * kept up to date for a link without --lto.
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "rtl.h"
+#include "scheduler.h"
+
+namespace bx {
+namespace lto {
+
+constexpr char const *module_suffix = ".bxl";
+
+/** The RTL of a module, or of a whole program */
+struct Module {
+  rtl::Program prog;
+  std::map<std::string, int> globals; // with their initial values
+};
+
+/** Throws std::runtime_error if file cannot be read */
+Module read_module(std::string const &file);
+void write_module(std::string const &file, rtl::Program const &prog,
+                  std::map<std::string, int> const &globals);
+
+/**
+ * The program of modules; throws std::runtime_error when a callable or a
+ * global variable is defined twice, or main() is not defined
+ */
+Module merge(std::vector<Module> modules);
+
+struct Stats {
+  int inlined = 0;   // call sites
+  int removed = 0;   // callables
+  int constants = 0; // reads of global variables
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+Stats optimize(Module &whole, sched::Scheduler &sched);
+
+} // namespace lto
+} // namespace bx
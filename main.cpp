@@ -1,88 +1,580 @@
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
-
-#include "antlr4-runtime.h"
+#include <sstream>
+#include <thread>
 
 #include "ast.h"
 #include "ast_rtl.h"
 #include "rtl.h"
 #include "type_check.h"
 #include "amd64.h"
+#include "amd64_encode.h"
+#include "cache.h"
+#include "driver.h"
+#include "dump.h"
+#include "elf_object.h"
+#include "gc.h"
+#include "jit.h"
+#include "lto.h"
+#include "passes.h"
+#include "pgo.h"
+#include "profile.h"
 #include "rtl_asm.h"
+#include "rtl_interp.h"
+#include "rtl_io.h"
+#include "scheduler.h"
+#include "timing.h"
 
 using namespace bx;
 
+static void usage(char const *prog) {
+  std::cerr << "Usage: " << prog << " [-j N] [-c] [-o FILE] [-S]\n"
+            << "       [--profile | --profile-use[=FILE]]\n"
+            << "       [-O0 | -O1 | -O2 | -O3 | --passes=P,...] [--verify-passes]\n"
+            << "       [--pass-stats] [--gc] [--checked] [--run | --interp-rtl]\n"
+            << "       [--cache[=DIR]] [--lto] [--emit=KIND[:PATH],...]\n"
+            << "       file.bx...\n"
+            << "  -j N   use N worker threads (0: one per core); with several\n"
+            << "             files, compile N files at a time\n"
+            << "  -c     only compile the files to object files\n"
+            << "  -o FILE  name of the executable (default: the first file\n"
+            << "             with .exe)\n"
+            << "  -O0 .. -O3  optimization level (default: -O0)\n"
+            << "  --passes=P,...  run these passes instead of a level (see\n"
+            << "             passes.h)\n"
+            << "  --verify-passes  check the RTL after every pass\n"
+            << "  --pass-stats  print what every pass did\n"
+            << "  -S     go through a .s file assembled by gcc\n"
+            << "  --profile  count the executions of blocks and calls\n"
+            << "  --profile-use[=FILE]  optimize with the profile in FILE\n"
+            << "             (default: $BX_PROFILE, or bxprof.out)\n"
+            << "  --gc   collect the garbage of the heap\n"
+            << "  --checked  panic on out-of-bounds list accesses and null\n"
+            << "             dereferences\n"
+            << "  --run  run the program in memory instead of linking it\n"
+            << "  --interp-rtl  interpret the RTL instead of compiling it;\n"
+            << "             also runs the .bxl files written by --lto\n"
+            << "  --time-report[=json]  print the time and memory taken by\n"
+            << "             each phase\n"
+            << "  --parse-check  compare the parse with the one of ANTLR\n"
+            << "  --cache[=DIR]  reuse the code of the unchanged callables\n"
+            << "             (default: $BX_CACHE, or .bxcache)\n"
+            << "  --lto  optimize the modules together when linking them\n"
+            << "  --emit=KIND[:PATH],...  also write these dumps: parsed,\n"
+            << "             rtl, asm (to PATH, - for stdout; see dump.h)\n";
+  std::exit(1);
+}
+
+static void write_asm(std::ostream &out,
+                      std::vector<AsmProgram> const &asm_prog) {
+  for (auto const &fun : asm_prog)
+    for (auto const &l : fun)
+      out << *l;
+}
+
+/** Write obj to o_file; throws std::runtime_error if it cannot be written */
+static void write_object_file(amd64::Object const &obj,
+                              std::string const &o_file) {
+  std::ofstream o_out{o_file, std::ios::binary};
+  if (!o_out)
+    throw std::runtime_error("cannot write " + o_file);
+  elf::write_object(o_out, obj);
+  o_out.close();
+  if (!o_out)
+    throw std::runtime_error("cannot write " + o_file);
+}
+
+/**
+ * Write asm_prog to file_root.o, or to file_root.s with emit_asm; returns
+ * the name of the file. Throws std::runtime_error if it cannot be written.
+ */
+static std::string write_code(std::vector<AsmProgram> const &asm_prog,
+                              std::string const &file_root, bool emit_asm) {
+  if (emit_asm) {
+    // debugging path: print the assembly and let gcc assemble it
+    auto s_file = file_root + ".s";
+    dump::Output s_out{s_file};
+    write_asm(s_out, asm_prog);
+    s_out.close();
+    if (!s_out)
+      throw std::runtime_error("cannot write " + s_file);
+    return s_file;
+  }
+  auto o_file = file_root + ".o";
+  write_object_file(amd64::assemble(asm_prog), o_file);
+  return o_file;
+}
+
+/** Run prog with the RTL interpreter; returns the exit status */
+static int interpret(rtl::Program const &prog,
+                     std::map<std::string, int> const &globals) {
+  try {
+    auto stats = interp::run(prog, globals);
+    std::cerr << "interp-rtl: " << stats << '\n';
+    return 0;
+  } catch (std::runtime_error const &e) {
+    std::cerr << "interp-rtl: " << e.what() << '\n';
+    return 1;
+  }
+}
+
+/** Link the object files with bxrt into exe_file */
+static void link(std::vector<std::string> const &obj_files,
+                 std::string const &exe_file, std::string const &rt_flags,
+                 std::ostream &log) {
+  std::string cmd = "gcc -O2 -o " + exe_file;
+  for (auto const &obj : obj_files)
+    cmd += " " + obj;
+  cmd += " " + rt_flags;
+  if (std::system(cmd.c_str()) != 0) {
+    std::cerr << "Could not run gcc successfully!\n";
+    std::exit(2);
+  }
+  log << exe_file << " created.\n";
+}
 
 int main(int argc, char *argv[]) {
   const std::string rt_flags = "-L build -lbxrt -Wl,-rpath," +
                                std::filesystem::current_path().string() +
                                "/build/";
 
-  if (argc >= 2) {
-    std::string bx_file{argv[1]};
-
-    if (bx_file.size() < 3 || bx_file.substr(bx_file.size() - 3, 3) != ".bx") {
+  int jobs = 1;
+  bool compile_only = false;
+  std::string exe_file;
+  bool emit_asm = false;
+  bool run = false;
+  bool interp_rtl = false;
+  bool profile = false;
+  bool gc = false;
+  bool parse_check = false;
+  bool lto = false;
+  auto time_report = timing::Format::NONE;
+  std::vector<std::string> opt_passes;
+  bool verify_passes = false;
+  bool pass_stats = false;
+  checks::Options checks;
+  std::string profile_use;
+  std::string cache_dir;
+  dump::Options dumps;
+  std::vector<std::string> bx_files;
+  // the options that the compilations of the modules need
+  std::vector<std::string> module_flags;
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    if (arg[0] == '-' && arg != "-c" && arg != "-o" && arg.rfind("-j", 0) != 0)
+      module_flags.push_back(arg);
+    if (arg == "-j" && i + 1 < argc)
+      jobs = std::atoi(argv[++i]);
+    else if (arg.rfind("-j", 0) == 0 && arg.size() > 2)
+      jobs = std::atoi(arg.c_str() + 2);
+    else if (arg == "-c")
+      compile_only = true;
+    else if (arg == "-o" && i + 1 < argc)
+      exe_file = argv[++i];
+    else if (arg == "-S")
+      emit_asm = true;
+    else if (arg == "--run")
+      run = true;
+    else if (arg == "--interp-rtl")
+      interp_rtl = true;
+    else if (arg == "--profile")
+      profile = true;
+    else if (arg == "--gc")
+      gc = true;
+    else if (arg == "--parse-check")
+      parse_check = true;
+    else if (arg == "--lto")
+      lto = true;
+    else if (arg.rfind("--emit=", 0) == 0) {
+      try {
+        dump::parse(arg.substr(7), dumps);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        usage(argv[0]);
+      }
+    }
+    else if (arg == "--time-report")
+      time_report = timing::Format::TABLE;
+    else if (arg == "--time-report=json")
+      time_report = timing::Format::JSON;
+    else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' &&
+             arg[2] >= '0' && arg[2] <= '3')
+      opt_passes = passes::pipeline(arg[2] - '0');
+    else if (arg.rfind("--passes=", 0) == 0) {
+      try {
+        opt_passes = passes::parse(arg.substr(9));
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        usage(argv[0]);
+      }
+    } else if (arg == "--verify-passes")
+      verify_passes = true;
+    else if (arg == "--pass-stats")
+      pass_stats = true;
+    else if (arg == "--checked")
+      checks.bounds = checks.null = true;
+    else if (arg == "--profile-use") {
+      char const *env = std::getenv("BX_PROFILE");
+      profile_use = env && *env ? env : "bxprof.out";
+    } else if (arg.rfind("--profile-use=", 0) == 0 && arg.size() > 14)
+      profile_use = arg.substr(14);
+    else if (arg == "--cache") {
+      char const *env = std::getenv("BX_CACHE");
+      cache_dir = env && *env ? env : ".bxcache";
+    } else if (arg.rfind("--cache=", 0) == 0 && arg.size() > 8)
+      cache_dir = arg.substr(8);
+    else if (arg[0] == '-')
+      usage(argv[0]);
+    else
+      bx_files.push_back(arg);
+  }
+  if (profile && !profile_use.empty())
+    usage(argv[0]);
+  if (!cache_dir.empty() &&
+      (emit_asm || interp_rtl || profile || !profile_use.empty() || gc ||
+       lto || dumps.wants(dump::Kind::ASM))) {
+    // these need the RTL or the assembly of the whole program
+    std::cerr << "warning: --cache is not used with -S, --interp-rtl, "
+                 "--profile, --profile-use, --gc, --lto or --emit=asm\n";
+    cache_dir.clear();
+  }
+  if (jobs <= 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  auto is_rtl_file = [](std::string const &f) {
+    std::string suffix{lto::module_suffix};
+    return f.size() > suffix.size() &&
+           f.compare(f.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  if (interp_rtl && !bx_files.empty() &&
+      std::all_of(bx_files.begin(), bx_files.end(), is_rtl_file)) {
+    // the RTL written by --lto: no need to compile anything
+    lto::Module whole;
+    try {
+      std::vector<lto::Module> modules;
+      for (auto const &f : bx_files)
+        modules.push_back(lto::read_module(f));
+      whole = lto::merge(std::move(modules));
+    } catch (std::runtime_error const &e) {
+      std::cerr << e.what() << '\n';
+      std::exit(1);
+    }
+    return interpret(whole.prog, whole.globals);
+  }
+  for (auto const &bx_file : bx_files)
+    if (bx_file.size() < 3 ||
+        bx_file.substr(bx_file.size() - 3, 3) != ".bx") {
       std::cerr << "Bad file name: " << bx_file << std::endl;
       std::exit(1);
     }
+  if (!bx_files.empty() && exe_file.empty())
+    exe_file = bx_files[0].substr(0, bx_files[0].size() - 3) + ".exe";
+
+  if (bx_files.size() > 1) {
+    // the counters, stack maps and runs are of whole programs
+    if (run || interp_rtl || profile || !profile_use.empty() || gc) {
+      std::cerr << "--run, --interp-rtl, --profile, --profile-use and --gc "
+                   "need a single file\n";
+      std::exit(1);
+    }
+    timing::Report report{time_report};
+    report.phase("compile");
+    std::vector<std::string> obj_files;
+    try {
+      obj_files = driver::compile_modules(bx_files, module_flags, jobs,
+                                          emit_asm, lto, std::cout);
+    } catch (std::runtime_error const &e) {
+      std::cerr << e.what() << '\n';
+      std::exit(1);
+    }
+    if (lto && !compile_only) {
+      report.phase("lto");
+      lto::Module whole;
+      try {
+        std::vector<lto::Module> modules;
+        for (auto const &f : bx_files)
+          modules.push_back(lto::read_module(f.substr(0, f.size() - 3) +
+                                             lto::module_suffix));
+        whole = lto::merge(std::move(modules));
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+      sched::Scheduler sched{jobs};
+      std::cout << "lto: " << lto::optimize(whole, sched) << '\n';
+      passes::Stats pass_log;
+      if (!opt_passes.empty())
+        passes::run_rtl(whole.prog, opt_passes, sched, verify_passes,
+                        pass_log);
+      auto asm_prog = rtl_to_asm(whole.prog, sched);
+      passes::run_asm(asm_prog, opt_passes, pass_log);
+      if (pass_stats)
+        std::cerr << "passes:\n" << pass_log;
+      asm_prog.insert(asm_prog.begin(), globals_to_asm(whole.globals));
+      report.phase("emit");
+      auto exe_root = exe_file.substr(0, exe_file.rfind(".exe"));
+      try {
+        obj_files = {write_code(asm_prog, exe_root + ".lto", emit_asm)};
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+      std::cout << obj_files[0] << " written.\n";
+    }
+    if (!compile_only) {
+      report.phase("link");
+      link(obj_files, exe_file, rt_flags, std::cout);
+    }
+    return 0;
+  }
+
+  sched::Scheduler sched{jobs};
+
+  if (!bx_files.empty()) {
+    auto const &bx_file = bx_files[0];
+    timing::Report report{time_report};
+    // when running the program or printing a dump, its output must not be
+    // mixed with ours
+    std::ostream no_log{nullptr};
+    std::ostream &log =
+        run || interp_rtl || dumps.to_stdout() ? no_log : std::cout;
 
     auto file_root = bx_file.substr(0, bx_file.size() - 3);
+    auto write_dump = [&](dump::Kind kind, auto const &print) {
+      auto path = dumps.path(kind, file_root);
+      try {
+        dump::Output out{path};
+        print(out);
+        out.close();
+        if (!out)
+          throw std::runtime_error("cannot write " + path);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+      log << path << " written.\n";
+    };
 
-    auto prog = source::read_program(bx_file);
-    check::type_check(prog);
-    std::cout << bx_file << " parsed and type checked.\n";
-    auto p_file = file_root + ".parsed";
-    std::ofstream p_out;
-    p_out.open(p_file);
-    p_out << prog;
-    p_out.close();
-    std::cout << p_file << " written.\n";
-    auto rtl_file = file_root + ".rtl";
+    report.phase("parse");
+    auto prog = [&] {
+      try {
+        return source::read_program(bx_file);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+    }();
+    if (parse_check) {
+#ifdef BX_ANTLR
+      std::ostringstream ours, antlr;
+      ours << prog;
+      antlr << source::read_program_antlr(bx_file);
+      if (ours.str() != antlr.str()) {
+        std::cerr << bx_file << ": the parsers disagree\n";
+        std::exit(1);
+      }
+      log << bx_file << ": the parsers agree.\n";
+#else
+      std::cerr << "--parse-check needs a build with ANTLR (cmake -DBX_ANTLR=ON)\n";
+      std::exit(1);
+#endif
+    }
+    report.phase("type-check");
+    try {
+      check::type_check(prog, !compile_only);
+    } catch (std::runtime_error const &e) {
+      std::cerr << e.what() << '\n';
+      std::exit(1);
+    }
+    log << bx_file << " parsed and type checked.\n";
+    if (dumps.wants(dump::Kind::PARSED)) {
+      report.phase("write-parsed");
+      write_dump(dump::Kind::PARSED, [&](std::ostream &out) { out << prog; });
+    }
     auto gvars = rtl::getGlobals(prog);
-    rtl::Program rtl_prog = rtl::transform(prog);
-    std::ofstream rtl_out;
-    rtl_out.open(rtl_file);
-    for (auto const &gv : prog.global_vars)
-      rtl_out << "GLOBAL " << gv.first << " = " << *(gv.second->init) << " : "
-              << gv.second->ty << "\n\n";
-    for (auto const &glb : gvars){
-      rtl_out << glb.first << " = " << glb.second << std::endl;
-    }
-    for (auto const &rtl_cbl : rtl_prog)
-      rtl_out << rtl_cbl << '\n';
-    rtl_out.close();
-    std::cout << rtl_file << " written.\n";
-    auto s_file = file_root + ".s";
-
-    auto asm_prog = rtl_to_asm(rtl_prog);
-    std::ofstream s_out;
-    s_out.open(s_file);
-    
-    for (auto const &glb : gvars){
-      s_out << "\t.globl "<< glb.first << std::endl;
-      s_out << "\t.section .data\n";
-      s_out << "\t.align 8\n";
-      s_out << glb.first << ":\n";
-      s_out << "\t.quad " << glb.second << "\n";
-    }
-    for (auto const &fun : asm_prog){
-      for (auto const &l : fun){
-        s_out << *l;
+    auto write_rtl_globals = [&](std::ostream &rtl_out) {
+      for (auto const &gv : prog.global_vars)
+        rtl_out << "GLOBAL " << gv.first << " = " << *(gv.second->init)
+                << " : " << *gv.second->ty << "\n\n";
+      for (auto const &glb : gvars)
+        rtl_out << glb.first << " = " << glb.second << '\n';
+    };
+    if (!cache_dir.empty()) {
+      report.phase("compile");
+      cache::Cache cache{cache_dir, {checks, opt_passes, verify_passes}};
+      checks::Stats check_stats;
+      passes::Stats pass_log;
+      cache::Stats cache_stats;
+      auto entries = cache::compile(cache, prog, sched, pass_log, check_stats,
+                                    cache_stats);
+      if (checks.bounds || checks.null)
+        log << "checked: " << check_stats << '\n';
+      if (pass_stats)
+        std::cerr << "passes:\n" << pass_log;
+      log << "cache: " << cache_stats << '\n';
+      if (dumps.wants(dump::Kind::RTL)) {
+        report.phase("write-rtl");
+        write_dump(dump::Kind::RTL, [&](std::ostream &rtl_out) {
+          write_rtl_globals(rtl_out);
+          for (auto const &e : entries) {
+            std::istringstream rtl_in{e.rtl};
+            std::map<std::string, int> no_globals;
+            for (auto const &cbl : rtl::read_program(rtl_in, no_globals))
+              rtl_out << cbl << '\n';
+          }
+        });
+      }
+      report.phase("emit");
+      std::vector<AsmProgram> globals;
+      globals.push_back(globals_to_asm(gvars));
+      std::vector<amd64::Object> parts;
+      amd64::Object obj;
+      try {
+        parts.push_back(amd64::assemble(globals));
+        for (auto &e : entries)
+          parts.push_back(std::move(e.object));
+        obj = amd64::link(parts);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+      if (run) {
+        report.phase("run");
+        try {
+          return jit::run(obj);
+        } catch (std::runtime_error const &e) {
+          std::cerr << e.what() << '\n';
+          std::exit(1);
+        }
+      }
+      auto obj_file = file_root + ".o";
+      try {
+        write_object_file(obj, obj_file);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
       }
+      log << obj_file << " written.\n";
+      if (!compile_only) {
+        report.phase("link");
+        link({obj_file}, exe_file, rt_flags, log);
+      }
+      return 0;
+    }
+    report.phase("rtl");
+    checks::Stats check_stats;
+    rtl::Program rtl_prog = rtl::transform(prog, sched, checks, &check_stats);
+    if (checks.bounds || checks.null)
+      log << "checked: " << check_stats << '\n';
+    passes::Stats pass_log;
+    if (!opt_passes.empty()) {
+      report.phase("optimize");
+      passes::run_rtl(rtl_prog, opt_passes, sched, verify_passes, pass_log);
+    }
+    if (lto) {
+      report.phase("write-bxl");
+      auto lto_file = file_root + lto::module_suffix;
+      try {
+        lto::write_module(lto_file, rtl_prog, gvars);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+      log << lto_file << " written.\n";
+    }
+    profile::Map prof_map;
+    if (profile) {
+      report.phase("profile");
+      prof_map = profile::instrument(rtl_prog);
+      auto map_file = file_root + profile::map_suffix;
+      std::ofstream map_out{map_file};
+      profile::write_map(map_out, prof_map);
+      log << map_file << " written.\n";
+    }
+    if (!profile_use.empty()) {
+      // a missing or stale profile only costs the optimizations
+      report.phase("profile-use");
+      try {
+        auto map_file = file_root + profile::map_suffix;
+        std::ifstream map_in{map_file};
+        if (!map_in)
+          throw std::runtime_error("cannot open " + map_file);
+        auto map = profile::read_map(map_in);
+        std::ifstream prof_in{profile_use, std::ios::binary};
+        if (!prof_in)
+          throw std::runtime_error("cannot open " + profile_use);
+        auto weights =
+            profile::weigh(rtl_prog, map, profile::read_counts(prof_in, map));
+        log << "profile-use: " << pgo::optimize(rtl_prog, weights, sched) << '\n';
+      } catch (std::runtime_error const &e) {
+        std::cerr << "warning: not using the profile: " << e.what() << '\n';
+      }
+    }
+    if (dumps.wants(dump::Kind::RTL)) {
+      report.phase("write-rtl");
+      write_dump(dump::Kind::RTL, [&](std::ostream &rtl_out) {
+        write_rtl_globals(rtl_out);
+        for (auto const &rtl_cbl : rtl_prog)
+          rtl_out << rtl_cbl << '\n';
+      });
+    }
+    if (interp_rtl) {
+      if (pass_stats)
+        std::cerr << "passes:\n" << pass_log;
+      report.phase("interpret");
+      return interpret(rtl_prog, gvars);
+    }
+    report.phase("asm");
+    // the interpreter does not collect its heap
+    if (gc)
+      gc::register_stackmaps(rtl_prog);
+    auto asm_prog = rtl_to_asm(rtl_prog, sched);
+    passes::run_asm(asm_prog, opt_passes, pass_log);
+    if (pass_stats)
+      std::cerr << "passes:\n" << pass_log;
+    asm_prog.insert(asm_prog.begin(), globals_to_asm(gvars));
+    if (profile)
+      asm_prog.push_back(
+          counters_to_asm(profile::counters_symbol, prof_map.sites.size()));
+    if (gc)
+      asm_prog.push_back(stackmaps_to_asm(rtl_prog, gc::global_roots(prog)));
+    // with -S, the .s file is written anyway
+    auto asm_dump = dumps.wants(dump::Kind::ASM)
+                        ? dumps.path(dump::Kind::ASM, file_root)
+                        : "";
+    if (!asm_dump.empty() && !(emit_asm && asm_dump == file_root + ".s")) {
+      report.phase("write-asm");
+      write_dump(dump::Kind::ASM, [&](std::ostream &out) {
+        write_asm(out, asm_prog);
+      });
+    }
+    report.phase("emit");
+    if (run) {
+      try {
+        auto obj = amd64::assemble(asm_prog);
+        report.phase("run");
+        return jit::run(obj);
+      } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+        std::exit(1);
+      }
+    }
+    std::string obj_file;
+    try {
+      obj_file = write_code(asm_prog, file_root, emit_asm);
+    } catch (std::runtime_error const &e) {
+      std::cerr << e.what() << '\n';
+      std::exit(1);
+    }
+    log << obj_file << " written.\n";
+    if (!compile_only) {
+      report.phase("link");
+      link({obj_file}, exe_file, rt_flags, log);
     }
-    s_out.close();
-    std::cout << s_file << " written.\n";
-
-    auto exe_file = file_root + ".exe";
-    std::string cmd = "gcc -O2 -o " + exe_file + " " + s_file + " " + rt_flags;
-    // std::cout << "Running: " << cmd << std::endl;
-    if (std::system(cmd.c_str()) != 0) {
-      std::cerr << "Could not run gcc successfully!\n";
-      std::exit(2);
-    }
-    std::cout << exe_file << " created.\n";
   }
   return 0;
 }
@@ -0,0 +1,578 @@
+#include "parser.h"
+
+#include <charconv>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bx {
+
+namespace source {
+
+namespace {
+
+enum class Tok : int8_t { Id, Num, Bool, Punct, Keyword, End };
+
+/** A token refers to its text in the source, which outlives the parse */
+struct Token {
+  Tok kind;
+  std::string_view text;
+  int line, col;
+};
+
+bool is_id_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+bool is_keyword(std::string_view s) {
+  static char const *const keywords[] = {
+      "var",    "fun",   "proc", "print", "if",   "else", "while",
+      "return", "alloc", "null", "int64", "bool", "type", "struct",
+      "extern"};
+  for (auto kw : keywords)
+    if (s == kw)
+      return true;
+  return false;
+}
+
+/**
+ * Splits the source text into tokens, following the lexical rules of BX.g4:
+ * the longest match wins, so "-12" is a single NUM token
+ */
+class Lexer {
+  std::string_view src;
+  std::string const &file;
+  std::size_t pos = 0;
+  int line = 1, col = 1;
+
+  void advance(std::size_t n) {
+    for (std::size_t i = 0; i < n; i++, pos++) {
+      if (src[pos] == '\n') {
+        line++;
+        col = 1;
+      } else {
+        col++;
+      }
+    }
+  }
+
+  void skip_blanks() {
+    while (pos < src.size()) {
+      char c = src[pos];
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        advance(1);
+      } else if (c == '/' && pos + 1 < src.size() && src[pos + 1] == '/') {
+        while (pos < src.size() && src[pos] != '\n')
+          advance(1);
+      } else {
+        return;
+      }
+    }
+  }
+
+public:
+  Lexer(std::string_view src, std::string const &file)
+      : src{src}, file{file} {}
+
+  std::vector<Token> run() {
+    static char const *const puncts2[] = {"<<", ">>", "<=", ">=",
+                                          "==", "!=", "&&", "||"};
+    constexpr std::string_view puncts1 = "(){}[],;:=*&~-!/%+<>^|";
+    std::vector<Token> toks;
+    // a token every 4 bytes is typical of BX
+    toks.reserve(src.size() / 4 + 1);
+    for (skip_blanks(); pos < src.size(); skip_blanks()) {
+      int tl = line, tc = col;
+      char c = src[pos];
+      std::size_t len = 0;
+      Tok kind;
+      if (is_id_start(c)) {
+        while (pos + len < src.size() &&
+               (is_id_start(src[pos + len]) || is_digit(src[pos + len])))
+          len++;
+        auto word = src.substr(pos, len);
+        kind = word == "true" || word == "false"
+                   ? Tok::Bool
+                   : is_keyword(word) ? Tok::Keyword : Tok::Id;
+      } else if (is_digit(c) ||
+                 (c == '-' && pos + 1 < src.size() && is_digit(src[pos + 1]))) {
+        len = 1;
+        while (pos + len < src.size() && is_digit(src[pos + len]))
+          len++;
+        kind = Tok::Num;
+      } else {
+        kind = Tok::Punct;
+        for (auto p : puncts2)
+          if (src.compare(pos, 2, p) == 0)
+            len = 2;
+        if (len == 0) {
+          if (puncts1.find(c) == std::string_view::npos)
+            throw std::runtime_error(file + ":" + std::to_string(tl) + ":" +
+                                     std::to_string(tc) +
+                                     ": unexpected character '" + c + "'");
+          len = 1;
+        }
+      }
+      toks.push_back(Token{kind, src.substr(pos, len), tl, tc});
+      advance(len);
+    }
+    toks.push_back(Token{Tok::End, "<EOF>", line, col});
+    return toks;
+  }
+};
+
+/**
+ * Binding levels of the expression alternatives of BX.g4. ANTLR gives the
+ * earlier alternatives the higher precedence, and parses the operand of a
+ * prefix operator at the level of that operator, so &x[i] is (&x)[i].
+ */
+namespace level {
+// clang-format off
+constexpr int ADDRESS = 18, DEREF = 16, LISTELEM = 15, UNOP = 12,
+              MUL = 11, ADD = 10, SHIFT = 9, INEQ = 8, EQ = 7,
+              BITAND = 6, BITXOR = 5, BITOR = 4, LOGAND = 3, LOGOR = 2,
+              LOWEST = 0, NONE = -1;
+// clang-format on
+} // namespace level
+
+/** The level of the binary operator text, with the operator in op */
+int binop_level(std::string_view text, Binop &op) {
+  static const struct {
+    char const *text;
+    Binop op;
+    int level;
+  } binops[] = {
+      // clang-format off
+      {"*",  Binop::Multiply, level::MUL},
+      {"/",  Binop::Divide,   level::MUL},
+      {"%",  Binop::Modulus,  level::MUL},
+      {"+",  Binop::Add,      level::ADD},
+      {"-",  Binop::Subtract, level::ADD},
+      {"<<", Binop::Lshift,   level::SHIFT},
+      {">>", Binop::Rshift,   level::SHIFT},
+      {"<",  Binop::Lt,       level::INEQ},
+      {"<=", Binop::Leq,      level::INEQ},
+      {">",  Binop::Gt,       level::INEQ},
+      {">=", Binop::Geq,      level::INEQ},
+      {"==", Binop::Eq,       level::EQ},
+      {"!=", Binop::Neq,      level::EQ},
+      {"&",  Binop::BitAnd,   level::BITAND},
+      {"^",  Binop::BitXor,   level::BITXOR},
+      {"|",  Binop::BitOr,    level::BITOR},
+      {"&&", Binop::BoolAnd,  level::LOGAND},
+      {"||", Binop::BoolOr,   level::LOGOR},
+      // clang-format on
+  };
+  for (auto const &b : binops)
+    if (text == b.text) {
+      op = b.op;
+      return b.level;
+    }
+  return level::NONE;
+}
+
+class Parser {
+  std::vector<Token> toks;
+  std::string const &file;
+  std::size_t pos = 0;
+
+  Token const &peek(std::size_t ahead = 0) const {
+    return toks[std::min(pos + ahead, toks.size() - 1)];
+  }
+
+  bool at(char const *text, std::size_t ahead = 0) const {
+    auto const &t = peek(ahead);
+    return (t.kind == Tok::Punct || t.kind == Tok::Keyword) && t.text == text;
+  }
+
+  [[noreturn]] void error(std::string const &msg) const {
+    auto const &t = peek();
+    throw std::runtime_error(file + ":" + std::to_string(t.line) + ":" +
+                             std::to_string(t.col) + ": " + msg + " at \"" +
+                             std::string{t.text} + "\"");
+  }
+
+  Token const &next() {
+    auto const &t = peek();
+    if (pos < toks.size() - 1)
+      pos++;
+    return t;
+  }
+
+  void expect(char const *text) {
+    if (!at(text))
+      error(std::string{"expected \""} + text + "\"");
+    next();
+  }
+
+  bool accept(char const *text) {
+    if (!at(text))
+      return false;
+    next();
+    return true;
+  }
+
+  Token const &expect_kind(Tok kind, char const *what) {
+    if (peek().kind != kind)
+      error(std::string{"expected "} + what);
+    return next();
+  }
+
+public:
+  Parser(std::vector<Token> &&toks, std::string const &file)
+      : toks{std::move(toks)}, file{file} {}
+
+  Program read_program() {
+    Program::CallTable callables, extern_callables;
+    Program::GlobalVarTable global_vars, extern_vars;
+    auto check_unique_name = [&](auto const &name) {
+      if (global_vars.find(name) != global_vars.end() ||
+          extern_vars.find(name) != extern_vars.end())
+        throw std::runtime_error("Redeclaration of existing global var " +
+                                 name);
+      if (callables.find(name) != callables.end() ||
+          extern_callables.find(name) != extern_callables.end())
+        throw std::runtime_error("Redeclaration of existing callable " + name +
+                                 "()");
+    };
+    while (peek().kind != Tok::End) {
+      if (accept("extern")) {
+        if (accept("var")) {
+          std::vector<std::string> names;
+          do {
+            names.emplace_back(expect_kind(Tok::Id, "an identifier").text);
+          } while (accept(","));
+          expect(":");
+          Type *ty = read_type();
+          expect(";");
+          for (auto const &name : names) {
+            check_unique_name(name);
+            extern_vars.insert_or_assign(
+                name, GlobalVar::make(name, ty, ExprPtr{nullptr}));
+          }
+        } else if (at("proc") || at("fun")) {
+          auto c = read_callable(true);
+          check_unique_name(c->name);
+          extern_callables.insert_or_assign(c->name, std::move(c));
+        } else {
+          error("expected var, fun or proc");
+        }
+      } else if (at("var")) {
+        for (auto &v : read_globalvar()) {
+          check_unique_name(v->name);
+          global_vars.insert_or_assign(v->name, std::move(v));
+        }
+      } else if (at("proc") || at("fun")) {
+        auto c = read_callable();
+        check_unique_name(c->name);
+        callables.insert_or_assign(c->name, std::move(c));
+      } else {
+        error("unknown top level declaration");
+      }
+    }
+    return Program{std::move(global_vars), std::move(callables),
+                   std::move(extern_vars), std::move(extern_callables)};
+  }
+
+private:
+  std::vector<GlobalVarPtr> read_globalvar() {
+    expect("var");
+    std::vector<std::pair<std::string, Token>> inits;
+    do {
+      std::string name{expect_kind(Tok::Id, "an identifier").text};
+      expect("=");
+      if (peek().kind != Tok::Num && peek().kind != Tok::Bool)
+        error("expected a number or a boolean");
+      inits.emplace_back(name, next());
+    } while (accept(","));
+    expect(":");
+    Type *ty = read_type();
+    bool is_bool = dynamic_cast<BOOL *>(ty);
+    expect(";");
+    std::vector<GlobalVarPtr> vars;
+    for (auto const &vi : inits) {
+      if (vi.second.kind != (is_bool ? Tok::Bool : Tok::Num))
+        throw std::runtime_error(file + ":" + std::to_string(vi.second.line) +
+                                 ": initial value of the wrong type for " +
+                                 vi.first);
+      ExprPtr init = is_bool ? read_bool(vi.second) : read_num(vi.second);
+      vars.push_back(GlobalVar::make(vi.first, ty, std::move(init)));
+    }
+    return vars;
+  }
+
+  /** An extern callable ends with ";" instead of a body */
+  CallablePtr read_callable(bool is_extern = false) {
+    bool is_proc = next().text == "proc";
+    std::string name{expect_kind(Tok::Id, "an identifier").text};
+    Callable::Params params;
+    expect("(");
+    if (!at(")")) {
+      do {
+        std::vector<std::string> names;
+        do {
+          names.emplace_back(expect_kind(Tok::Id, "an identifier").text);
+        } while (accept(","));
+        expect(":");
+        Type *ty = read_type();
+        for (auto const &nm : names)
+          params.push_back(std::make_pair(nm, ty));
+      } while (accept(","));
+    }
+    expect(")");
+    Type *return_ty = nullptr;
+    if (!is_proc) {
+      expect(":");
+      return_ty = read_type();
+    }
+    BlockPtr body{nullptr};
+    if (is_extern)
+      expect(";");
+    else
+      body = read_block();
+    return Callable::make(name, std::move(params), std::move(body),
+                          is_proc ? new UNKNOWN() : return_ty);
+  }
+
+  /**
+   * @param greedy_list when false, a "[NUM]" suffix is only read as part of
+   * the type if another "[" follows, as in alloc int64[4][n]
+   */
+  Type *read_type(bool greedy_list = true) {
+    Type *ty;
+    if (accept("int64"))
+      ty = new INT64();
+    else if (accept("bool"))
+      ty = new BOOL();
+    else if (at("struct"))
+      error("struct types are not supported");
+    else
+      error("expected a type");
+    while (true) {
+      if (accept("*")) {
+        ty = new POINTER(ty);
+      } else if (at("[") && peek(1).kind == Tok::Num && at("]", 2) &&
+                 (greedy_list || at("[", 3))) {
+        next();
+        ty = new LIST(ty, static_cast<int>(read_int(next())));
+        next();
+      } else {
+        return ty;
+      }
+    }
+  }
+
+  BlockPtr read_block() {
+    expect("{");
+    std::vector<StmtPtr> body;
+    while (!accept("}")) {
+      if (peek().kind == Tok::End)
+        error("unterminated block");
+      read_stmt(body);
+    }
+    return Block::make(body);
+  }
+
+  /** Append the statement at the current token to stmts */
+  void read_stmt(std::vector<StmtPtr> &stmts) {
+    if (accept("var")) {
+      std::vector<std::pair<std::string, ExprPtr>> inits;
+      do {
+        std::string name{expect_kind(Tok::Id, "an identifier").text};
+        expect("=");
+        inits.emplace_back(name, read_expr());
+      } while (accept(","));
+      expect(":");
+      Type *ty = read_type();
+      expect(";");
+      for (auto &vi : inits)
+        stmts.push_back(Declare::make(vi.first, ty, std::move(vi.second)));
+    } else if (accept("print")) {
+      auto arg = read_expr();
+      expect(";");
+      stmts.push_back(Print::make(std::move(arg)));
+    } else if (at("{")) {
+      stmts.push_back(read_block());
+    } else if (at("if")) {
+      stmts.push_back(read_ifelse());
+    } else if (accept("while")) {
+      expect("(");
+      auto condition = read_expr();
+      expect(")");
+      stmts.push_back(While::make(std::move(condition), read_block()));
+    } else if (accept("return")) {
+      ExprPtr arg{nullptr};
+      if (!at(";"))
+        arg = read_expr();
+      expect(";");
+      stmts.push_back(Return::make(std::move(arg)));
+    } else {
+      auto left = read_expr();
+      if (accept("=")) {
+        auto right = read_expr();
+        expect(";");
+        stmts.push_back(Assign::make(std::move(left), std::move(right)));
+      } else {
+        expect(";");
+        stmts.push_back(Eval::make(std::move(left)));
+      }
+    }
+  }
+
+  IfElsePtr read_ifelse() {
+    expect("if");
+    expect("(");
+    auto condition = read_expr();
+    expect(")");
+    auto then_block = read_block();
+    StmtPtr else_block = Block::make();
+    if (accept("else")) {
+      if (at("if"))
+        else_block = read_ifelse();
+      else
+        else_block = read_block();
+    }
+    return IfElse::make(std::move(condition), std::move(then_block),
+                        std::move(else_block));
+  }
+
+  /** An expression of the operators of level min_level or above */
+  ExprPtr read_expr(int min_level = level::LOWEST) {
+    ExprPtr left = read_prefix();
+    while (true) {
+      Binop op = Binop::Add; // only read when lvl is not NONE
+      int lvl = peek().kind == Tok::Punct ? binop_level(peek().text, op)
+                                          : level::NONE;
+      if (at("[") && level::LISTELEM >= min_level) {
+        next();
+        auto idx = read_expr();
+        expect("]");
+        left = ListElem::make(std::move(left), std::move(idx));
+      } else if (lvl != level::NONE && lvl >= min_level) {
+        next();
+        // left associative: the right operand binds tighter
+        left = BinopApp::make(std::move(left), op, read_expr(lvl + 1));
+      } else {
+        return left;
+      }
+    }
+  }
+
+  ExprPtr read_prefix() {
+    switch (peek().kind) {
+    case Tok::Num:
+      return read_num(next());
+    case Tok::Bool:
+      return read_bool(next());
+    case Tok::Id: {
+      std::string name{next().text};
+      if (!accept("("))
+        return Variable::make(name);
+      std::vector<ExprPtr> args;
+      if (!at(")")) {
+        do {
+          args.push_back(read_expr());
+        } while (accept(","));
+      }
+      expect(")");
+      return Call::make(name, args);
+    }
+    default:
+      break;
+    }
+    if (accept("alloc")) {
+      Type *ty = read_type(false);
+      expect("[");
+      auto size = read_expr();
+      expect("]");
+      return Alloc::make(std::move(size), ty);
+    }
+    if (accept("null"))
+      return Null::make();
+    if (accept("&"))
+      return Address::make(read_expr(level::ADDRESS));
+    if (accept("*"))
+      return Deref::make(read_expr(level::DEREF));
+    if (at("~") || at("-") || at("!")) {
+      auto op_txt = next().text;
+      auto op = op_txt[0] == '~'
+                    ? Unop::BitNot
+                    : op_txt[0] == '-' ? Unop::Negate : Unop::LogNot;
+      return UnopApp::make(op, read_expr(level::UNOP));
+    }
+    if (accept("(")) {
+      auto e = read_expr();
+      expect(")");
+      return e;
+    }
+    error("expected an expression");
+  }
+
+  int64_t read_int(Token const &t) {
+    int64_t value = 0;
+    auto end = t.text.data() + t.text.size();
+    if (std::from_chars(t.text.data(), end, value).ec != std::errc{})
+      throw std::runtime_error(file + ":" + std::to_string(t.line) + ":" +
+                               std::to_string(t.col) + ": " +
+                               std::string{t.text} +
+                               " does not fit in 64 bits");
+    return value;
+  }
+
+  ExprPtr read_num(Token const &t) { return IntConstant::make(read_int(t)); }
+
+  ExprPtr read_bool(Token const &t) {
+    return BoolConstant::make(t.text == "true");
+  }
+};
+
+} // namespace
+
+Program parse(std::string_view src, std::string const &file) {
+  return Parser{Lexer{src, file}.run(), file}.read_program();
+}
+
+MappedFile::MappedFile(std::string const &file) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("cannot open " + file);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size = static_cast<std::size_t>(st.st_size);
+    void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem != MAP_FAILED) {
+      madvise(mem, size, MADV_SEQUENTIAL);
+      base = static_cast<char const *>(mem);
+      close(fd);
+      return;
+    }
+  }
+  // not a regular file, such as a pipe, or one that cannot be mapped
+  size = 0;
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof buf)) > 0)
+    fallback.append(buf, static_cast<std::size_t>(n));
+  close(fd);
+  if (n < 0)
+    throw std::runtime_error("cannot read " + file);
+}
+
+MappedFile::~MappedFile() {
+  if (base)
+    munmap(const_cast<char *>(base), size);
+}
+
+Program read_program(std::string file) {
+  MappedFile source{file};
+  return parse(source.text(), file);
+}
+
+} // namespace source
+
+} // namespace bx
@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+ * A hand-written lexer and precedence-climbing parser for the grammar in
+ * BX.g4, which builds the source:: AST directly. It accepts the same
+ * programs as the parser that ANTLR generates from BX.g4 and gives them the
+ * same AST; built with that parser (cmake -DBX_ANTLR=ON), bx --parse-check
+ * parses with both and compares their results.
+ */
+
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+
+namespace bx {
+namespace source {
+
+/**
+ * The contents of a file, mapped in memory when the file is a regular one
+ * and read into a string otherwise. The tokens of the parser refer to their
+ * text in it, so it is only copied for the names in the AST.
+ */
+class MappedFile {
+  char const *base = nullptr;
+  std::size_t size = 0;
+  std::string fallback;
+
+public:
+  explicit MappedFile(std::string const &file);
+  ~MappedFile();
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  std::string_view text() const {
+    return base ? std::string_view{base, size} : std::string_view{fallback};
+  }
+};
+
+/**
+ * Parse the text src of a program; file is only used in the error messages.
+ * Throws std::runtime_error on the first syntax error.
+ */
+Program parse(std::string_view src, std::string const &file);
+
+} // namespace source
+} // namespace bx
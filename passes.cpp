@@ -0,0 +1,395 @@
+#include "passes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
+
+namespace bx {
+namespace passes {
+
+namespace {
+
+using namespace rtl;
+
+/** The pseudos an instruction reads and writes */
+struct DefUse : public InstrVisitor {
+  std::vector<Pseudo> defs, uses;
+  /** a pure definition: no effect but writing its only def */
+  bool pure = false;
+
+  void use(Pseudo r) {
+    if (r != discard_pr)
+      uses.push_back(r);
+  }
+  // clang-format off
+  void visit(Move const &i) override      { defs = {i.dest}; pure = true; }
+  void visit(Copy const &i) override      { use(i.src); defs = {i.dest}; pure = true; }
+  void visit(CopyMP const &i) override    { defs = {i.dest}; pure = true; }
+  void visit(CopyPM const &i) override    { use(i.src); }
+  void visit(CopyAP const &i) override    { use(i.pbase); defs = {i.dst}; pure = true; }
+  void visit(Load const &i) override      { use(i.pbase); defs = {i.dest}; }
+  void visit(Store const &i) override     { use(i.pbase); use(i.src); }
+  void visit(Binop const &i) override     { use(i.src); use(i.dest); defs = {i.dest}; }
+  void visit(Unop const &i) override      { use(i.arg); defs = {i.arg}; }
+  void visit(Bbranch const &i) override   { use(i.arg1); use(i.arg2); }
+  void visit(Ubranch const &i) override   { use(i.arg); }
+  void visit(Call const &) override       {}
+  void visit(Return const &) override     {}
+  void visit(Goto const &) override       {}
+  void visit(NewFrame const &) override   {}
+  void visit(DelFrame const &) override   {}
+  void visit(LoadParam const &i) override { defs = {i.dest}; }
+  void visit(Push const &i) override      { use(i.dest); }
+  void visit(Pop const &i) override       { defs = {i.dest}; }
+  void visit(Count const &) override      {}
+  // clang-format on
+};
+
+DefUse def_use(Instr &instr) {
+  DefUse du;
+  instr.accept(du);
+  return du;
+}
+
+Label entry(Callable const &cbl) { return cbl.schedule.front(); }
+
+bool removable(Callable const &cbl, Label l) {
+  return !(l == entry(cbl) || l == cbl.enter || l == cbl.leave);
+}
+
+/**
+ * Make the jumps to the labels of skip (each mapped to where the control
+ * goes instead) go there directly, then remove the instructions of skip.
+ * Returns whether anything changed.
+ */
+bool bypass(Callable &cbl, LabelMap<Label> const &skip) {
+  if (skip.empty())
+    return false;
+  auto resolve = [&](Label l) {
+    std::set<Label> seen; // a loop of skipped labels stays as it is
+    for (auto it = skip.find(l); it != skip.end() && seen.insert(l).second;
+         it = skip.find(l))
+      l = it->second;
+    return l;
+  };
+  std::vector<Label> schedule;
+  for (auto const &l : cbl.schedule) {
+    if (skip.count(l) && !(resolve(l) == l)) {
+      cbl.body.erase(l);
+      continue;
+    }
+    auto instr = cbl.body.at(l);
+    cbl.body[l] = rename(*instr, resolve, [](Pseudo r) { return r; });
+    schedule.push_back(l);
+  }
+  cbl.schedule = std::move(schedule);
+  return true;
+}
+
+/** The number of uses of every pseudo, counting the output of cbl */
+std::unordered_map<int, int> use_counts(Callable const &cbl) {
+  std::unordered_map<int, int> uses;
+  for (auto const &l : cbl.schedule)
+    for (auto r : def_use(*cbl.body.at(l)).uses)
+      uses[r.id]++;
+  uses[cbl.output_reg.id]++;
+  return uses;
+}
+
+bool thread_jumps(Callable &cbl) {
+  LabelMap<Label> skip;
+  for (auto const &l : cbl.schedule)
+    if (auto go = dynamic_cast<Goto *>(cbl.body.at(l)))
+      if (removable(cbl, l) && !(go->succ == l))
+        skip.emplace(l, go->succ);
+  return bypass(cbl, skip);
+}
+
+bool unreachable(Callable &cbl) {
+  std::set<Label> seen;
+  std::vector<Label> work{entry(cbl)};
+  while (!work.empty()) {
+    auto l = work.back();
+    work.pop_back();
+    if (!seen.insert(l).second)
+      continue;
+    for (auto s : successors(*cbl.body.at(l)))
+      work.push_back(s);
+  }
+  std::vector<Label> schedule;
+  for (auto const &l : cbl.schedule)
+    if (seen.count(l) || !removable(cbl, l))
+      schedule.push_back(l);
+    else
+      cbl.body.erase(l);
+  bool changed = schedule.size() != cbl.schedule.size();
+  cbl.schedule = std::move(schedule);
+  return changed;
+}
+
+bool forward_copies(Callable &cbl) {
+  std::unordered_map<int, int> defs;
+  LabelMap<int> preds;
+  for (auto const &l : cbl.schedule) {
+    auto instr = cbl.body.at(l);
+    for (auto r : def_use(*instr).defs)
+      defs[r.id]++;
+    for (auto s : successors(*instr))
+      preds[s]++;
+  }
+  auto uses = use_counts(cbl);
+  std::set<int> inputs;
+  for (auto r : cbl.input_regs)
+    inputs.insert(r.id);
+  std::set<int> roots;
+  for (auto r : cbl.roots)
+    roots.insert(r.id);
+
+  LabelMap<Label> skip;
+  for (auto const &l : cbl.schedule) {
+    auto du = def_use(*cbl.body.at(l));
+    if (!du.pure || !removable(cbl, l))
+      continue;
+    auto t = du.defs[0];
+    auto next = successors(*cbl.body.at(l))[0];
+    auto copy = dynamic_cast<Copy *>(cbl.body.at(next));
+    if (!copy || !(copy->src == t) || copy->dest == t || skip.count(l) ||
+        !removable(cbl, next) || preds[next] != 1 || defs[t.id] != 1 ||
+        uses[t.id] != 1 || inputs.count(t.id))
+      continue;
+    auto v = copy->dest;
+    auto after = copy->succ;
+    cbl.body[l] = rename(
+        *cbl.body.at(l), [&](Label x) { return x == next ? after : x; },
+        [&](Pseudo r) { return r == t ? v : r; });
+    if (roots.count(t.id) && !roots.count(v.id)) {
+      cbl.roots.push_back(v);
+      roots.insert(v.id);
+    }
+    skip.emplace(next, after);
+    // the copy is gone: nothing can match it again
+    defs[t.id] = 0;
+  }
+  return bypass(cbl, skip);
+}
+
+bool dead_code(Callable &cbl) {
+  auto uses = use_counts(cbl);
+  LabelMap<Label> skip;
+  for (auto const &l : cbl.schedule) {
+    auto du = def_use(*cbl.body.at(l));
+    if (du.pure && !uses[du.defs[0].id] && removable(cbl, l))
+      skip.emplace(l, successors(*cbl.body.at(l))[0]);
+  }
+  return bypass(cbl, skip);
+}
+
+using RtlPass = std::function<bool(Callable &)>;
+
+std::vector<std::pair<std::string, RtlPass>> const &rtl_passes() {
+  static const std::vector<std::pair<std::string, RtlPass>> passes{
+      {"thread-jumps", thread_jumps},
+      {"unreachable", unreachable},
+      {"forward-copies", forward_copies},
+      {"dead-code", dead_code},
+  };
+  return passes;
+}
+
+bool same_location(amd64::Pseudo const &a, amd64::Pseudo const &b) {
+  if (!a.binding || !b.binding || a.binding->index() != b.binding->index())
+    return false;
+  // the same register can be spelled by different copies of its name
+  if (auto reg = std::get_if<amd64::Reg>(&*a.binding))
+    return std::strcmp(*reg, std::get<amd64::Reg>(*b.binding)) == 0;
+  return *a.binding == *b.binding;
+}
+
+bool is_move(amd64::Asm const &line) {
+  return line.repr_template == "\tmovq `s0, `d0" && line.use.size() == 1 &&
+         line.def.size() == 1;
+}
+
+void store_load(AsmProgram &fun) {
+  AsmProgram out;
+  for (auto &line : fun) {
+    if (is_move(*line)) {
+      if (same_location(line->use[0], line->def[0]))
+        continue;
+      if (!out.empty() && is_move(*out.back()) &&
+          same_location(out.back()->def[0], line->use[0]) &&
+          same_location(out.back()->use[0], line->def[0]))
+        continue;
+    }
+    out.push_back(std::move(line));
+  }
+  fun = std::move(out);
+}
+
+using AsmPass = std::function<void(AsmProgram &)>;
+
+std::vector<std::pair<std::string, AsmPass>> const &asm_passes() {
+  static const std::vector<std::pair<std::string, AsmPass>> passes{
+      {"store-load", store_load},
+  };
+  return passes;
+}
+
+template <typename Passes>
+auto find(Passes const &passes, std::string const &name) {
+  return std::find_if(passes.begin(), passes.end(),
+                      [&](auto const &p) { return p.first == name; });
+}
+
+long count(Program const &prog) {
+  long n = 0;
+  for (auto const &cbl : prog)
+    n += static_cast<long>(cbl.body.size());
+  return n;
+}
+
+long count(std::vector<AsmProgram> const &prog) {
+  long n = 0;
+  for (auto const &fun : prog)
+    for (auto const &line : fun)
+      if (line->repr_template.rfind("\t.", 0) != 0 &&
+          line->repr_template.back() != ':')
+        n++;
+  return n;
+}
+
+PassStats &stats_of(Stats &stats, std::string const &name) {
+  for (auto &p : stats.passes)
+    if (p.name == name)
+      return p;
+  stats.passes.push_back(PassStats{name});
+  return stats.passes.back();
+}
+
+template <typename F> double timed(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+} // namespace
+
+std::vector<std::string> pipeline(int level) {
+  std::vector<std::string> names;
+  if (level >= 1)
+    names = {"thread-jumps", "unreachable"};
+  if (level >= 2)
+    names.insert(names.end(), {"forward-copies", "dead-code", "thread-jumps",
+                               "store-load"});
+  if (level >= 3)
+    // forwarding a copy can leave another copy with a single use
+    names.insert(names.end(), {"forward-copies", "dead-code", "unreachable"});
+  return names;
+}
+
+std::vector<std::string> parse(std::string const &list) {
+  std::vector<std::string> names;
+  std::size_t start = 0;
+  while (start <= list.size()) {
+    auto end = std::min(list.find(',', start), list.size());
+    auto name = list.substr(start, end - start);
+    if (!name.empty()) {
+      if (find(rtl_passes(), name) == rtl_passes().end() &&
+          find(asm_passes(), name) == asm_passes().end())
+        throw std::runtime_error("unknown pass " + name);
+      names.push_back(name);
+    }
+    start = end + 1;
+  }
+  return names;
+}
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  auto flags = out.flags();
+  out << std::fixed << std::setprecision(6);
+  for (auto const &p : stats.passes)
+    out << "  " << std::left << std::setw(16) << p.name << std::right
+        << std::setw(3) << p.runs << "x " << std::setw(10) << p.seconds
+        << " s " << std::setw(8) << p.before << " -> " << std::setw(8)
+        << p.after << " instructions (" << std::showpos
+        << p.after - p.before << std::noshowpos << ")\n";
+  out.flags(flags);
+  return out;
+}
+
+void verify(Callable const &cbl) {
+  auto fail = [&](std::string const &what) {
+    throw std::runtime_error(cbl.name + ": " + what);
+  };
+  if (cbl.schedule.empty())
+    fail("empty schedule");
+  if (cbl.schedule.size() != cbl.body.size())
+    fail("the schedule and the body differ");
+  std::set<Label> scheduled;
+  for (auto const &l : cbl.schedule) {
+    if (!scheduled.insert(l).second)
+      fail("label " + std::to_string(l.id) + " scheduled twice");
+    auto it = cbl.body.find(l);
+    if (it == cbl.body.end())
+      fail("no instruction at label " + std::to_string(l.id));
+    for (auto s : successors(*it->second))
+      if (!cbl.body.count(s))
+        fail("jump to the missing label " + std::to_string(s.id));
+  }
+  if (!cbl.body.count(cbl.enter) || !cbl.body.count(cbl.leave))
+    fail("no enter or leave label");
+  if (!cbl.layout.empty() &&
+      std::set<Label>(cbl.layout.begin(), cbl.layout.end()) != scheduled)
+    fail("the layout is not a permutation of the schedule");
+}
+
+void run_rtl(Program &prog, std::vector<std::string> const &names,
+             sched::Scheduler &sched, bool check, Stats &stats) {
+  for (auto const &name : names) {
+    auto pass = find(rtl_passes(), name);
+    if (pass == rtl_passes().end())
+      continue;
+    auto &ps = stats_of(stats, name);
+    ps.runs++;
+    ps.before += count(prog);
+    ps.seconds += timed([&] {
+      sched::parallel_for(sched, static_cast<int>(prog.size()),
+                          [&](int i) { pass->second(prog[i]); });
+    });
+    ps.after += count(prog);
+    if (check)
+      for (auto const &cbl : prog) {
+        try {
+          verify(cbl);
+        } catch (std::runtime_error const &e) {
+          throw std::runtime_error("after pass " + name + ": " + e.what());
+        }
+      }
+  }
+}
+
+void run_asm(std::vector<AsmProgram> &prog,
+             std::vector<std::string> const &names, Stats &stats) {
+  for (auto const &name : names) {
+    auto pass = find(asm_passes(), name);
+    if (pass == asm_passes().end())
+      continue;
+    auto &ps = stats_of(stats, name);
+    ps.runs++;
+    ps.before += count(prog);
+    ps.seconds += timed([&] {
+      for (auto &fun : prog)
+        pass->second(fun);
+    });
+    ps.after += count(prog);
+  }
+}
+
+} // namespace passes
+} // namespace bx
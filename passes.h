@@ -0,0 +1,71 @@
+#pragma once
+
+/**
+ * The optimization pipeline: a sequence of passes over the RTL of the
+ * program, then over its assembly, chosen by an optimization level (bx -O0
+ * to -O3) or given explicitly (bx --passes=a,b,c).
+ *
+ * The RTL passes run on every callable in parallel, after rtl::transform()
+ * and before the profile instrumentation, so a profile must be recorded and
+ * used at the same level. They never remove the entry of a callable (the
+ * first label of its schedule) nor its enter and leave labels:
+ *
+ *   thread-jumps    retarget the jumps to a goto to where the goto goes
+ *   unreachable     remove the instructions that cannot be reached
+ *   forward-copies  compute a value straight into the pseudo it is copied
+ *                   to, when the copy is the only use of a temporary
+ *   dead-code       remove the moves and copies to pseudos never read
+ *
+ * The asm passes run on the output of rtl_to_asm():
+ *
+ *   store-load      remove the reload of a register from the slot it was
+ *                   just stored to, and the moves of a location to itself
+ *
+ * With verification, the RTL is checked after every pass: each label of the
+ * schedule has one instruction and the reverse, and every jump goes to a
+ * label that exists. A failure throws std::runtime_error naming the pass.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "rtl.h"
+#include "rtl_asm.h"
+#include "scheduler.h"
+
+namespace bx {
+namespace passes {
+
+/** The passes of optimization level 0 to 3 */
+std::vector<std::string> pipeline(int level);
+
+/** Split a comma-separated list of passes, checking their names */
+std::vector<std::string> parse(std::string const &list);
+
+/** What a pass did to the whole program, summed over its runs */
+struct PassStats {
+  std::string name;
+  int runs = 0;
+  double seconds = 0;
+  long before = 0, after = 0; // instructions
+};
+
+struct Stats {
+  std::vector<PassStats> passes;
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+/** Run the RTL passes among names, in order */
+void run_rtl(rtl::Program &prog, std::vector<std::string> const &names,
+             sched::Scheduler &sched, bool verify, Stats &stats);
+
+/** Run the asm passes among names, in order */
+void run_asm(std::vector<AsmProgram> &prog,
+             std::vector<std::string> const &names, Stats &stats);
+
+/** Check the structure of cbl; throws std::runtime_error */
+void verify(rtl::Callable const &cbl);
+
+} // namespace passes
+} // namespace bx
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <unordered_set>
+
+#include "amd64.h"
+#include "pgo.h"
+
+namespace bx {
+namespace pgo {
+
+namespace {
+
+constexpr std::size_t inline_max_size = 64; // instructions of the callee
+constexpr std::size_t inline_min_growth = 64;
+constexpr uint64_t inline_min_share = 100; // of the hottest call site
+constexpr std::size_t unroll_max_size = 32;
+constexpr std::size_t unroll_max_growth = 128;
+
+using Weights = rtl::LabelMap<uint64_t>;
+
+uint64_t weight(Weights const &w, rtl::Label l) {
+  auto it = w.find(l);
+  return it == w.end() ? 0 : it->second;
+}
+
+uint64_t scale(uint64_t w, uint64_t num, uint64_t den) {
+  return den == 0 ? 0
+                  : static_cast<uint64_t>(static_cast<long double>(w) * num /
+                                          den);
+}
+
+bool is_frame(char const *base) {
+  return base && std::strcmp(base, amd64::reg::rip) != 0;
+}
+
+/**
+ * Whether the code of cbl can move to another frame, or get code from
+ * another frame: it must not address its variables relative to the frame
+ * (they alias the slots of the pseudos), nor pass or receive arguments on
+ * the stack.
+ */
+bool movable(rtl::Callable const &cbl) {
+  for (auto const &l : cbl.schedule) {
+    auto instr = cbl.body.at(l);
+    if (auto ap = dynamic_cast<rtl::CopyAP *>(instr)) {
+      if (ap->pbase == rtl::discard_pr && is_frame(ap->base))
+        return false;
+    } else if (auto ld = dynamic_cast<rtl::Load *>(instr)) {
+      if (ld->pbase == rtl::discard_pr && is_frame(ld->mbase))
+        return false;
+    } else if (auto st = dynamic_cast<rtl::Store *>(instr)) {
+      if (st->pbase == rtl::discard_pr && is_frame(st->mbase))
+        return false;
+    } else if (dynamic_cast<rtl::LoadParam *>(instr) ||
+               dynamic_cast<rtl::Push *>(instr) ||
+               dynamic_cast<rtl::Pop *>(instr) ||
+               dynamic_cast<rtl::Count *>(instr))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Replace the call at l by a copy of the callee with fresh labels and
+ * pseudos, appended to the schedule. The copy keeps the callee's moves
+ * to and from the machine registers of the calling convention, and the
+ * deletion of its frame continues at the successor of the call.
+ */
+void inline_call(rtl::Callable &caller, Weights &cw, rtl::Label l,
+                 rtl::Callable const &callee, Weights const &ew) {
+  auto call = static_cast<rtl::Call *>(caller.body.at(l));
+  rtl::LabelMap<rtl::Label> labels;
+  std::unordered_map<int, rtl::Pseudo> regs;
+  auto label = [&](rtl::Label x) {
+    auto it = labels.find(x);
+    if (it == labels.end())
+      it = labels.insert({x, caller.fresh_label()}).first;
+    return it->second;
+  };
+  auto pseudo = [&](rtl::Pseudo r) {
+    auto it = regs.find(r.id);
+    if (it == regs.end())
+      it = regs.insert({r.id, caller.fresh_pseudo()}).first;
+    return it->second;
+  };
+  auto site = weight(cw, l), entry = weight(ew, callee.schedule.front());
+  for (auto const &el : callee.schedule) {
+    auto instr = callee.body.at(el);
+    if (dynamic_cast<rtl::NewFrame *>(instr) ||
+        dynamic_cast<rtl::Return *>(instr))
+      continue;
+    rtl::InstrPtr copy;
+    if (dynamic_cast<rtl::DelFrame *>(instr))
+      copy = rtl::Goto::make(call->succ);
+    else
+      copy = rtl::rename(*instr, label, pseudo);
+    caller.add_instr(label(el), copy);
+    cw[label(el)] = scale(weight(ew, el), site, entry);
+  }
+  caller.body.insert_or_assign(l,
+                               rtl::Goto::make(label(callee.schedule.front())));
+  for (auto const &r : callee.roots)
+    if (regs.count(r.id))
+      caller.roots.push_back(regs.at(r.id));
+}
+
+/**
+ * Inline the hot call sites of prog. The callables are visited bottom-up
+ * in the call graph, in parallel: a callee has had its own call sites
+ * inlined before it is inlined into its callers.
+ */
+int inline_calls(rtl::Program &prog, profile::Weights &weights,
+                 sched::Scheduler &sched) {
+  std::unordered_map<std::string, int> index;
+  std::unordered_map<std::string, rtl::Callable *> callables;
+  for (std::size_t i = 0; i < prog.size(); i++) {
+    auto &cbl = prog[i];
+    index[cbl.name] = static_cast<int>(i);
+    if (!cbl.schedule.empty() && movable(cbl))
+      callables[cbl.name] = &cbl;
+    weights[cbl.name]; // not inserted while the callables are inlined
+  }
+  uint64_t hottest = 0;
+  std::vector<std::vector<int>> callees(prog.size());
+  for (std::size_t i = 0; i < prog.size(); i++)
+    for (auto const &l : prog[i].schedule)
+      if (auto call = dynamic_cast<rtl::Call *>(prog[i].body.at(l))) {
+        hottest = std::max(hottest, weight(weights.at(prog[i].name), l));
+        auto it = index.find(call->func);
+        if (it != index.end())
+          callees[i].push_back(it->second);
+      }
+  auto threshold = std::max<uint64_t>(1, hottest / inline_min_share);
+
+  std::vector<int> inlined(prog.size());
+  sched::bottom_up(sched, callees, [&](int i) {
+    auto &cbl = prog[i];
+    if (!callables.count(cbl.name))
+      return;
+    auto &cw = weights.at(cbl.name);
+    std::vector<rtl::Label> sites;
+    for (auto const &l : cbl.schedule)
+      if (auto call = dynamic_cast<rtl::Call *>(cbl.body.at(l)))
+        if (call->func != cbl.name && callables.count(call->func) &&
+            weight(cw, l) >= threshold)
+          sites.push_back(l);
+    std::stable_sort(sites.begin(), sites.end(), [&](auto a, auto b) {
+      return weight(cw, a) > weight(cw, b);
+    });
+    auto budget = std::max(inline_min_growth, cbl.schedule.size());
+    for (auto const &l : sites) {
+      auto const &callee =
+          *callables.at(static_cast<rtl::Call *>(cbl.body.at(l))->func);
+      if (callee.schedule.size() > inline_max_size ||
+          callee.schedule.size() > budget)
+        continue;
+      budget -= callee.schedule.size();
+      inline_call(cbl, cw, l, callee, weights.at(callee.name));
+      inlined[i]++;
+    }
+  });
+  return std::accumulate(inlined.begin(), inlined.end(), 0);
+}
+
+struct Loop {
+  rtl::Label header;
+  std::vector<rtl::Label> latches;
+  std::vector<rtl::Label> body; // in schedule order, header included
+};
+
+/**
+ * The natural loops of cbl whose body contains no other loop. The back
+ * edges are the edges to an ancestor in a depth-first search, which finds
+ * all the loops of the structured code generated from BX.
+ */
+std::vector<Loop> innermost_loops(rtl::Callable const &cbl) {
+  rtl::LabelMap<std::vector<rtl::Label>> preds, latches;
+  rtl::LabelMap<int> state; // 1: on the stack, 2: done
+  std::vector<std::pair<rtl::Label, std::size_t>> stack;
+  std::vector<rtl::Label> headers;
+  auto visit = [&](rtl::Label l) {
+    state[l] = 1;
+    stack.push_back({l, 0});
+  };
+  visit(cbl.schedule.front());
+  while (!stack.empty()) {
+    auto l = stack.back().first;
+    auto succs = rtl::successors(*cbl.body.at(l));
+    auto &next = stack.back().second;
+    if (next == succs.size()) {
+      state[l] = 2;
+      stack.pop_back();
+      continue;
+    }
+    auto s = succs[next++];
+    preds[s].push_back(l);
+    if (state[s] == 1) {
+      if (latches[s].empty())
+        headers.push_back(s);
+      latches[s].push_back(l);
+    } else if (state[s] == 0)
+      visit(s);
+  }
+
+  std::vector<Loop> loops;
+  rtl::LabelMap<rtl::Label> loop_of;
+  for (auto const &h : headers) {
+    rtl::LabelMap<bool> in{{h, true}};
+    std::vector<rtl::Label> todo;
+    for (auto const &l : latches[h])
+      if (!in[l]) {
+        in[l] = true;
+        todo.push_back(l);
+      }
+    while (!todo.empty()) {
+      auto l = todo.back();
+      todo.pop_back();
+      for (auto const &p : preds[l])
+        if (!in[p]) {
+          in[p] = true;
+          todo.push_back(p);
+        }
+    }
+    Loop loop{h, latches[h], {}};
+    bool innermost = true;
+    for (auto const &l : cbl.schedule)
+      if (in[l]) {
+        loop.body.push_back(l);
+        innermost = innermost && (l == h || latches[l].empty());
+      }
+    if (innermost)
+      loops.push_back(std::move(loop));
+  }
+  return loops;
+}
+
+/**
+ * Chain factor copies of the loop: the back edges of each copy go to the
+ * header of the next one, and the ones of the last copy to the original
+ * header. The copies share the pseudos of the loop.
+ */
+void unroll_loop(rtl::Callable &cbl, Weights &w, Loop const &loop,
+                 int factor) {
+  std::unordered_set<int> in;
+  for (auto const &l : loop.body)
+    in.insert(l.id);
+  std::vector<rtl::LabelMap<rtl::Label>> copies(factor);
+  for (int k = 1; k < factor; k++)
+    for (auto const &l : loop.body)
+      copies[k][l] = cbl.fresh_label();
+  auto same = [](rtl::Pseudo r) { return r; };
+  for (int k = 1; k < factor; k++) {
+    auto target = [&](rtl::Label l) {
+      if (l == loop.header)
+        return k + 1 < factor ? copies[k + 1].at(l) : l;
+      return in.count(l.id) ? copies[k].at(l) : l;
+    };
+    for (auto const &l : loop.body) {
+      cbl.add_instr(copies[k].at(l), rtl::rename(*cbl.body.at(l), target, same));
+      w[copies[k].at(l)] = weight(w, l) / factor;
+    }
+  }
+  auto to_first_copy = [&](rtl::Label l) {
+    return l == loop.header ? copies[1].at(l) : l;
+  };
+  for (auto const &l : loop.latches)
+    cbl.body.insert_or_assign(l,
+                              rtl::rename(*cbl.body.at(l), to_first_copy, same));
+  for (auto const &l : loop.body)
+    w[l] = weight(w, l) / factor;
+}
+
+int unroll_loops(rtl::Program &prog, profile::Weights &weights) {
+  int unrolled = 0;
+  for (auto &cbl : prog) {
+    if (cbl.schedule.empty())
+      continue;
+    auto &w = weights[cbl.name];
+    for (auto const &loop : innermost_loops(cbl)) {
+      if (loop.body.size() > unroll_max_size)
+        continue;
+      // the trip count is the number of iterations per entry in the loop
+      std::unordered_set<int> in;
+      for (auto const &l : loop.body)
+        in.insert(l.id);
+      uint64_t entries = 0;
+      for (auto const &l : cbl.schedule)
+        if (!in.count(l.id))
+          for (auto const &s : rtl::successors(*cbl.body.at(l)))
+            if (s == loop.header)
+              entries += weight(w, l);
+      if (entries == 0)
+        continue;
+      auto trip = weight(w, loop.header) / entries;
+      int factor = trip >= 16 ? 4 : trip >= 4 ? 2 : 1;
+      while (factor > 1 && loop.body.size() * factor > unroll_max_growth)
+        factor /= 2;
+      if (factor == 1)
+        continue;
+      unroll_loop(cbl, w, loop, factor);
+      unrolled++;
+    }
+  }
+  return unrolled;
+}
+
+/**
+ * Lay out the code of cbl in chains: after an instruction comes its
+ * hottest successor that is not laid out yet, otherwise the hottest label
+ * reached so far. The entry stays first, a frame deletion is followed by
+ * its return, and what never ran keeps the order of the schedule at the
+ * end.
+ */
+void lay_out(rtl::Callable &cbl, Weights const &w) {
+  rtl::LabelMap<std::size_t> position;
+  for (std::size_t i = 0; i < cbl.schedule.size(); i++)
+    position[cbl.schedule[i]] = i;
+  auto hotter = [&](rtl::Label a, rtl::Label b) {
+    auto wa = weight(w, a), wb = weight(w, b);
+    return wa != wb ? wa > wb : position.at(a) < position.at(b);
+  };
+
+  std::vector<rtl::Label> layout;
+  rtl::LabelMap<bool> placed;
+  std::vector<rtl::Label> pending;
+  auto place = [&](rtl::Label l) {
+    placed[l] = true;
+    layout.push_back(l);
+  };
+  auto next = cbl.schedule.front();
+  while (true) {
+    place(next);
+    auto instr = cbl.body.at(next);
+    auto succs = rtl::successors(*instr);
+    for (auto const &s : succs)
+      if (weight(w, s) > 0 && !placed[s])
+        pending.push_back(s);
+    if (dynamic_cast<rtl::DelFrame *>(instr) && !placed[succs.front()]) {
+      next = succs.front();
+      continue;
+    }
+    std::vector<rtl::Label> candidates;
+    for (auto const &s : succs)
+      if (weight(w, s) > 0 && !placed[s])
+        candidates.push_back(s);
+    if (candidates.empty()) {
+      pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                   [&](auto l) { return placed[l]; }),
+                    pending.end());
+      candidates = pending;
+    }
+    if (candidates.empty())
+      break;
+    next = *std::min_element(candidates.begin(), candidates.end(), hotter);
+  }
+  for (auto const &l : cbl.schedule)
+    if (!placed[l])
+      place(l);
+  cbl.layout = std::move(layout);
+}
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  return out << stats.inlined << " calls inlined, " << stats.unrolled
+             << " loops unrolled, " << stats.laid_out << " callables laid out";
+}
+
+Stats optimize(rtl::Program &prog, profile::Weights &weights,
+               sched::Scheduler &sched) {
+  Stats stats;
+  stats.inlined = inline_calls(prog, weights, sched);
+  stats.unrolled = unroll_loops(prog, weights);
+  for (auto &cbl : prog) {
+    auto const &w = weights[cbl.name];
+    if (cbl.schedule.empty() || weight(w, cbl.schedule.front()) == 0)
+      continue;
+    lay_out(cbl, w);
+    stats.laid_out++;
+  }
+  return stats;
+}
+
+int inline_small(rtl::Program &prog, sched::Scheduler &sched) {
+  profile::Weights weights;
+  for (auto const &cbl : prog)
+    for (auto const &l : cbl.schedule)
+      weights[cbl.name][l] = 1;
+  return inline_calls(prog, weights, sched);
+}
+
+} // namespace pgo
+} // namespace bx
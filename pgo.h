@@ -0,0 +1,53 @@
+#pragma once
+
+/**
+ * Profile-guided optimization of RTL programs (bx --profile-use).
+ *
+ * Given the weights of a profile (profile::weigh), optimize() runs, in
+ * order:
+ *
+ *   - inlining of the hot call sites whose callee is small and does not
+ *     take the address of its frame, bottom-up in the call graph (see
+ *     sched::bottom_up) so that a callee is inlined with its own call sites
+ *     already inlined;
+ *   - unrolling of the hot innermost loops whose recorded trip count is
+ *     large enough, by 2 or 4, keeping every exit test;
+ *   - layout of the code: the blocks are chained so that the hottest
+ *     successor of an instruction comes right after it, which lets
+ *     rtl_asm.cpp invert branches to fall through on the likely path, and
+ *     the code that never ran goes to the end of the callable.
+ *
+ * New code only adds labels and pseudos at the end of the schedule, so the
+ * frame slots of the existing pseudos do not move (see rtl.h).
+ */
+
+#include <cstdint>
+#include <iostream>
+
+#include "profile.h"
+#include "rtl.h"
+#include "scheduler.h"
+
+namespace bx {
+namespace pgo {
+
+struct Stats {
+  int inlined = 0;  // call sites
+  int unrolled = 0; // loops
+  int laid_out = 0; // callables
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+/** Optimize prog; weights are updated along with the code */
+Stats optimize(rtl::Program &prog, profile::Weights &weights,
+               sched::Scheduler &sched);
+
+/**
+ * Without a profile, inline the call sites whose callee is small as if
+ * they were all equally hot (see lto.h). Returns the number of call sites
+ * inlined.
+ */
+int inline_small(rtl::Program &prog, sched::Scheduler &sched);
+
+} // namespace pgo
+} // namespace bx
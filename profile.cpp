@@ -0,0 +1,266 @@
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include "amd64.h"
+#include "encoding.h"
+#include "profile.h"
+
+namespace bx {
+namespace profile {
+
+char const *const counters_symbol = "__bx_profile_counts";
+char const *const map_suffix = ".profmap";
+
+namespace {
+
+constexpr int map_version = 1;
+constexpr char magic[8] = {'B', 'X', 'P', 'R', 'O', 'F', 1, 0};
+
+std::string describe(Site const &site) {
+  std::ostringstream out;
+  out << (site.kind == Site::BLOCK ? "block " : "call ") << site.callable
+      << ' ' << site.position;
+  if (site.kind == Site::CALL)
+    out << ' ' << site.callee;
+  return out.str();
+}
+
+/**
+ * The labels where a basic block starts: the entry, and the reachable
+ * labels that are a join point or the target of a branch
+ */
+rtl::LabelMap<bool> block_entries(rtl::Callable const &cbl) {
+  rtl::LabelMap<int> preds;
+  rtl::LabelMap<bool> entries, reached;
+  if (cbl.schedule.empty())
+    return entries;
+  std::vector<rtl::Label> todo{cbl.schedule.front()};
+  reached[todo.back()] = true;
+  while (!todo.empty()) {
+    auto l = todo.back();
+    todo.pop_back();
+    auto succs = rtl::successors(*cbl.body.at(l));
+    for (auto const &s : succs) {
+      preds[s]++;
+      if (succs.size() > 1)
+        entries[s] = true;
+      if (!reached[s]) {
+        reached[s] = true;
+        todo.push_back(s);
+      }
+    }
+  }
+  for (auto const &p : preds)
+    if (p.second > 1)
+      entries[p.first] = true;
+  entries[cbl.schedule.front()] = true;
+  return entries;
+}
+
+/**
+ * Jump from the start of the entry procedure to a call of
+ * bx_profile_start(counters, n, checksum), placed at the end of the
+ * schedule so that its pseudos come after the ones of the callable.
+ */
+void register_counters(rtl::Callable &cbl, Map const &map) {
+  auto counters = cbl.fresh_pseudo(), size = cbl.fresh_pseudo(),
+       checksum = cbl.fresh_pseudo();
+  auto start = cbl.fresh_label(), in_label = cbl.fresh_label();
+  auto old_entry = cbl.schedule.front();
+  cbl.schedule.insert(cbl.schedule.begin(), start);
+  cbl.body.insert_or_assign(start, rtl::Goto::make(in_label));
+  auto add_sequential = [&](auto use_label) {
+    auto next = cbl.fresh_label();
+    cbl.add_instr(in_label, use_label(next));
+    in_label = next;
+  };
+  add_sequential([&](auto next) {
+    return rtl::CopyAP::make(counters_symbol, -1, amd64::reg::rip,
+                             rtl::discard_pr, counters, next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::Move::make(static_cast<int64_t>(map.sites.size()), size,
+                           next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::Move::make(static_cast<int64_t>(map.checksum), checksum,
+                           next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::CopyPM::make(counters, amd64::reg::rdi, next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::CopyPM::make(size, amd64::reg::rsi, next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::CopyPM::make(checksum, amd64::reg::rdx, next);
+  });
+  add_sequential([&](auto next) {
+    return rtl::Call::make("bx_profile_start", 3, next);
+  });
+  cbl.add_instr(in_label, rtl::Goto::make(old_entry));
+}
+
+/** The counters of a callable, in order, with the label they count */
+std::vector<std::pair<rtl::Label, Site>> counters_of(rtl::Callable const &cbl) {
+  std::vector<std::pair<rtl::Label, Site>> counters;
+  auto entries = block_entries(cbl);
+  int position = 0;
+  for (auto const &l : cbl.schedule) {
+    if (entries.count(l))
+      counters.push_back({l, Site{Site::BLOCK, cbl.name, position, ""}});
+    if (auto call = dynamic_cast<rtl::Call *>(cbl.body.at(l)))
+      counters.push_back(
+          {l, Site{Site::CALL, cbl.name, position, call->func}});
+    position++;
+  }
+  return counters;
+}
+
+uint64_t checksum(std::vector<Site> const &sites, std::string const &entry) {
+  auto h = encoding::fnv1a(entry);
+  for (auto const &site : sites)
+    h = encoding::fnv1a(describe(site) + '\n', h);
+  return h;
+}
+
+} // namespace
+
+Map instrument(rtl::Program &prog, std::string const &entry) {
+  Map map;
+  for (auto &cbl : prog) {
+    auto counters = counters_of(cbl);
+    auto next_counter = counters.begin();
+    std::vector<rtl::Label> schedule;
+    for (auto const &l : cbl.schedule) {
+      // the counters take the place of the instruction, which keeps its
+      // predecessors, and the instruction moves to a fresh label
+      auto instr = cbl.body.at(l);
+      auto at = l;
+      schedule.push_back(at);
+      for (; next_counter != counters.end() && next_counter->first == l;
+           ++next_counter) {
+        auto next = cbl.fresh_label();
+        auto counter = static_cast<int>(map.sites.size());
+        map.sites.push_back(next_counter->second);
+        cbl.body.insert_or_assign(at, rtl::Count::make(counter, next));
+        schedule.push_back(next);
+        at = next;
+      }
+      cbl.body.insert_or_assign(at, instr);
+    }
+    cbl.schedule = std::move(schedule);
+  }
+  map.checksum = checksum(map.sites, entry);
+
+  bool found = false;
+  for (auto &cbl : prog)
+    if (cbl.name == entry && !cbl.schedule.empty()) {
+      register_counters(cbl, map);
+      found = true;
+    }
+  if (!found)
+    throw std::runtime_error("cannot find the " + entry + "() procedure");
+  return map;
+}
+
+Weights weigh(rtl::Program const &prog, Map const &map,
+              std::vector<uint64_t> const &counts, std::string const &entry) {
+  std::vector<Site> sites;
+  std::vector<rtl::Label> labels;
+  for (auto const &cbl : prog)
+    for (auto const &c : counters_of(cbl)) {
+      labels.push_back(c.first);
+      sites.push_back(c.second);
+    }
+  if (checksum(sites, entry) != map.checksum || counts.size() != sites.size())
+    throw std::runtime_error("the profile is for another program");
+
+  Weights weights;
+  std::size_t k = 0;
+  for (auto const &cbl : prog) {
+    auto &w = weights[cbl.name];
+    // the blocks get their counts, the other instructions the count of
+    // their only predecessor
+    for (; k < sites.size() && sites[k].callable == cbl.name; k++)
+      if (sites[k].kind == Site::BLOCK)
+        w[labels[k]] = counts[k];
+    if (cbl.schedule.empty())
+      continue;
+    std::vector<rtl::Label> todo{cbl.schedule.front()};
+    rtl::LabelMap<bool> seen{{todo.back(), true}};
+    while (!todo.empty()) {
+      auto l = todo.back();
+      todo.pop_back();
+      for (auto const &s : rtl::successors(*cbl.body.at(l))) {
+        if (seen[s])
+          continue;
+        seen[s] = true;
+        if (!w.count(s))
+          w[s] = w[l];
+        todo.push_back(s);
+      }
+    }
+  }
+  return weights;
+}
+
+void write_map(std::ostream &out, Map const &map) {
+  out << "bxprofmap " << map_version << ' ' << std::hex << map.checksum
+      << std::dec << '\n';
+  for (auto const &site : map.sites)
+    out << describe(site) << '\n';
+}
+
+Map read_map(std::istream &in) {
+  Map map;
+  std::string header;
+  int version = 0;
+  if (!(in >> header >> version >> std::hex >> map.checksum >> std::dec) ||
+      header != "bxprofmap" || version != map_version)
+    throw std::runtime_error("not a profile map");
+  std::string kind;
+  while (in >> kind) {
+    Site site;
+    if (kind == "block")
+      site.kind = Site::BLOCK;
+    else if (kind == "call")
+      site.kind = Site::CALL;
+    else
+      throw std::runtime_error("bad profile map entry " + kind);
+    in >> site.callable >> site.position;
+    if (site.kind == Site::CALL)
+      in >> site.callee;
+    if (!in)
+      throw std::runtime_error("truncated profile map");
+    map.sites.push_back(std::move(site));
+  }
+  return map;
+}
+
+std::vector<uint64_t> read_counts(std::istream &in, Map const &map) {
+  char header[16];
+  if (!in.read(header, sizeof header) ||
+      std::memcmp(header, magic, sizeof magic) != 0)
+    throw std::runtime_error("not a BX profile");
+  uint64_t checksum = 0;
+  for (int i = 7; i >= 0; i--)
+    checksum = checksum << 8 | static_cast<unsigned char>(header[8 + i]);
+  std::string rest{std::istreambuf_iterator<char>{in}, {}};
+  std::size_t pos = 0;
+  auto uleb = [&rest, &pos] {
+    return encoding::get_uleb(rest, pos, "truncated profile",
+                              "bad number in the profile");
+  };
+  if (checksum != map.checksum || uleb() != map.sites.size())
+    throw std::runtime_error("the profile is for another program");
+  std::vector<uint64_t> counts(map.sites.size());
+  for (auto &c : counts)
+    c = uleb();
+  return counts;
+}
+
+} // namespace profile
+} // namespace bx
@@ -0,0 +1,81 @@
+#pragma once
+
+/**
+ * Profiling of the generated code (bx --profile).
+ *
+ * instrument() puts an rtl::Count instruction at the entry of every basic
+ * block and before every call. The counters are an array of quads in the
+ * data section (counters_symbol); the entry procedure registers them with
+ * the runtime, which adds them to the profile file when the program exits
+ * (bxrt.c, $BX_PROFILE or bxprof.out by default).
+ *
+ * The compiler describes the counters in a map file next to the program:
+ *
+ *     bxprofmap <version> <checksum>
+ *     block <callable> <position>
+ *     call <callable> <position> <callee>
+ *
+ * with one line per counter, where position is the index in the schedule
+ * of the uninstrumented callable of the instruction that is counted.
+ * Positions do not depend on label numbers, so the map stays valid across
+ * compilations of the same source.
+ *
+ * The profile file is binary: the 8 bytes "BXPROF" 1 0, the checksum of
+ * the map as 8 little-endian bytes, then the number of counters and the
+ * counters themselves as unsigned LEB128 numbers.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rtl.h"
+
+namespace bx {
+namespace profile {
+
+extern char const *const counters_symbol;
+extern char const *const map_suffix;
+
+struct Site {
+  enum Kind { BLOCK, CALL };
+  Kind kind;
+  std::string callable;
+  int position;
+  std::string callee; // for CALL
+};
+
+struct Map {
+  uint64_t checksum = 0;
+  std::vector<Site> sites; // one per counter
+};
+
+/**
+ * Insert the counters in prog, and the code registering them at the start
+ * of the entry procedure. Neither add pseudos to the existing code, so the
+ * frame layout of the callables does not change.
+ */
+Map instrument(rtl::Program &prog, std::string const &entry = "main");
+
+/** The number of executions of every reachable instruction, by callable */
+using Weights = std::unordered_map<std::string, rtl::LabelMap<uint64_t>>;
+
+/**
+ * Give the instructions of prog, which must not be instrumented, the
+ * counts recorded by a build with the instrumentation described by map.
+ * Throws if prog is not the program that was instrumented.
+ */
+Weights weigh(rtl::Program const &prog, Map const &map,
+              std::vector<uint64_t> const &counts,
+              std::string const &entry = "main");
+
+void write_map(std::ostream &out, Map const &map);
+Map read_map(std::istream &in);
+
+/** Read a profile file; its checksum must be the one of map */
+std::vector<uint64_t> read_counts(std::istream &in, Map const &map);
+
+} // namespace profile
+} // namespace bx
@@ -53,5 +53,156 @@ std::ostream &operator<<(std::ostream &out, Callable const &cbl) {
   return out << "END CALLABLE\n\n";
 }
 
+namespace {
+
+struct Successors : public InstrVisitor {
+  std::vector<Label> labels;
+  // clang-format off
+  void visit(Move const &i) override      { labels = {i.succ}; }
+  void visit(Copy const &i) override      { labels = {i.succ}; }
+  void visit(CopyMP const &i) override    { labels = {i.succ}; }
+  void visit(CopyPM const &i) override    { labels = {i.succ}; }
+  void visit(CopyAP const &i) override    { labels = {i.succ}; }
+  void visit(Load const &i) override      { labels = {i.succ}; }
+  void visit(Store const &i) override     { labels = {i.succ}; }
+  void visit(Binop const &i) override     { labels = {i.succ}; }
+  void visit(Unop const &i) override      { labels = {i.succ}; }
+  void visit(Bbranch const &i) override   { labels = {i.succ, i.fail}; }
+  void visit(Ubranch const &i) override   { labels = {i.succ, i.fail}; }
+  void visit(Call const &i) override      { labels = {i.succ}; }
+  void visit(Return const &) override     { labels = {}; }
+  void visit(Goto const &i) override      { labels = {i.succ}; }
+  void visit(NewFrame const &i) override  { labels = {i.succ}; }
+  void visit(DelFrame const &i) override  { labels = {i.succ}; }
+  void visit(LoadParam const &i) override { labels = {i.succ}; }
+  void visit(Push const &i) override      { labels = {i.succ}; }
+  void visit(Pop const &i) override       { labels = {i.succ}; }
+  void visit(Count const &i) override     { labels = {i.succ}; }
+  // clang-format on
+};
+
+struct Pseudos : public InstrVisitor {
+  std::vector<Pseudo> regs;
+  void based(Pseudo base, Pseudo other) {
+    regs = base == discard_pr ? std::vector<Pseudo>{other}
+                              : std::vector<Pseudo>{base, other};
+  }
+  // clang-format off
+  void visit(Move const &i) override      { regs = {i.dest}; }
+  void visit(Copy const &i) override      { regs = {i.src, i.dest}; }
+  void visit(CopyMP const &i) override    { regs = {i.dest}; }
+  void visit(CopyPM const &i) override    { regs = {i.src}; }
+  void visit(CopyAP const &i) override    { based(i.pbase, i.dst); }
+  void visit(Load const &i) override      { based(i.pbase, i.dest); }
+  void visit(Store const &i) override     { based(i.pbase, i.src); }
+  void visit(Binop const &i) override     { regs = {i.src, i.dest}; }
+  void visit(Unop const &i) override      { regs = {i.arg}; }
+  void visit(Bbranch const &i) override   { regs = {i.arg1, i.arg2}; }
+  void visit(Ubranch const &i) override   { regs = {i.arg}; }
+  void visit(Call const &) override       { regs = {}; }
+  void visit(Return const &) override     { regs = {}; }
+  void visit(Goto const &) override       { regs = {}; }
+  void visit(NewFrame const &) override   { regs = {}; }
+  void visit(DelFrame const &) override   { regs = {}; }
+  void visit(LoadParam const &i) override { regs = {i.dest}; }
+  void visit(Push const &i) override      { regs = {i.dest}; }
+  void visit(Pop const &i) override       { regs = {i.dest}; }
+  void visit(Count const &) override      { regs = {}; }
+  // clang-format on
+};
+
+struct Renamer : public InstrVisitor {
+  std::function<Label(Label)> const &l;
+  std::function<Pseudo(Pseudo)> const &p_;
+  InstrPtr result = nullptr;
+  Renamer(std::function<Label(Label)> const &l,
+          std::function<Pseudo(Pseudo)> const &p)
+      : l{l}, p_{p} {}
+
+  Pseudo p(Pseudo r) { return r == discard_pr ? r : p_(r); }
+
+  void visit(Move const &i) override {
+    result = Move::make(i.source, p(i.dest), l(i.succ));
+  }
+  void visit(Copy const &i) override {
+    result = Copy::make(p(i.src), p(i.dest), l(i.succ));
+  }
+  void visit(CopyMP const &i) override {
+    result = CopyMP::make(i.src, p(i.dest), l(i.succ));
+  }
+  void visit(CopyPM const &i) override {
+    result = CopyPM::make(p(i.src), i.dest, l(i.succ));
+  }
+  void visit(CopyAP const &i) override {
+    result = CopyAP::make(i.goffset, i.offset, i.base, p(i.pbase), p(i.dst),
+                          l(i.succ));
+  }
+  void visit(Load const &i) override {
+    result = Load::make(i.src, i.offset, p(i.dest), p(i.pbase), i.mbase,
+                        l(i.succ));
+  }
+  void visit(Store const &i) override {
+    result = Store::make(p(i.src), i.dest, p(i.pbase), i.mbase, i.offset,
+                         l(i.succ));
+  }
+  void visit(Binop const &i) override {
+    result = Binop::make(i.opcode, p(i.src), p(i.dest), l(i.succ));
+  }
+  void visit(Unop const &i) override {
+    result = Unop::make(i.opcode, p(i.arg), l(i.succ));
+  }
+  void visit(Bbranch const &i) override {
+    result = Bbranch::make(i.opcode, p(i.arg1), p(i.arg2), l(i.succ),
+                           l(i.fail));
+  }
+  void visit(Ubranch const &i) override {
+    result = Ubranch::make(i.opcode, p(i.arg), l(i.succ), l(i.fail));
+  }
+  void visit(Call const &i) override {
+    result = Call::make(i.func, i.Nargs, l(i.succ));
+  }
+  void visit(Return const &) override { result = Return::make(); }
+  void visit(Goto const &i) override { result = Goto::make(l(i.succ)); }
+  void visit(NewFrame const &i) override {
+    result = NewFrame::make(l(i.succ), i.size);
+  }
+  void visit(DelFrame const &i) override {
+    result = DelFrame::make(l(i.succ));
+  }
+  void visit(LoadParam const &i) override {
+    result = LoadParam::make(i.source, p(i.dest), l(i.succ));
+  }
+  void visit(Push const &i) override {
+    result = Push::make(p(i.dest), l(i.succ));
+  }
+  void visit(Pop const &i) override {
+    result = Pop::make(p(i.dest), l(i.succ));
+  }
+  void visit(Count const &i) override {
+    result = Count::make(i.counter, l(i.succ));
+  }
+};
+
+} // namespace
+
+std::vector<Label> successors(Instr &instr) {
+  Successors succ;
+  instr.accept(succ);
+  return succ.labels;
+}
+
+std::vector<Pseudo> pseudos(Instr &instr) {
+  Pseudos ps;
+  instr.accept(ps);
+  return ps.regs;
+}
+
+InstrPtr rename(Instr &instr, std::function<Label(Label)> const &label,
+                std::function<Pseudo(Pseudo)> const &pseudo) {
+  Renamer ren{label, pseudo};
+  instr.accept(ren);
+  return ren.result;
+}
+
 } // namespace rtl
 } // namespace bx
\ No newline at end of file
@@ -2,7 +2,9 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <stdexcept>
 #include <unordered_map>
 #include <vector>
@@ -64,6 +66,7 @@ struct DelFrame;  ///////////////////////////////
 struct LoadParam; ///////////////////////////////
 struct Push;      ///////////////////////////////
 struct Pop;       ///////////////////////////////
+struct Count;
 
 struct InstrVisitor {
   virtual ~InstrVisitor() = default;
@@ -89,6 +92,7 @@ struct InstrVisitor {
   VISIT_FUNCTION(LoadParam); ///////////////////////////////
   VISIT_FUNCTION(Push);      ///////////////////////////////
   VISIT_FUNCTION(Pop);       ///////////////////////////////
+  VISIT_FUNCTION(Count);
 #undef VISIT_FUNCTION
 };
 
@@ -455,6 +459,18 @@ struct Pop : public Instr {
   CONSTRUCTOR(Pop, Pseudo dest, Label succ) : dest{dest}, succ{succ} {}
 };
 /////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Increment the profile counter number `counter` (see profile.h) */
+struct Count : public Instr {
+  int counter;
+  Label succ;
+
+  std::ostream &print(std::ostream &out) const override {
+    return out << "count " << counter << "  --> " << succ;
+  }
+  MAKE_VISITABLE
+  CONSTRUCTOR(Count, int counter, Label succ) : counter{counter}, succ{succ} {}
+};
 #undef MAKE_VISITABLE
 
 struct LabelHash {
@@ -477,7 +493,34 @@ struct Callable {
   Pseudo output_reg;
   LabelMap<InstrPtr> body;
   std::vector<Label> schedule; // the order in which the labels are scheduled
+  /**
+   * The order in which the code is laid out, if not the schedule (see
+   * pgo.h). The frame is always laid out following the schedule.
+   */
+  std::vector<Label> layout;
+  std::vector<Label> const &code_order() const {
+    return layout.empty() ? schedule : layout;
+  }
+  /**
+   * What may hold the address of a heap block, for the stack maps of the
+   * garbage collector (see gc.h): pseudos, and words of the frame given by
+   * their offset from the frame pointer.
+   */
+  std::vector<Pseudo> roots;
+  std::vector<int> frame_roots;
+  /**
+   * Bytes at the top of the frame, from -8(%rbp) down, that hold the local
+   * lists; the slots of the pseudos come below them
+   */
+  int locals = 0;
+  /**
+   * Labels and pseudos are numbered per callable, so that the numbering
+   * does not depend on the order in which the callables are generated
+   */
+  int last_label = 0, last_pseudo = 0;
   explicit Callable(std::string name) : name{name} {}
+  Label fresh_label() { return Label{last_label++}; }
+  Pseudo fresh_pseudo() { return Pseudo{last_pseudo++}; }
   void add_instr(Label lab, InstrPtr instr) {
     if (body.find(lab) != body.end()) {
       std::cerr << "Repeated in-label: " << lab.id << '\n';
@@ -492,6 +535,19 @@ std::ostream &operator<<(std::ostream &out, Callable const &cbl);
 
 using Program = std::vector<Callable>;
 
+/** The labels an instruction can continue at (none for Return) */
+std::vector<Label> successors(Instr &instr);
+
+/**
+ * The pseudos used by an instruction, in the order in which rtl_asm.cpp
+ * gives them a stack slot
+ */
+std::vector<Pseudo> pseudos(Instr &instr);
+
+/** A copy of an instruction with its labels and pseudos renamed */
+InstrPtr rename(Instr &instr, std::function<Label(Label)> const &label,
+                std::function<Pseudo(Pseudo)> const &pseudo);
+
 } // namespace rtl
 
 } // namespace bx
@@ -10,14 +10,27 @@
  *
  *     AsmProgram bx::rtl_to_asm(rtl::Program const &prog)
  *         The main compilation function
+ *
+ *     AsmProgram bx::globals_to_asm(std::map<std::string, int> const &)
+ *         The data section for the global variables
+ *
+ *     AsmProgram bx::counters_to_asm(std::string const &, std::size_t)
+ *         The data section for the profile counters
+ *
+ *     AsmProgram bx::stackmaps_to_asm(rtl::Program const &, ...)
+ *         The data section for the stack maps of the garbage collector
  */
 
 #include <cassert>
 #include <cstdint>
+#include <set>
 #include <stdexcept>
 #include <unordered_map>
 
 #include "amd64.h"
+#include "bxrt.h"
+#include "gc.h"
+#include "profile.h"
 #include "rtl.h"
 #include "rtl_asm.h"
 
@@ -25,15 +38,19 @@ namespace bx {
 
 using namespace amd64;
 
+/** The largest allocation whose fast path is inline (see alloc_inline) */
+constexpr int32_t INLINE_ALLOC_MAX = 1 << 20;
+
 class InstrCompiler : public rtl::InstrVisitor {
 private:
   std::string funcname, exit_label;
   std::unordered_map<int, amd64::Pseudo> rmap{};
+  std::size_t locals = 0; // words of the local lists, above the slots
   AsmProgram body{};
 
   amd64::Pseudo lookup(rtl::Pseudo r) {
     if (rmap.find(r.id) == rmap.end()) {
-      amd64::Pseudo p{static_cast<int>(rmap.size() + 1)};
+      amd64::Pseudo p{static_cast<int>(locals + rmap.size() + 1)};
       rmap.insert({r.id, p});
     }
     return rmap.at(r.id);
@@ -45,7 +62,159 @@ private:
 
   void append(std::unique_ptr<Asm> line) { body.push_back(std::move(line)); }
 
+  /**
+   * The fast paths of some functions of the runtime, which continue at
+   * succ when they succeed and otherwise fall through to the call. The
+   * argument is in %rdi, and only the registers that the call clobbers are
+   * used.
+   */
+  int intrinsics = 0;
+
+  amd64::Label intrinsic_label(char const *what) {
+    return ".L" + funcname + '.' + what + std::to_string(intrinsics);
+  }
+
+  /** %rax = bx_out_len, and jump to slow if the buffer is full */
+  void check_out_room(amd64::Label const &slow) {
+    Pseudo rip{reg::rip}, rax{reg::rax}, rcx{reg::rcx};
+    append(Asm::movq("bx_out_len", rip, rax));
+    append(Asm::movq("bx_out_limit", rip, rcx));
+    append(Asm::cmpq(rcx, rax));
+    append(Asm::jge(slow));
+  }
+
+  /** Store the line in %rdx, of length %rsi, at the end of the buffer */
+  void append_out_line() {
+    Pseudo rip{reg::rip}, rax{reg::rax}, rcx{reg::rcx}, rdx{reg::rdx},
+        rsi{reg::rsi};
+    append(Asm::leaq("bx_out_buf", rip, rcx));
+    append(Asm::addq(rax, rcx));
+    append(Asm::movq(rdx, 0, rcx));
+    append(Asm::addq(rsi, rax));
+    append(Asm::movq(rax, "bx_out_len", rip));
+  }
+
+  /**
+   * Bump allocation in the current span of the heap (see bxrt.h) of a block
+   * of %rdi bytes plus its header, into %rax. The runtime takes the other
+   * blocks, and the negative sizes.
+   */
+  void alloc_inline(rtl::Label succ, bool refs) {
+    intrinsics++;
+    auto slow = intrinsic_label("alloc_slow");
+    Pseudo rip{reg::rip}, rax{reg::rax}, rcx{reg::rcx}, rdx{reg::rdx},
+        rsi{reg::rsi}, rdi{reg::rdi};
+    append(Asm::cmpq(0, rdi));
+    append(Asm::jl(slow));
+    append(Asm::cmpq(INLINE_ALLOC_MAX, rdi));
+    append(Asm::jg(slow));
+    append(Asm::movq(rdi, rax));
+    append(Asm::addq(31, rax));
+    append(Asm::andq(-16, rax));
+    append(Asm::movq("bx_heap", rip, rcx));
+    append(Asm::movq(rcx, rdx));
+    append(Asm::addq(rax, rdx));
+    append(Asm::movq("bx_heap+8", rip, rsi));
+    append(Asm::cmpq(rsi, rdx));
+    append(Asm::jge(slow));
+    append(Asm::movq(rdx, "bx_heap", rip));
+    append(Asm::incq("bx_heap+16", rip));
+    append(Asm::addq(rax, "bx_heap+24", rip));
+    if (refs)
+      append(Asm::orq(BX_HEADER_REFS, rax));
+    append(Asm::movq(rax, 8, rcx));
+    append(Asm::leaq(16, rcx, rax));
+    append(Asm::jmp(label_translate(succ)));
+    append(Asm::set_label(slow));
+  }
+
+  /** Append "true\n" or "false\n" to the output buffer */
+  void print_bool_inline(rtl::Label succ) {
+    intrinsics++;
+    auto slow = intrinsic_label("print_slow"),
+         store = intrinsic_label("print_store");
+    Pseudo rdx{reg::rdx}, rsi{reg::rsi}, rdi{reg::rdi};
+    check_out_room(slow);
+    append(Asm::movabsq(0x0a65757274, rdx)); // "true\n"
+    append(Asm::movq(5, rsi));
+    append(Asm::cmpq(0, rdi));
+    append(Asm::jne(store));
+    append(Asm::movabsq(0x0a65736c6166, rdx)); // "false\n"
+    append(Asm::movq(6, rsi));
+    append(Asm::set_label(store));
+    append_out_line();
+    append(Asm::jmp(label_translate(succ)));
+    append(Asm::set_label(slow));
+  }
+
+  /**
+   * Numbers in [0, 10^7) fit in 8 bytes with their newline. The line is
+   * built in %r10 from the last digit up, dividing by 10 with a
+   * multiplication by its reciprocal. The other numbers go to the runtime.
+   */
+  void print_int_inline(rtl::Label succ) {
+    intrinsics++;
+    auto slow = intrinsic_label("print_slow"),
+         digit = intrinsic_label("print_digit");
+    Pseudo rax{reg::rax}, rcx{reg::rcx}, rdx{reg::rdx}, rsi{reg::rsi},
+        rdi{reg::rdi}, r8{reg::r8}, r9{reg::r9}, r10{reg::r10};
+    check_out_room(slow);
+    append(Asm::cmpq(0, rdi));
+    append(Asm::jl(slow));
+    append(Asm::movq(10000000, rcx));
+    append(Asm::cmpq(rcx, rdi));
+    append(Asm::jge(slow));
+    append(Asm::movq(rax, r9)); // the length of the buffer
+    append(Asm::movq(rdi, r8)); // what remains to print
+    append(Asm::movq(10, r10)); // the line, "\n" so far
+    append(Asm::movq(1, rsi));  // its length
+    append(Asm::movabsq(0x6666666666666667, rdi)); // 2^66 / 10, rounded up
+    append(Asm::set_label(digit));
+    append(Asm::movq(r8, rax));
+    append(Asm::imulq(rdi));
+    append(Asm::movq(2, rcx));
+    append(Asm::sarq(rdx)); // %rdx = %r8 / 10
+    append(Asm::movq(rdx, rax));
+    append(Asm::addq(rax, rax));
+    append(Asm::movq(rax, rcx));
+    append(Asm::addq(rcx, rcx));
+    append(Asm::addq(rcx, rcx));
+    append(Asm::addq(rax, rcx));
+    append(Asm::subq(rcx, r8)); // %r8 = %r8 % 10
+    append(Asm::addq(48, r8));
+    append(Asm::movq(8, rcx));
+    append(Asm::salq(r10));
+    append(Asm::orq(r8, r10));
+    append(Asm::addq(1, rsi));
+    append(Asm::movq(rdx, r8));
+    append(Asm::cmpq(0, r8));
+    append(Asm::jne(digit));
+    append(Asm::movq(r10, rdx));
+    append(Asm::movq(r9, rax));
+    append_out_line();
+    append(Asm::jmp(label_translate(succ)));
+    append(Asm::set_label(slow));
+  }
+
+
 public:
+  /** The label laid out after the instruction being compiled, if any */
+  rtl::Label next{-1};
+
+  /** Give the pseudos their stack slots in the order of the schedule */
+  void number_pseudos(rtl::Callable const &c) {
+    locals = static_cast<std::size_t>(c.locals) / 8;
+    for (auto const &l : c.schedule)
+      for (auto const &r : rtl::pseudos(*c.body.at(l)))
+        lookup(r);
+  }
+
+  /** The offset from %rbp of the slot of r, or 0 if r has none */
+  int slot_of(rtl::Pseudo r) const {
+    auto it = rmap.find(r.id);
+    return it == rmap.end() ? 0 : -8 * std::get<1>(*it->second.binding);
+  }
+
   void append_label(rtl::Label const &rtl_lab) {
     std::string label = label_translate(rtl_lab);
     if (body.size() > 0 && body.back()->repr_template.rfind("\tjmp", 0) == 0 &&
@@ -60,13 +229,15 @@ public:
 
   AsmProgram finalize() {
     AsmProgram prog;
-    prog.push_back(Asm::directive(".globl " + funcname));
-    prog.push_back(Asm::directive(".section .text"));
+    prog.push_back(Asm::globl(funcname));
+    prog.push_back(Asm::text());
     prog.push_back(Asm::set_label(funcname));
     if (rmap.size() > 0) {
       prog.push_back(Asm::pushq(Pseudo{reg::rbp}));
       prog.push_back(Asm::movq(Pseudo{reg::rsp}, Pseudo{reg::rbp}));
-      prog.push_back(Asm::subq(rmap.size() * 8, Pseudo{reg::rsp}));
+      // keep %rsp 16-byte aligned at calls, as the ABI requires
+      prog.push_back(Asm::subq((locals + rmap.size() + 1) / 2 * 16,
+                               Pseudo{reg::rsp}));
     }
     for (auto i = body.begin(), e = body.end(); i != e; i++)
       prog.push_back(std::move(*i));
@@ -81,9 +252,11 @@ public:
 
   void visit(rtl::Move const &mv) override {
     int64_t src = mv.source;
-    if (src < INT32_MIN || src > INT32_MAX)
-      append(Asm::movabsq(src, lookup(mv.dest)));
-    else
+    if (src < INT32_MIN || src > INT32_MAX) {
+      // movabsq only takes a register as destination
+      append(Asm::movabsq(src, Pseudo{reg::r12}));
+      append(Asm::movq(Pseudo{reg::r12}, lookup(mv.dest)));
+    } else
       append(Asm::movq(src, lookup(mv.dest)));
     append(Asm::jmp(label_translate(mv.succ)));
   }
@@ -161,15 +334,18 @@ public:
   void visit(rtl::Ubranch const &ub) override {
     Pseudo arg = lookup(ub.arg);
     append(Asm::cmpq(0u, arg));
-    switch (ub.opcode) {
-    case rtl::Ubranch::JZ:
-      append(Asm::je(label_translate(ub.succ)));
-      break;
-    case rtl::Ubranch::JNZ:
-      append(Asm::jne(label_translate(ub.succ)));
-      break;
+    // test the condition that jumps away from the next label
+    bool zero = ub.opcode == rtl::Ubranch::JZ;
+    rtl::Label target = ub.succ, other = ub.fail;
+    if (ub.succ == next) {
+      zero = !zero;
+      std::swap(target, other);
     }
-    append(Asm::jmp(label_translate(ub.fail)));
+    if (zero)
+      append(Asm::je(label_translate(target)));
+    else
+      append(Asm::jne(label_translate(target)));
+    append(Asm::jmp(label_translate(other)));
   }
 
   void visit(rtl::Bbranch const &bb) override {
@@ -178,31 +354,36 @@ public:
     append(Asm::movq(arg1, Pseudo{reg::rcx}));
     append(Asm::movq(arg2, Pseudo{reg::rax}));
     append(Asm::cmpq(Pseudo{reg::rax}, Pseudo{reg::rcx}));
-    switch (bb.opcode) {
+    // jump to fail on the negated condition, unless fail comes next
+    auto code = bb.opcode;
+    rtl::Label target = bb.fail, other = bb.succ;
+    bool negate = true;
+    if (bb.fail == next) {
+      negate = false;
+      std::swap(target, other);
+    }
+    auto const t = label_translate(target);
+    // clang-format off
+    switch (code) {
     case rtl::Bbranch::JE:
-      append(Asm::jne(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::jne(t) : Asm::je(t));  break;
     case rtl::Bbranch::JNE:
-      append(Asm::je(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::je(t) : Asm::jne(t));  break;
     case rtl::Bbranch::JL:
     case rtl::Bbranch::JNGE:
-      append(Asm::jge(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::jge(t) : Asm::jl(t));  break;
     case rtl::Bbranch::JLE:
     case rtl::Bbranch::JNG:
-      append(Asm::jg(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::jg(t) : Asm::jle(t));  break;
     case rtl::Bbranch::JG:
     case rtl::Bbranch::JNLE:
-      append(Asm::jle(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::jle(t) : Asm::jg(t));  break;
     case rtl::Bbranch::JGE:
     case rtl::Bbranch::JNL:
-      append(Asm::jl(label_translate(bb.fail)));
-      break;
+      append(negate ? Asm::jl(t) : Asm::jge(t));  break;
     }
-    append(Asm::jmp(label_translate(bb.succ)));
+    // clang-format on
+    append(Asm::jmp(label_translate(other)));
   }
 
   void visit(rtl::Call const &c) override {
@@ -214,6 +395,15 @@ public:
     Pseudo ret = lookup(c.ret);
     append(Asm::movq(Pseudo{reg::rax}, ret));
     append(Asm::jmp(label_translate(c.succ)));*/
+    if (c.func == "bx_print_int")
+      print_int_inline(c.succ);
+    else if (c.func == "bx_print_bool")
+      print_bool_inline(c.succ);
+    else if (c.func == "bx_alloc" || c.func == "bx_alloc_refs") {
+      alloc_inline(c.succ, c.func == "bx_alloc_refs");
+      // the collector walks the stack from the frame of the caller
+      append(Asm::movq(Pseudo{reg::rbp}, Pseudo{reg::rsi}));
+    }
     append(Asm::call(std::string{c.func}));
     append(Asm::jmp(label_translate(c.succ)));
   }
@@ -358,21 +548,86 @@ public:
   }
 
   ////////////////////////////////// /////////////////////
+
+  void visit(rtl::Count const &cnt) override {
+    append(Asm::incq(std::string{profile::counters_symbol} + '+' +
+                         std::to_string(8 * cnt.counter),
+                     Pseudo{reg::rip}));
+    append(Asm::jmp(label_translate(cnt.succ)));
+  }
 };
 
-std::vector<AsmProgram> rtl_to_asm(rtl::Program const &prog) {
-  std::vector<AsmProgram> p;
-  for (auto const &c : prog) {
+std::vector<AsmProgram> rtl_to_asm(rtl::Program const &prog,
+                                   sched::Scheduler &sched) {
+  std::vector<AsmProgram> p(prog.size());
+  sched::parallel_for(sched, static_cast<int>(prog.size()), [&](int i) {
+    auto const &c = prog[i];
     InstrCompiler icomp{c.name};
-    for (auto const &l : c.schedule) {
+    icomp.number_pseudos(c);
+    auto const &order = c.code_order();
+    for (std::size_t k = 0; k < order.size(); k++) {
+      auto const &l = order[k];
       icomp.append_label(l);
+      icomp.next = k + 1 < order.size() ? order[k + 1] : rtl::Label{-1};
       // std::unique_ptr<const bx::rtl::Instr> tmp = new
       // bx::rtl::Instr{*c.body.find(l)->second};
       c.body.find(l)->second->accept(icomp);
     }
-    p.push_back(icomp.finalize());
-  }
+    p[i] = icomp.finalize();
+  });
   return p;
 }
 
+AsmProgram globals_to_asm(std::map<std::string, int> const &globals) {
+  AsmProgram prog;
+  for (auto const &glb : globals) {
+    prog.push_back(Asm::globl(glb.first));
+    prog.push_back(Asm::data());
+    prog.push_back(Asm::align(8));
+    prog.push_back(Asm::set_label(glb.first));
+    prog.push_back(Asm::quad(glb.second));
+  }
+  return prog;
+}
+
+AsmProgram counters_to_asm(std::string const &symbol, std::size_t n) {
+  AsmProgram prog;
+  prog.push_back(Asm::globl(symbol));
+  prog.push_back(Asm::data());
+  prog.push_back(Asm::align(8));
+  prog.push_back(Asm::set_label(symbol));
+  for (std::size_t i = 0; i < n; i++)
+    prog.push_back(Asm::quad(0));
+  return prog;
+}
+
+AsmProgram stackmaps_to_asm(rtl::Program const &prog,
+                             std::vector<std::string> const &globals,
+                             std::string const &entry) {
+  AsmProgram maps;
+  auto quad = [&](auto const &v) { maps.push_back(Asm::quad(v)); };
+  maps.push_back(Asm::globl(gc::stackmaps_symbol));
+  maps.push_back(Asm::data());
+  maps.push_back(Asm::align(8));
+  maps.push_back(Asm::set_label(gc::stackmaps_symbol));
+  quad(static_cast<int64_t>(globals.size()));
+  for (auto const &g : globals)
+    quad(g);
+  quad(static_cast<int64_t>(prog.size()));
+  for (auto const &c : prog) {
+    InstrCompiler icomp{c.name};
+    icomp.number_pseudos(c);
+    std::set<int> slots{c.frame_roots.begin(), c.frame_roots.end()};
+    for (auto const &r : c.roots)
+      if (int slot = icomp.slot_of(r))
+        slots.insert(slot);
+    quad(c.name);
+    quad(int64_t{c.name == entry});
+    quad(static_cast<int64_t>(slots.size()));
+    for (int slot : slots)
+      quad(int64_t{slot});
+  }
+  return maps;
+}
+
 } // namespace bx
@@ -1,12 +1,31 @@
 #pragma once
 
+#include <map>
+#include <string>
+
 #include "amd64.h"
 #include "rtl.h"
+#include "scheduler.h"
 
 namespace bx {
 
 using AsmProgram = std::vector<std::unique_ptr<amd64::Asm>>;
 
-std::vector<AsmProgram> rtl_to_asm(rtl::Program const &prog);
+std::vector<AsmProgram> rtl_to_asm(rtl::Program const &prog,
+                                   sched::Scheduler &sched);
+
+/** The .data section holding the global variables */
+AsmProgram globals_to_asm(std::map<std::string, int> const &globals);
+
+/** The .data section holding n zeroed profile counters at symbol */
+AsmProgram counters_to_asm(std::string const &symbol, std::size_t n);
+
+/**
+ * The .data section holding the stack maps of prog for the garbage
+ * collector (see gc.h), given its global variables that may hold pointers
+ */
+AsmProgram stackmaps_to_asm(rtl::Program const &prog,
+                            std::vector<std::string> const &globals,
+                            std::string const &entry = "main");
 
 } // namespace bx
\ No newline at end of file
@@ -0,0 +1,641 @@
+/**
+ * This file interprets RTL programs
+ *
+ * Classes:
+ *
+ *     bx::interp::Decoder:
+ *         A visitor that translates rtl::Instr into the flat form run by
+ *         the interpreter
+ *
+ *  Functions
+ *
+ *     Stats bx::interp::run(rtl::Program const &, ...)
+ *         The interpreter loop
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "amd64.h"
+#include "bxrt.h"
+#include "profile.h"
+#include "rtl_interp.h"
+
+namespace bx {
+namespace interp {
+
+namespace {
+
+// clang-format off
+/** The register file; ZERO stands for %rip and always holds 0 */
+enum Reg : int32_t {
+  RAX, RBX, RCX, RDX, RBP, RSI, RDI, RSP,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  ZERO, NUM_REGS
+};
+
+/**
+ * The operations. The suffix tells where the operands are: P for a pseudo
+ * (an offset from %rbp), R for a register, I for an immediate.
+ */
+enum class Op : uint8_t {
+  MOVE_IP, COPY_PP, COPY_RP, COPY_PR,
+  ADDR_RP, ADDR_PP, LOAD_RP, LOAD_PP, STORE_PR, STORE_PP,
+  ADD, SUB, MUL, DIV, REM, SAL, SAR, AND, OR, XOR, NEG, NOT,
+  JZ, JNZ, JE, JNE, JL, JLE, JG, JGE,
+  GOTO, CALL, CALL_RT, RET, NEWFRAME, DELFRAME, PUSH, POP, COUNT
+};
+
+/** The runtime functions that can be called */
+enum Runtime : int64_t {
+  BX_PANIC, BX_PRINT_INT, BX_PRINT_BOOL, BX_ALLOC, BX_ALLOC_REFS, MALLOC,
+  MEMSET, BX_PROFILE_START, BX_GC_START
+};
+// clang-format on
+
+const std::unordered_map<std::string, Runtime> runtime_functions{
+    {"bx_panic", BX_PANIC}, {"bx_print_int", BX_PRINT_INT},
+    {"bx_print_bool", BX_PRINT_BOOL}, {"bx_alloc", BX_ALLOC},
+    {"bx_alloc_refs", BX_ALLOC_REFS}, {"malloc", MALLOC},
+    {"memset", MEMSET}, {"bx_profile_start", BX_PROFILE_START},
+    {"bx_gc_start", BX_GC_START},
+};
+
+/**
+ * A decoded instruction: `a` is the source or base operand, `b` the
+ * destination (or second argument of a branch), `imm` a constant or a
+ * displacement, `succ` and `fail` are indices into the code.
+ */
+struct Instr {
+  Op op;
+  int32_t a = 0, b = 0;
+  int64_t imm = 0;
+  int32_t succ = -1, fail = -1;
+};
+
+struct Function {
+  int32_t entry;
+  int32_t frame_size; // bytes below %rbp, 0 if there is no frame
+};
+
+constexpr std::size_t STACK_SIZE = std::size_t{8} << 20;
+
+class Decoder : public rtl::InstrVisitor {
+private:
+  std::vector<Instr> &code;
+  std::unordered_map<std::string, int32_t> const &functions;
+  std::unordered_map<std::string, int64_t> const &globals;
+  std::unordered_map<int, int32_t> rmap{};
+  int32_t locals = 0; // words of the local lists, above the slots
+  std::vector<rtl::Label> succs, fails; // of every instruction in code
+
+  /** Same numbering as InstrCompiler::lookup() in rtl_asm.cpp */
+  int32_t lookup(rtl::Pseudo r) {
+    if (rmap.find(r.id) == rmap.end())
+      rmap.insert({r.id, locals + static_cast<int32_t>(rmap.size() + 1)});
+    return -8 * rmap.at(r.id);
+  }
+
+  static int32_t machine_reg(char const *name) {
+    static const std::unordered_map<std::string, Reg> regs{
+        {amd64::reg::rax, RAX}, {amd64::reg::rbx, RBX},
+        {amd64::reg::rcx, RCX}, {amd64::reg::rdx, RDX},
+        {amd64::reg::rbp, RBP}, {amd64::reg::rsi, RSI},
+        {amd64::reg::rdi, RDI}, {amd64::reg::rsp, RSP},
+        {amd64::reg::r8, R8},   {amd64::reg::r9, R9},
+        {amd64::reg::r10, R10}, {amd64::reg::r11, R11},
+        {amd64::reg::r12, R12}, {amd64::reg::r13, R13},
+        {amd64::reg::r14, R14}, {amd64::reg::r15, R15},
+        {amd64::reg::rip, ZERO},
+    };
+    auto it = regs.find(name);
+    if (it == regs.end())
+      throw std::runtime_error(std::string{"unknown register "} + name);
+    return it->second;
+  }
+
+  int64_t global(std::string const &name) const {
+    if (name.empty())
+      return 0;
+    auto it = globals.find(name);
+    if (it == globals.end())
+      throw std::runtime_error("undefined global variable " + name);
+    return it->second;
+  }
+
+  void emit(Instr in, rtl::Label succ, rtl::Label fail = rtl::Label{-1}) {
+    code.push_back(in);
+    succs.push_back(succ);
+    fails.push_back(fail);
+  }
+
+public:
+  Decoder(std::vector<Instr> &code,
+          std::unordered_map<std::string, int32_t> const &functions,
+          std::unordered_map<std::string, int64_t> const &globals)
+      : code{code}, functions{functions}, globals{globals} {}
+
+  /** Decode a callable at the end of the code; returns its frame size */
+  int32_t decode(rtl::Callable const &cbl) {
+    auto start = code.size();
+    rmap.clear();
+    locals = cbl.locals / 8;
+    rtl::LabelMap<int32_t> index;
+    for (auto const &l : cbl.schedule)
+      for (auto const &r : rtl::pseudos(*cbl.body.at(l)))
+        lookup(r);
+    for (auto const &l : cbl.code_order()) {
+      index.insert({l, static_cast<int32_t>(code.size())});
+      cbl.body.at(l)->accept(*this);
+    }
+    auto resolve = [&](rtl::Label l) -> int32_t {
+      if (l.id < 0)
+        return -1;
+      auto it = index.find(l);
+      if (it == index.end())
+        throw std::runtime_error("undefined label in " + cbl.name);
+      return it->second;
+    };
+    for (auto i = start; i < code.size(); i++) {
+      code[i].succ = resolve(succs[i]);
+      code[i].fail = resolve(fails[i]);
+    }
+    return 8 * (locals + static_cast<int32_t>(rmap.size()));
+  }
+
+  void visit(rtl::Move const &mv) override {
+    emit({Op::MOVE_IP, 0, lookup(mv.dest), mv.source}, mv.succ);
+  }
+
+  void visit(rtl::Copy const &cp) override {
+    auto src = lookup(cp.src);
+    emit({Op::COPY_PP, src, lookup(cp.dest)}, cp.succ);
+  }
+
+  void visit(rtl::CopyMP const &cp) override {
+    emit({Op::COPY_RP, machine_reg(cp.src), lookup(cp.dest)}, cp.succ);
+  }
+
+  void visit(rtl::CopyPM const &cp) override {
+    emit({Op::COPY_PR, lookup(cp.src), machine_reg(cp.dest)}, cp.succ);
+  }
+
+  void visit(rtl::CopyAP const &cp) override {
+    auto disp = cp.goffset.empty() ? cp.offset : global(cp.goffset);
+    if (cp.pbase == rtl::discard_pr) {
+      emit({Op::ADDR_RP, machine_reg(cp.base), lookup(cp.dst), disp},
+           cp.succ);
+    } else {
+      auto base = lookup(cp.pbase);
+      emit({Op::ADDR_PP, base, lookup(cp.dst), disp}, cp.succ);
+    }
+  }
+
+  void visit(rtl::Load const &ld) override {
+    auto disp = ld.src.empty() ? ld.offset : global(ld.src);
+    if (ld.pbase == rtl::discard_pr) {
+      emit({Op::LOAD_RP, machine_reg(ld.mbase), lookup(ld.dest), disp},
+           ld.succ);
+    } else {
+      auto base = lookup(ld.pbase);
+      emit({Op::LOAD_PP, base, lookup(ld.dest), disp}, ld.succ);
+    }
+  }
+
+  void visit(rtl::Store const &st) override {
+    auto disp = st.dest.empty() ? st.offset : global(st.dest);
+    if (st.pbase == rtl::discard_pr) {
+      emit({Op::STORE_PR, lookup(st.src), machine_reg(st.mbase), disp},
+           st.succ);
+    } else {
+      auto base = lookup(st.pbase);
+      emit({Op::STORE_PP, lookup(st.src), base, disp}, st.succ);
+    }
+  }
+
+  void visit(rtl::Binop const &bo) override {
+    Op op = Op::ADD;
+    // clang-format off
+    switch (bo.opcode) {
+    case rtl::Binop::ADD: op = Op::ADD; break;
+    case rtl::Binop::SUB: op = Op::SUB; break;
+    case rtl::Binop::MUL: op = Op::MUL; break;
+    case rtl::Binop::DIV: op = Op::DIV; break;
+    case rtl::Binop::REM: op = Op::REM; break;
+    case rtl::Binop::SAL: op = Op::SAL; break;
+    case rtl::Binop::SAR: op = Op::SAR; break;
+    case rtl::Binop::AND: op = Op::AND; break;
+    case rtl::Binop::OR:  op = Op::OR;  break;
+    case rtl::Binop::XOR: op = Op::XOR; break;
+    }
+    // clang-format on
+    auto src = lookup(bo.src);
+    emit({op, src, lookup(bo.dest)}, bo.succ);
+  }
+
+  void visit(rtl::Unop const &uo) override {
+    auto op = uo.opcode == rtl::Unop::NEG ? Op::NEG : Op::NOT;
+    emit({op, 0, lookup(uo.arg)}, uo.succ);
+  }
+
+  void visit(rtl::Ubranch const &ub) override {
+    auto op = ub.opcode == rtl::Ubranch::JZ ? Op::JZ : Op::JNZ;
+    emit({op, lookup(ub.arg)}, ub.succ, ub.fail);
+  }
+
+  void visit(rtl::Bbranch const &bb) override {
+    Op op = Op::JE;
+    // clang-format off
+    switch (bb.opcode) {
+    case rtl::Bbranch::JE:  op = Op::JE;  break;
+    case rtl::Bbranch::JNE: op = Op::JNE; break;
+    case rtl::Bbranch::JL:
+    case rtl::Bbranch::JNGE: op = Op::JL; break;
+    case rtl::Bbranch::JLE:
+    case rtl::Bbranch::JNG: op = Op::JLE; break;
+    case rtl::Bbranch::JG:
+    case rtl::Bbranch::JNLE: op = Op::JG; break;
+    case rtl::Bbranch::JGE:
+    case rtl::Bbranch::JNL: op = Op::JGE; break;
+    }
+    // clang-format on
+    auto arg1 = lookup(bb.arg1);
+    emit({op, arg1, lookup(bb.arg2)}, bb.succ, bb.fail);
+  }
+
+  void visit(rtl::Goto const &go) override { emit({Op::GOTO}, go.succ); }
+
+  void visit(rtl::Call const &c) override {
+    auto fn = functions.find(c.func);
+    if (fn != functions.end()) {
+      // the entry and frame size are filled in once everything is decoded
+      emit({Op::CALL, fn->second}, c.succ);
+      return;
+    }
+    auto rt = runtime_functions.find(c.func);
+    if (rt == runtime_functions.end())
+      throw std::runtime_error("call to unknown function " + c.func);
+    emit({Op::CALL_RT, 0, 0, rt->second}, c.succ);
+  }
+
+  void visit(rtl::Return const &) override { emit({Op::RET}, {-1}); }
+
+  void visit(rtl::NewFrame const &nf) override {
+    emit({Op::NEWFRAME, 0, 0, nf.size}, nf.succ);
+  }
+
+  void visit(rtl::DelFrame const &df) override {
+    emit({Op::DELFRAME}, df.succ);
+  }
+
+  void visit(rtl::LoadParam const &lp) override {
+    emit({Op::LOAD_RP, RBP, lookup(lp.dest), lp.source * 8 + 8}, lp.succ);
+  }
+
+  void visit(rtl::Push const &p) override {
+    emit({Op::PUSH, lookup(p.dest)}, p.succ);
+  }
+
+  void visit(rtl::Pop const &p) override {
+    emit({Op::POP, 0, lookup(p.dest)}, p.succ);
+  }
+
+  void visit(rtl::Count const &cnt) override {
+    auto counter = global(profile::counters_symbol) + 8 * cnt.counter;
+    emit({Op::COUNT, 0, 0, counter}, cnt.succ);
+  }
+};
+
+inline int64_t load(int64_t addr) {
+  int64_t v;
+  std::memcpy(&v, reinterpret_cast<void *>(addr), sizeof v);
+  return v;
+}
+
+inline void store(int64_t addr, int64_t v) {
+  std::memcpy(reinterpret_cast<void *>(addr), &v, sizeof v);
+}
+
+/**
+ * The memory the program may access: the stack, the globals and the blocks
+ * it allocated. Invalid accesses are reported instead of crashing the
+ * compiler.
+ */
+class Memory {
+  std::map<int64_t, int64_t> blocks; // start -> end
+
+public:
+  void add(void const *start, std::size_t size) {
+    auto s = reinterpret_cast<int64_t>(start);
+    blocks[s] = s + static_cast<int64_t>(size);
+  }
+
+  /** Check that the size bytes at addr can be accessed */
+  int64_t check(int64_t addr, int64_t size = 8) const {
+    auto it = blocks.upper_bound(addr);
+    if (it == blocks.begin() || size < 0 || addr + size > std::prev(it)->second)
+      throw std::runtime_error("invalid memory access");
+    return addr;
+  }
+};
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &out, Stats const &stats) {
+  return out << stats.instructions << " instructions, " << stats.calls
+             << " calls, " << stats.runtime_calls << " runtime calls";
+}
+
+Stats run(rtl::Program const &prog, std::map<std::string, int> const &globals,
+          std::string const &entry) {
+  // Globals: one quad each, as in globals_to_asm()
+  std::vector<int64_t> global_data;
+  std::unordered_map<std::string, int64_t> global_addr;
+  for (auto const &glb : globals)
+    global_data.push_back(glb.second);
+  std::size_t k = 0;
+  for (auto const &glb : globals)
+    global_addr[glb.first] = reinterpret_cast<int64_t>(&global_data[k++]);
+
+  // The profile counters, if the program is instrumented
+  std::size_t num_counters = 0;
+  for (auto const &cbl : prog)
+    for (auto const &in : cbl.body)
+      if (auto cnt = dynamic_cast<rtl::Count const *>(in.second))
+        num_counters =
+            std::max(num_counters, static_cast<std::size_t>(cnt->counter) + 1);
+  std::vector<int64_t> counters(num_counters);
+  global_addr[profile::counters_symbol] =
+      reinterpret_cast<int64_t>(counters.data());
+
+  // Decode
+  std::unordered_map<std::string, int32_t> fn_index;
+  for (auto const &cbl : prog)
+    fn_index.emplace(cbl.name, static_cast<int32_t>(fn_index.size()));
+  std::vector<Instr> code;
+  std::vector<Function> functions;
+  Decoder decoder{code, fn_index, global_addr};
+  for (auto const &cbl : prog) {
+    auto entry_pc = static_cast<int32_t>(code.size());
+    functions.push_back({entry_pc, decoder.decode(cbl)});
+    if (code.size() == static_cast<std::size_t>(entry_pc))
+      throw std::runtime_error("empty callable " + cbl.name);
+  }
+  for (auto &in : code)
+    if (in.op == Op::CALL) {
+      auto const &fn = functions[in.a];
+      in.a = fn.entry;
+      in.b = fn.frame_size;
+    }
+  auto main_fn = fn_index.find(entry);
+  if (main_fn == fn_index.end())
+    throw std::runtime_error("cannot find the " + entry + "() procedure");
+
+  // The stack, aligned like a real one
+  std::vector<int64_t> stack(STACK_SIZE / 8 + 2);
+  auto stack_lo = reinterpret_cast<int64_t>(stack.data());
+  auto stack_hi =
+      (stack_lo + static_cast<int64_t>(STACK_SIZE)) & ~int64_t{15};
+  Memory mem;
+  mem.add(stack.data(), stack.size() * 8);
+  mem.add(global_data.data(), global_data.size() * 8);
+  mem.add(counters.data(), counters.size() * 8);
+
+  int64_t r[NUM_REGS] = {};
+  Stats stats;
+  auto pseudo = [&r](int32_t off) -> int64_t & {
+    return *reinterpret_cast<int64_t *>(r[RBP] + off);
+  };
+  auto push = [&](int64_t v) {
+    r[RSP] -= 8;
+    if (r[RSP] < stack_lo)
+      throw std::runtime_error("stack overflow");
+    store(r[RSP], v);
+  };
+  auto pop = [&] {
+    auto v = load(r[RSP]);
+    r[RSP] += 8;
+    return v;
+  };
+  // the frame pointer can be overwritten through the address of a variable
+  auto check_frame = [&] {
+    if (r[RBP] < stack_lo || r[RBP] > stack_hi || r[RSP] < stack_lo ||
+        r[RSP] > stack_hi)
+      throw std::runtime_error("corrupted frame pointer");
+  };
+  auto enter = [&](Function const &fn) {
+    stats.calls++;
+    if (fn.frame_size > 0) {
+      push(r[RBP]);
+      r[RBP] = r[RSP];
+      r[RSP] -= fn.frame_size;
+      if (r[RSP] < stack_lo)
+        throw std::runtime_error("stack overflow");
+    }
+    return fn.entry;
+  };
+
+  // Call the entry as if from crt0: the return address -1 stops the loop
+  r[RSP] = r[RBP] = stack_hi;
+  push(-1);
+  int32_t pc = enter(functions[main_fn->second]);
+  std::fflush(stdout);
+  while (pc >= 0) {
+    Instr const &in = code[pc];
+    stats.instructions++;
+    pc = in.succ;
+    switch (in.op) {
+    case Op::MOVE_IP:
+      pseudo(in.b) = in.imm;
+      break;
+    case Op::COPY_PP:
+      pseudo(in.b) = pseudo(in.a);
+      break;
+    case Op::COPY_RP:
+      pseudo(in.b) = r[in.a];
+      break;
+    case Op::COPY_PR:
+      r[in.b] = pseudo(in.a);
+      if (in.b == RBP || in.b == RSP)
+        check_frame();
+      break;
+    case Op::ADDR_RP:
+      pseudo(in.b) = r[in.a] + in.imm;
+      break;
+    case Op::ADDR_PP:
+      pseudo(in.b) = pseudo(in.a) + in.imm;
+      break;
+    case Op::LOAD_RP:
+      pseudo(in.b) = load(mem.check(r[in.a] + in.imm));
+      break;
+    case Op::LOAD_PP:
+      pseudo(in.b) = load(mem.check(pseudo(in.a) + in.imm));
+      break;
+    case Op::STORE_PR:
+      store(mem.check(r[in.b] + in.imm), pseudo(in.a));
+      break;
+    case Op::STORE_PP:
+      store(mem.check(pseudo(in.b) + in.imm), pseudo(in.a));
+      break;
+    // arithmetic wraps around as on the machine
+    case Op::ADD:
+      pseudo(in.b) = static_cast<int64_t>(static_cast<uint64_t>(pseudo(in.b)) +
+                                          static_cast<uint64_t>(pseudo(in.a)));
+      break;
+    case Op::SUB:
+      pseudo(in.b) = static_cast<int64_t>(static_cast<uint64_t>(pseudo(in.b)) -
+                                          static_cast<uint64_t>(pseudo(in.a)));
+      break;
+    case Op::MUL:
+      pseudo(in.b) = static_cast<int64_t>(static_cast<uint64_t>(pseudo(in.b)) *
+                                          static_cast<uint64_t>(pseudo(in.a)));
+      break;
+    case Op::DIV:
+    case Op::REM: {
+      int64_t d = pseudo(in.a), n = pseudo(in.b);
+      if (d == 0 || (d == -1 && n == INT64_MIN))
+        throw std::runtime_error("arithmetic exception in division");
+      pseudo(in.b) = in.op == Op::DIV ? n / d : n % d;
+    } break;
+    case Op::SAL:
+      pseudo(in.b) = static_cast<int64_t>(static_cast<uint64_t>(pseudo(in.b))
+                                          << (pseudo(in.a) & 63));
+      break;
+    case Op::SAR:
+      pseudo(in.b) >>= (pseudo(in.a) & 63);
+      break;
+    case Op::AND:
+      pseudo(in.b) &= pseudo(in.a);
+      break;
+    case Op::OR:
+      pseudo(in.b) |= pseudo(in.a);
+      break;
+    case Op::XOR:
+      pseudo(in.b) ^= pseudo(in.a);
+      break;
+    case Op::NEG:
+      pseudo(in.b) =
+          static_cast<int64_t>(-static_cast<uint64_t>(pseudo(in.b)));
+      break;
+    case Op::NOT:
+      pseudo(in.b) = ~pseudo(in.b);
+      break;
+    case Op::JZ:
+      if (pseudo(in.a) != 0)
+        pc = in.fail;
+      break;
+    case Op::JNZ:
+      if (pseudo(in.a) == 0)
+        pc = in.fail;
+      break;
+    case Op::JE:
+      if (!(pseudo(in.a) == pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::JNE:
+      if (!(pseudo(in.a) != pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::JL:
+      if (!(pseudo(in.a) < pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::JLE:
+      if (!(pseudo(in.a) <= pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::JG:
+      if (!(pseudo(in.a) > pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::JGE:
+      if (!(pseudo(in.a) >= pseudo(in.b)))
+        pc = in.fail;
+      break;
+    case Op::GOTO:
+      break;
+    case Op::CALL:
+      push(pc);
+      pc = enter({in.a, in.b});
+      break;
+    case Op::CALL_RT:
+      stats.runtime_calls++;
+      switch (static_cast<Runtime>(in.imm)) {
+      case BX_PANIC:
+        bx_panic();
+        break;
+      case BX_PRINT_INT:
+        bx_print_int(r[RDI]);
+        break;
+      case BX_PRINT_BOOL:
+        bx_print_bool(r[RDI]);
+        break;
+      case BX_ALLOC:
+      case BX_ALLOC_REFS: {
+        // no frame: the interpreted frames have no stack maps, so the heap
+        // is not collected
+        void *block = bx_alloc(r[RDI], nullptr);
+        mem.add(block, static_cast<std::size_t>(r[RDI]));
+        r[RAX] = reinterpret_cast<int64_t>(block);
+      } break;
+      case MALLOC: {
+        auto size = static_cast<std::size_t>(r[RDI]);
+        void *block = std::malloc(size);
+        if (block)
+          mem.add(block, size);
+        r[RAX] = reinterpret_cast<int64_t>(block);
+      } break;
+      case BX_PROFILE_START:
+        bx_profile_start(reinterpret_cast<int64_t *>(r[RDI]), r[RSI], r[RDX]);
+        break;
+      case BX_GC_START:
+        break;
+      case MEMSET:
+        r[RAX] = reinterpret_cast<int64_t>(
+            std::memset(reinterpret_cast<void *>(mem.check(r[RDI], r[RDX])),
+                        static_cast<int>(r[RSI]),
+                        static_cast<std::size_t>(r[RDX])));
+        break;
+      }
+      break;
+    case Op::RET: {
+      auto ret = pop();
+      if (ret < -1 || ret >= static_cast<int64_t>(code.size()))
+        throw std::runtime_error("corrupted return address");
+      pc = static_cast<int32_t>(ret);
+    } break;
+    case Op::NEWFRAME:
+      push(r[RBP]);
+      r[RBP] = r[RSP];
+      r[RSP] -= in.imm;
+      break;
+    case Op::DELFRAME:
+      r[RSP] = r[RBP];
+      r[RBP] = pop();
+      check_frame();
+      break;
+    case Op::PUSH:
+      push(pseudo(in.a));
+      break;
+    case Op::POP:
+      pseudo(in.b) = pop();
+      break;
+    case Op::COUNT:
+      store(in.imm, load(in.imm) + 1);
+      break;
+    }
+  }
+  bx_profile_dump(); // the counters go away with this frame
+  bx_flush();
+  return stats;
+}
+
+} // namespace interp
+} // namespace bx
@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * A built-in interpreter for RTL programs, used as a reference for the
+ * generated code and to count the instructions a program executes.
+ *
+ * The callables are decoded into one flat array of instructions whose
+ * successors are array indices. The interpreter models the machine the way
+ * rtl_asm.cpp compiles to it: pseudos live in the frame at -8*n(%rbp) in
+ * the order rtl_asm.cpp assigns them, calls push a return address on a
+ * simulated stack, and the machine registers used by the calling
+ * convention are kept in a register file. The heap is the one of the
+ * compiler itself, and is not collected: bx_alloc, memset and the print
+ * functions of the runtime (bxrt.h) are called directly.
+ */
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "rtl.h"
+
+namespace bx {
+namespace interp {
+
+struct Stats {
+  uint64_t instructions = 0; // RTL instructions executed
+  uint64_t calls = 0;        // calls to callables of the program
+  uint64_t runtime_calls = 0;
+};
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
+
+/**
+ * Run the entry procedure of prog, with the global variables initialized
+ * as given. Errors that would crash the compiled program (invalid memory
+ * access, division by zero, stack overflow) raise std::runtime_error.
+ */
+Stats run(rtl::Program const &prog, std::map<std::string, int> const &globals,
+          std::string const &entry = "main");
+
+} // namespace interp
+} // namespace bx
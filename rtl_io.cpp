@@ -0,0 +1,561 @@
+/**
+ * The format of an RTL program: the 6 bytes "BXRTL" 0 and the version of
+ * the format, the string table, the number of global variables and their
+ * names and initial values, then the number of callables and the callables.
+ * A callable is its name, its numbers of labels and of pseudos, enter,
+ * leave, the input pseudos, the output pseudo, the instructions of its
+ * schedule (each preceded by its label), its layout, its roots and frame
+ * roots, and the size of its locals. An instruction is its kind, in the
+ * order of InstrVisitor, then its fields in the order of its constructor.
+ *
+ * Unsigned numbers are unsigned LEB128, and signed ones zigzag-encoded
+ * first so that small negative offsets stay short. Every name (of a
+ * callable, a global, a register) is written once, in the string table, as
+ * its length and bytes, and elsewhere as its index in the table. A label or
+ * pseudo is its index in the callable plus one, with 0 for the label -1
+ * and the discarded pseudo; a machine register is its index in the table
+ * plus one, with 0 for none.
+ */
+
+#include "rtl_io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "amd64.h"
+#include "encoding.h"
+
+namespace bx {
+namespace rtl {
+
+namespace {
+
+constexpr char magic[6] = {'B', 'X', 'R', 'T', 'L', 0};
+constexpr uint64_t format_version = 1;
+
+enum Kind : uint64_t {
+  // clang-format off
+  MOVE, COPY, COPY_MP, COPY_PM, COPY_AP, LOAD, STORE, BINOP, UNOP, BBRANCH,
+  UBRANCH, CALL, RETURN, GOTO, NEW_FRAME, DEL_FRAME, LOAD_PARAM, PUSH, POP,
+  COUNT
+  // clang-format on
+};
+
+char const *const machine_regs[] = {
+    // clang-format off
+    amd64::reg::rax, amd64::reg::rbx, amd64::reg::rcx, amd64::reg::rdx,
+    amd64::reg::rbp, amd64::reg::rsi, amd64::reg::rdi, amd64::reg::rsp,
+    amd64::reg::r8,  amd64::reg::r9,  amd64::reg::r10, amd64::reg::r11,
+    amd64::reg::r12, amd64::reg::r13, amd64::reg::r14, amd64::reg::r15,
+    amd64::reg::rip, amd64::reg::rflags,
+    // clang-format on
+};
+
+/** Encodes into memory, as the string table must come first */
+class Encoder {
+  std::string body;
+  std::vector<std::string> table;
+  std::unordered_map<std::string, uint64_t> index;
+  std::unordered_map<char const *, uint64_t> reg_index;
+
+  uint64_t intern(std::string const &s) {
+    auto it = index.find(s);
+    if (it != index.end())
+      return it->second;
+    table.push_back(s);
+    return index[s] = table.size() - 1;
+  }
+
+public:
+  Encoder() { intern(""); } // the most frequent string, see str()
+
+  void num(uint64_t v) { encoding::put_uleb(body, v); }
+  void snum(int64_t v) {
+    num((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+  }
+  void str(std::string const &s) { num(s.empty() ? 0 : intern(s)); }
+  void reg(char const *r) {
+    if (!r) {
+      num(0);
+      return;
+    }
+    // the registers are constants of amd64.h: look them up by address
+    auto it = reg_index.find(r);
+    if (it == reg_index.end())
+      it = reg_index.insert({r, intern(r)}).first;
+    num(it->second + 1);
+  }
+
+  void finish(std::ostream &out) const {
+    std::string head{magic, sizeof magic};
+    encoding::put_uleb(head, format_version);
+    encoding::put_uleb(head, table.size());
+    for (auto const &s : table) {
+      encoding::put_uleb(head, s.size());
+      head += s;
+    }
+    out.write(head.data(), static_cast<std::streamsize>(head.size()));
+    out.write(body.data(), static_cast<std::streamsize>(body.size()));
+  }
+};
+
+class Decoder {
+  std::string const &in;
+  std::size_t pos = 0;
+  std::vector<std::string> table;
+  std::vector<char const *> regs; // of the strings that name one
+
+public:
+  explicit Decoder(std::string const &in) : in{in} {
+    if (in.compare(0, sizeof magic, magic, sizeof magic) != 0)
+      throw std::runtime_error("not an RTL file");
+    pos = sizeof magic;
+    auto version = num();
+    if (version != format_version)
+      throw std::runtime_error("RTL format version " +
+                               std::to_string(version) + " (expected " +
+                               std::to_string(format_version) + ")");
+    table.resize(count());
+    regs.resize(table.size());
+    for (std::size_t i = 0; i < table.size(); i++) {
+      auto n = num();
+      if (n > in.size() - pos)
+        throw std::runtime_error("truncated RTL");
+      table[i] = in.substr(pos, n);
+      pos += n;
+      for (auto r : machine_regs)
+        if (table[i] == r)
+          regs[i] = r;
+    }
+  }
+
+  uint64_t num() {
+    return encoding::get_uleb(in, pos, "truncated RTL",
+                              "bad number in the RTL");
+  }
+
+  int64_t snum() {
+    auto v = num();
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  }
+
+  /** A number in [0, bound] */
+  uint64_t index(uint64_t bound) {
+    auto v = num();
+    if (v > bound)
+      throw std::runtime_error("bad number in the RTL");
+    return v;
+  }
+
+  /**
+   * A number of things that each take at least a byte of what is left, so
+   * that a corrupt count cannot make the reader allocate much more than the
+   * size of the input
+   */
+  uint64_t count() {
+    return index(std::min<uint64_t>(in.size() - pos, INT32_MAX));
+  }
+
+  std::string const &str() {
+    if (table.empty())
+      throw std::runtime_error("bad string in the RTL");
+    return table[index(table.size() - 1)];
+  }
+
+  char const *reg() {
+    auto k = index(table.size());
+    if (k == 0)
+      return nullptr;
+    if (!regs[k - 1])
+      throw std::runtime_error("unknown register " + table[k - 1] +
+                               " in the RTL");
+    return regs[k - 1];
+  }
+
+  bool at_end() const { return pos == in.size(); }
+};
+
+/**
+ * Numbers the ids of the labels or pseudos of a callable from 1, in their
+ * order. The ids are numbered from 0 in each callable (see rtl::Callable),
+ * so they are usually numbered through a table indexed by id rather than
+ * by sorting them.
+ */
+class Numbering {
+  std::vector<int> ids;
+  int lo = 0;
+  std::vector<uint32_t> table; // by id - lo, when dense
+  uint64_t count = 0;
+
+public:
+  void clear() { ids.clear(); }
+  void add(int id) { ids.push_back(id); }
+
+  void number() {
+    table.clear();
+    count = 0;
+    if (ids.empty())
+      return;
+    auto [min, max] = std::minmax_element(ids.begin(), ids.end());
+    lo = *min;
+    auto range = static_cast<std::size_t>(*max) - lo + 1;
+    if (range <= 4 * ids.size() + 64) {
+      table.assign(range, 0);
+      for (auto id : ids)
+        table[id - lo] = 1;
+      for (auto &k : table)
+        if (k)
+          k = static_cast<uint32_t>(++count);
+      return;
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    count = ids.size();
+  }
+
+  uint64_t size() const { return count; }
+
+  /** The number of id, or 0 for a negative one */
+  uint64_t operator()(int64_t id) const {
+    if (id < 0)
+      return 0;
+    if (!table.empty())
+      return table[id - lo];
+    return std::lower_bound(ids.begin(), ids.end(), id) - ids.begin() + 1;
+  }
+};
+
+/**
+ * Writes a callable. Its labels and pseudos are numbered in the order of
+ * their ids, which is only known once all of them are seen, so the fields
+ * after its name and its numbers of labels and pseudos are collected first.
+ */
+class CallableWriter : public InstrVisitor {
+  enum Type : uint8_t { NUM, SNUM, LABEL, PSEUDO, STR, REG };
+  struct Field {
+    Type type;
+    int64_t value;
+    void const *ptr; // the std::string of STR, the register of REG
+  };
+  std::vector<Field> fields;
+  Numbering labels, pseudos;
+
+  void num(uint64_t v) { fields.push_back({NUM, static_cast<int64_t>(v), {}}); }
+  void snum(int64_t v) { fields.push_back({SNUM, v, {}}); }
+  void l(Label x) {
+    fields.push_back({LABEL, x.id, {}});
+    if (x.id >= 0)
+      labels.add(x.id);
+  }
+  void p(Pseudo x) {
+    fields.push_back({PSEUDO, x.id, {}});
+    if (x != discard_pr)
+      pseudos.add(x.id);
+  }
+  void str(std::string const &s) { fields.push_back({STR, 0, &s}); }
+  void reg(char const *r) { fields.push_back({REG, 0, r}); }
+
+public:
+  void write(Callable const &cbl, Encoder &e) {
+    fields.clear();
+    labels.clear();
+    pseudos.clear();
+    l(cbl.enter);
+    l(cbl.leave);
+    num(cbl.input_regs.size());
+    for (auto const &r : cbl.input_regs)
+      p(r);
+    p(cbl.output_reg);
+    num(cbl.schedule.size());
+    for (auto const &lab : cbl.schedule) {
+      l(lab);
+      cbl.body.at(lab)->accept(*this);
+    }
+    num(cbl.layout.size());
+    for (auto const &lab : cbl.layout)
+      l(lab);
+    num(cbl.roots.size());
+    for (auto const &r : cbl.roots)
+      p(r);
+    num(cbl.frame_roots.size());
+    for (auto const &r : cbl.frame_roots)
+      snum(r);
+    snum(cbl.locals);
+    labels.number();
+    pseudos.number();
+
+    e.str(cbl.name);
+    e.num(labels.size());
+    e.num(pseudos.size());
+    for (auto const &f : fields)
+      switch (f.type) {
+      case NUM:
+        e.num(static_cast<uint64_t>(f.value));
+        break;
+      case SNUM:
+        e.snum(f.value);
+        break;
+      case LABEL:
+        e.num(labels(f.value));
+        break;
+      case PSEUDO:
+        e.num(pseudos(f.value));
+        break;
+      case STR:
+        e.str(*static_cast<std::string const *>(f.ptr));
+        break;
+      case REG:
+        e.reg(static_cast<char const *>(f.ptr));
+        break;
+      }
+  }
+
+  void visit(Move const &i) override {
+    num(MOVE), snum(i.source), p(i.dest), l(i.succ);
+  }
+  void visit(Copy const &i) override { num(COPY), p(i.src), p(i.dest), l(i.succ); }
+  void visit(CopyMP const &i) override {
+    num(COPY_MP), reg(i.src), p(i.dest), l(i.succ);
+  }
+  void visit(CopyPM const &i) override {
+    num(COPY_PM), p(i.src), reg(i.dest), l(i.succ);
+  }
+  void visit(CopyAP const &i) override {
+    num(COPY_AP), str(i.goffset), snum(i.offset), reg(i.base), p(i.pbase),
+        p(i.dst), l(i.succ);
+  }
+  void visit(Load const &i) override {
+    num(LOAD), str(i.src), snum(i.offset), p(i.dest), p(i.pbase),
+        reg(i.mbase), l(i.succ);
+  }
+  void visit(Store const &i) override {
+    num(STORE), p(i.src), str(i.dest), p(i.pbase), reg(i.mbase),
+        snum(i.offset), l(i.succ);
+  }
+  void visit(Binop const &i) override {
+    num(BINOP), num(i.opcode), p(i.src), p(i.dest), l(i.succ);
+  }
+  void visit(Unop const &i) override {
+    num(UNOP), num(i.opcode), p(i.arg), l(i.succ);
+  }
+  void visit(Bbranch const &i) override {
+    num(BBRANCH), num(i.opcode), p(i.arg1), p(i.arg2), l(i.succ), l(i.fail);
+  }
+  void visit(Ubranch const &i) override {
+    num(UBRANCH), num(i.opcode), p(i.arg), l(i.succ), l(i.fail);
+  }
+  void visit(Call const &i) override {
+    num(CALL), str(i.func), snum(i.Nargs), l(i.succ);
+  }
+  void visit(Return const &) override { num(RETURN); }
+  void visit(Goto const &i) override { num(GOTO), l(i.succ); }
+  void visit(NewFrame const &i) override {
+    num(NEW_FRAME), l(i.succ), snum(i.size);
+  }
+  void visit(DelFrame const &i) override { num(DEL_FRAME), l(i.succ); }
+  void visit(LoadParam const &i) override {
+    num(LOAD_PARAM), snum(i.source), p(i.dest), l(i.succ);
+  }
+  void visit(Push const &i) override { num(PUSH), p(i.dest), l(i.succ); }
+  void visit(Pop const &i) override { num(POP), p(i.dest), l(i.succ); }
+  void visit(Count const &i) override {
+    num(COUNT), snum(i.counter), l(i.succ);
+  }
+};
+
+class CallableReader {
+  Decoder &d;
+  uint64_t num_labels, num_pseudos;
+
+  Label l() {
+    auto k = d.index(num_labels);
+    return Label{static_cast<int>(k) - 1};
+  }
+  Pseudo p() {
+    auto k = d.index(num_pseudos);
+    return k == 0 ? discard_pr : Pseudo{static_cast<int>(k) - 1};
+  }
+  int i32() { return static_cast<int>(d.snum()); }
+
+  InstrPtr instr() {
+    switch (d.num()) {
+    case MOVE: {
+      auto source = d.snum();
+      auto dest = p();
+      return Move::make(source, dest, l());
+    }
+    case COPY: {
+      auto src = p();
+      auto dest = p();
+      return Copy::make(src, dest, l());
+    }
+    case COPY_MP: {
+      auto src = d.reg();
+      auto dest = p();
+      return CopyMP::make(src, dest, l());
+    }
+    case COPY_PM: {
+      auto src = p();
+      auto dest = d.reg();
+      return CopyPM::make(src, dest, l());
+    }
+    case COPY_AP: {
+      auto const &goffset = d.str();
+      auto offset = i32();
+      auto base = d.reg();
+      auto pbase = p();
+      auto dst = p();
+      return CopyAP::make(goffset, offset, base, pbase, dst, l());
+    }
+    case LOAD: {
+      auto const &src = d.str();
+      auto offset = i32();
+      auto dest = p();
+      auto pbase = p();
+      auto mbase = d.reg();
+      return Load::make(src, offset, dest, pbase, mbase, l());
+    }
+    case STORE: {
+      auto src = p();
+      auto const &dest = d.str();
+      auto pbase = p();
+      auto mbase = d.reg();
+      auto offset = i32();
+      return Store::make(src, dest, pbase, mbase, offset, l());
+    }
+    case BINOP: {
+      auto code = static_cast<Binop::Code>(d.index(Binop::XOR));
+      auto src = p();
+      auto dest = p();
+      return Binop::make(code, src, dest, l());
+    }
+    case UNOP: {
+      auto code = static_cast<Unop::Code>(d.index(Unop::NOT));
+      auto arg = p();
+      return Unop::make(code, arg, l());
+    }
+    case BBRANCH: {
+      auto code = static_cast<Bbranch::Code>(d.index(Bbranch::JNGE));
+      auto arg1 = p();
+      auto arg2 = p();
+      auto succ = l();
+      return Bbranch::make(code, arg1, arg2, succ, l());
+    }
+    case UBRANCH: {
+      auto code = static_cast<Ubranch::Code>(d.index(Ubranch::JNZ));
+      auto arg = p();
+      auto succ = l();
+      return Ubranch::make(code, arg, succ, l());
+    }
+    case CALL: {
+      auto const &func = d.str();
+      auto nargs = i32();
+      return Call::make(func, nargs, l());
+    }
+    case RETURN:
+      return Return::make();
+    case GOTO:
+      return Goto::make(l());
+    case NEW_FRAME: {
+      auto succ = l();
+      return NewFrame::make(succ, i32());
+    }
+    case DEL_FRAME:
+      return DelFrame::make(l());
+    case LOAD_PARAM: {
+      auto source = d.snum();
+      auto dest = p();
+      return LoadParam::make(source, dest, l());
+    }
+    case PUSH: {
+      auto dest = p();
+      return Push::make(dest, l());
+    }
+    case POP: {
+      auto dest = p();
+      return Pop::make(dest, l());
+    }
+    case COUNT: {
+      auto counter = i32();
+      return Count::make(counter, l());
+    }
+    default:
+      throw std::runtime_error("unknown instruction in the RTL");
+    }
+  }
+
+public:
+  explicit CallableReader(Decoder &d) : d{d} {}
+
+  Callable read() {
+    Callable cbl{d.str()};
+    num_labels = d.count();
+    num_pseudos = d.count();
+    cbl.last_label = static_cast<int>(num_labels);
+    cbl.last_pseudo = static_cast<int>(num_pseudos);
+    cbl.enter = l();
+    cbl.leave = l();
+    for (auto n = d.count(); n > 0; n--)
+      cbl.input_regs.push_back(p());
+    cbl.output_reg = p();
+    auto size = d.count();
+    cbl.schedule.reserve(size);
+    cbl.body.reserve(size);
+    for (; size > 0; size--) {
+      auto lab = l();
+      if (!cbl.body.emplace(lab, instr()).second)
+        throw std::runtime_error("repeated label in the RTL");
+      cbl.schedule.push_back(lab);
+    }
+    for (auto n = d.count(); n > 0; n--)
+      cbl.layout.push_back(l());
+    for (auto n = d.count(); n > 0; n--)
+      cbl.roots.push_back(p());
+    for (auto n = d.count(); n > 0; n--)
+      cbl.frame_roots.push_back(i32());
+    cbl.locals = i32();
+    return cbl;
+  }
+};
+
+} // namespace
+
+void write_program(std::ostream &out, Program const &prog,
+                   std::map<std::string, int> const &globals) {
+  Encoder e;
+  e.num(globals.size());
+  for (auto const &glb : globals) {
+    e.str(glb.first);
+    e.snum(glb.second);
+  }
+  e.num(prog.size());
+  CallableWriter w;
+  for (auto const &cbl : prog)
+    w.write(cbl, e);
+  e.finish(out);
+}
+
+Program read_program(std::istream &in, std::map<std::string, int> &globals) {
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  auto buf = contents.str();
+  Decoder d{buf};
+  for (auto n = d.count(); n > 0; n--) {
+    auto const &name = d.str();
+    globals[name] = static_cast<int>(d.snum());
+  }
+  Program prog;
+  auto n = d.count();
+  prog.reserve(n);
+  for (; n > 0; n--)
+    prog.push_back(CallableReader{d}.read());
+  if (!d.at_end())
+    throw std::runtime_error("trailing bytes after the RTL");
+  return prog;
+}
+
+} // namespace rtl
+} // namespace bx
@@ -0,0 +1,37 @@
+#pragma once
+
+/**
+ * Reading and writing RTL programs in a compact binary format, for the RTL
+ * kept by the compiler: the RTL of the modules for link-time optimization
+ * (see lto.h), the RTL of the callables in the compilation cache (see
+ * cache.h), and programs run by the interpreter (bx --interp-rtl f.bxl).
+ * The format is versioned, and a file of another version is rejected.
+ *
+ * The labels and pseudos of every callable are written renumbered from 0,
+ * in the order of their numbers, and read back as fresh ones, so that
+ * callables written by separate compilations can go in one program. The
+ * relative order of the pseudos of a callable, which decides its frame
+ * layout, is kept.
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "rtl.h"
+
+namespace bx {
+namespace rtl {
+
+/** Write prog and the initial values of its global variables */
+void write_program(std::ostream &out, Program const &prog,
+                   std::map<std::string, int> const &globals);
+
+/**
+ * Read a program, adding its global variables to globals; throws
+ * std::runtime_error if in does not hold a program
+ */
+Program read_program(std::istream &in, std::map<std::string, int> &globals);
+
+} // namespace rtl
+} // namespace bx
@@ -0,0 +1,225 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace bx {
+namespace sched {
+
+namespace {
+thread_local Scheduler *current_sched = nullptr;
+thread_local int current_worker = 0;
+} // namespace
+
+Scheduler::Scheduler(int num_workers) {
+  num_workers = std::max(1, num_workers);
+  for (int i = 0; i < num_workers; i++)
+    queues.push_back(std::make_unique<Queue>());
+  for (int i = 1; i < num_workers; i++)
+    threads.emplace_back([this, i] { worker_loop(i); });
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lk{idle_lock};
+    stopping = true;
+  }
+  idle_cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void Scheduler::spawn(Task task) {
+  int self = current_sched == this ? current_worker : 0;
+  pending++;
+  {
+    std::lock_guard<std::mutex> lk{queues[self]->lock};
+    queues[self]->tasks.push_back(std::move(task));
+  }
+  queued++;
+  // taking the lock makes sure that a worker about to sleep sees the task
+  { std::lock_guard<std::mutex> lk{idle_lock}; }
+  idle_cv.notify_one();
+}
+
+bool Scheduler::pop_local(int self, Task &task) {
+  auto &q = *queues[self];
+  std::lock_guard<std::mutex> lk{q.lock};
+  if (q.tasks.empty())
+    return false;
+  task = std::move(q.tasks.back());
+  q.tasks.pop_back();
+  queued--;
+  return true;
+}
+
+bool Scheduler::steal(int self, Task &task) {
+  int n = num_workers();
+  for (int k = 1; k < n; k++) {
+    auto &q = *queues[(self + k) % n];
+    std::lock_guard<std::mutex> lk{q.lock};
+    if (q.tasks.empty())
+      continue;
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    queued--;
+    return true;
+  }
+  return false;
+}
+
+bool Scheduler::run_one(int self) {
+  Task task;
+  if (!pop_local(self, task) && !steal(self, task))
+    return false;
+  try {
+    task();
+  } catch (...) {
+    std::lock_guard<std::mutex> lk{error_lock};
+    if (!error)
+      error = std::current_exception();
+  }
+  if (--pending == 0) {
+    { std::lock_guard<std::mutex> lk{idle_lock}; }
+    idle_cv.notify_all();
+  }
+  return true;
+}
+
+void Scheduler::worker_loop(int self) {
+  current_sched = this;
+  current_worker = self;
+  while (true) {
+    if (run_one(self))
+      continue;
+    std::unique_lock<std::mutex> lk{idle_lock};
+    idle_cv.wait(lk, [this] { return stopping || queued > 0; });
+    if (stopping)
+      return;
+  }
+}
+
+void Scheduler::wait() {
+  auto saved_sched = current_sched;
+  auto saved_worker = current_worker;
+  current_sched = this;
+  current_worker = 0;
+  while (pending > 0) {
+    if (run_one(0))
+      continue;
+    std::unique_lock<std::mutex> lk{idle_lock};
+    idle_cv.wait(lk, [this] { return pending == 0 || queued > 0; });
+  }
+  current_sched = saved_sched;
+  current_worker = saved_worker;
+  std::exception_ptr e;
+  {
+    std::lock_guard<std::mutex> lk{error_lock};
+    std::swap(e, error);
+  }
+  if (e)
+    std::rethrow_exception(e);
+}
+
+void parallel_for(Scheduler &sched, int n, std::function<void(int)> fn) {
+  for (int i = 0; i < n; i++)
+    sched.spawn([&fn, i] { fn(i); });
+  sched.wait();
+}
+
+namespace {
+
+/**
+ * Tarjan's algorithm, iteratively. The components are produced callees
+ * first, i.e., in reverse topological order of the call graph.
+ */
+std::vector<std::vector<int>>
+strongly_connected(std::vector<std::vector<int>> const &succs) {
+  int n = static_cast<int>(succs.size());
+  std::vector<int> index(n, -1), low(n, 0);
+  std::vector<bool> on_stack(n, false);
+  std::vector<int> stack;
+  std::vector<std::vector<int>> comps;
+  int next_index = 0;
+  // explicit DFS stack of (node, position in its successor list)
+  std::vector<std::pair<int, std::size_t>> dfs;
+  for (int root = 0; root < n; root++) {
+    if (index[root] >= 0)
+      continue;
+    dfs.emplace_back(root, 0);
+    while (!dfs.empty()) {
+      auto &[v, pos] = dfs.back();
+      if (pos == 0 && index[v] < 0) {
+        index[v] = low[v] = next_index++;
+        stack.push_back(v);
+        on_stack[v] = true;
+      }
+      if (pos < succs[v].size()) {
+        int w = succs[v][pos++];
+        if (index[w] < 0)
+          dfs.emplace_back(w, 0);
+        else if (on_stack[w])
+          low[v] = std::min(low[v], index[w]);
+        continue;
+      }
+      if (low[v] == index[v]) {
+        std::vector<int> comp;
+        int w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          on_stack[w] = false;
+          comp.push_back(w);
+        } while (w != v);
+        comps.push_back(std::move(comp));
+      }
+      int done = v;
+      dfs.pop_back();
+      if (!dfs.empty())
+        low[dfs.back().first] = std::min(low[dfs.back().first], low[done]);
+    }
+  }
+  return comps;
+}
+
+} // namespace
+
+void bottom_up(Scheduler &sched, std::vector<std::vector<int>> const &callees,
+               std::function<void(int)> fn) {
+  auto comps = strongly_connected(callees);
+  int ncomps = static_cast<int>(comps.size());
+  std::vector<int> comp_of(callees.size());
+  for (int c = 0; c < ncomps; c++)
+    for (int v : comps[c])
+      comp_of[v] = c;
+
+  std::vector<std::vector<int>> callers(ncomps);
+  std::unique_ptr<std::atomic<int>[]> waiting{new std::atomic<int>[ncomps]};
+  std::vector<int> seen(ncomps, -1);
+  for (int c = 0; c < ncomps; c++) {
+    waiting[c] = 0;
+    for (int v : comps[c])
+      for (int w : callees[v]) {
+        int d = comp_of[w];
+        if (d == c || seen[d] == c)
+          continue;
+        seen[d] = c;
+        callers[d].push_back(c);
+        waiting[c]++;
+      }
+  }
+
+  std::function<void(int)> run_comp = [&](int c) {
+    for (int v : comps[c])
+      fn(v);
+    for (int caller : callers[c])
+      if (--waiting[caller] == 0)
+        sched.spawn([&run_comp, caller] { run_comp(caller); });
+  };
+  for (int c = 0; c < ncomps; c++)
+    if (waiting[c] == 0)
+      sched.spawn([&run_comp, c] { run_comp(c); });
+  sched.wait();
+}
+
+} // namespace sched
+} // namespace bx
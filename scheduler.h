@@ -0,0 +1,86 @@
+#pragma once
+
+/**
+ * A small work-stealing task scheduler used to run the per-callable phases
+ * of the compiler in parallel.
+ *
+ * Every worker owns a deque of tasks: it pushes and pops tasks at the back,
+ * while idle workers steal from the front of the other deques. The thread
+ * that calls wait() takes part in the work as worker 0.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bx {
+namespace sched {
+
+using Task = std::function<void()>;
+
+class Scheduler {
+public:
+  /** @param num_workers total number of workers, including the caller */
+  explicit Scheduler(int num_workers = 1);
+  ~Scheduler();
+  Scheduler(Scheduler const &) = delete;
+  Scheduler &operator=(Scheduler const &) = delete;
+
+  int num_workers() const { return static_cast<int>(queues.size()); }
+
+  /**
+   * Queue a task. When called from a running task, the task goes to the
+   * deque of the current worker.
+   */
+  void spawn(Task task);
+
+  /**
+   * Run tasks until all the spawned tasks (and the tasks they spawn) are
+   * finished. Rethrows the first exception thrown by a task, if any.
+   */
+  void wait();
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+
+  std::atomic<int> queued{0};  // tasks sitting in some deque
+  std::atomic<int> pending{0}; // tasks spawned but not finished
+  bool stopping = false;
+  std::mutex idle_lock;
+  std::condition_variable idle_cv;
+
+  std::mutex error_lock;
+  std::exception_ptr error;
+
+  bool pop_local(int self, Task &task);
+  bool steal(int self, Task &task);
+  bool run_one(int self);
+  void worker_loop(int self);
+};
+
+/** Run fn(0), ..., fn(n - 1) in parallel and wait for all of them */
+void parallel_for(Scheduler &sched, int n, std::function<void(int)> fn);
+
+/**
+ * Run fn(i) for every node i of the graph, where callees[i] lists the nodes
+ * that i depends on (typically, the callables that i calls). A node is only
+ * started once all of its callees are finished; the members of a cycle
+ * (mutual recursion) run one after the other in a single task. This is the
+ * order needed by bottom-up interprocedural passes such as inlining.
+ */
+void bottom_up(Scheduler &sched, std::vector<std::vector<int>> const &callees,
+               std::function<void(int)> fn);
+
+} // namespace sched
+} // namespace bx
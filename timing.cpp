@@ -0,0 +1,132 @@
+#include "timing.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> alloc_count{0}, alloc_bytes{0};
+
+void *counted_alloc(std::size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+double cpu_seconds() {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  auto seconds = [](timeval const &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+  return seconds(ru.ru_utime) + seconds(ru.ru_stime);
+}
+
+long peak_rss_kb() {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss; // kilobytes on Linux
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace bx {
+namespace timing {
+
+Allocations allocations() {
+  return {alloc_count.load(std::memory_order_relaxed),
+          alloc_bytes.load(std::memory_order_relaxed)};
+}
+
+Report::~Report() {
+  stop();
+  if (format == Format::TABLE)
+    print_table(std::cerr);
+  else if (format == Format::JSON)
+    print_json(std::cerr);
+}
+
+void Report::phase(std::string const &name) {
+  stop();
+  auto it = std::find_if(phases.begin(), phases.end(),
+                         [&](Phase const &p) { return p.name == name; });
+  current = static_cast<int>(it - phases.begin());
+  if (it == phases.end())
+    phases.push_back(Phase{name});
+  start_allocations = allocations();
+  start_cpu = cpu_seconds();
+  start = Clock::now();
+}
+
+void Report::stop() {
+  if (current < 0)
+    return;
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  auto &p = phases[current];
+  p.seconds += elapsed.count();
+  p.cpu_seconds += cpu_seconds() - start_cpu;
+  auto now = allocations();
+  p.allocations += now.count - start_allocations.count;
+  p.allocated_bytes += now.bytes - start_allocations.bytes;
+  p.peak_rss_kb = peak_rss_kb();
+  current = -1;
+}
+
+void Report::print_table(std::ostream &out) const {
+  Phase total{"total"};
+  for (auto const &p : phases) {
+    total.seconds += p.seconds;
+    total.cpu_seconds += p.cpu_seconds;
+    total.allocations += p.allocations;
+    total.allocated_bytes += p.allocated_bytes;
+    total.peak_rss_kb = std::max(total.peak_rss_kb, p.peak_rss_kb);
+  }
+  auto flags = out.flags();
+  auto line = [&](std::string const &indent, Phase const &p) {
+    out << indent << std::left << std::setw(16 - indent.size()) << p.name
+        << std::right << std::setprecision(6) << std::setw(10) << p.seconds
+        << std::setw(10) << p.cpu_seconds << std::setprecision(1)
+        << std::setw(8)
+        << (total.seconds > 0 ? 100 * p.seconds / total.seconds : 0.0)
+        << std::setw(10) << p.allocations << std::setw(10)
+        << p.allocated_bytes / 1048576.0 << std::setw(13)
+        << p.peak_rss_kb / 1024.0 << '\n';
+  };
+  out << std::fixed << "time-report:      wall s     cpu s  wall %    allocs"
+      << "  alloc MB  peak RSS MB\n";
+  for (auto const &p : phases)
+    line("  ", p);
+  line("", total);
+  out.flags(flags);
+}
+
+void Report::print_json(std::ostream &out) const {
+  auto flags = out.flags();
+  out << std::fixed << std::setprecision(6) << "{\"phases\": [";
+  for (std::size_t i = 0; i < phases.size(); i++) {
+    auto const &p = phases[i];
+    out << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << p.name
+        << "\", \"seconds\": " << p.seconds
+        << ", \"cpu_seconds\": " << p.cpu_seconds
+        << ", \"allocations\": " << p.allocations
+        << ", \"allocated_bytes\": " << p.allocated_bytes
+        << ", \"peak_rss_kb\": " << p.peak_rss_kb << "}";
+  }
+  out << "\n]}\n";
+  out.flags(flags);
+}
+
+} // namespace timing
+} // namespace bx
@@ -0,0 +1,77 @@
+#pragma once
+
+/**
+ * Timing of the phases of the compiler (bx --time-report).
+ *
+ * The driver marks the start of every phase with Report::phase(), which
+ * ends the previous one; the phases that come up more than once add up.
+ * For every phase, the report has the wall-clock and CPU times (the CPU
+ * time is larger with -j), the number and total size of the memory
+ * allocations of the compiler (counted by the replacement of the global
+ * operator new in timing.cpp), and the peak resident set size at the end of
+ * the phase, which shows the phase that raised it.
+ *
+ * When enabled, the report goes to stderr as the Report is destroyed, so
+ * it is printed on normal return only: the errors that end the driver with
+ * std::exit() skip it. It is either a table:
+ *
+ *     time-report:  wall s  cpu s  wall %  allocs  alloc MB  peak RSS MB
+ *       <phase> <seconds> ...
+ *     total ...
+ *
+ * with one line per phase, in the order they first started, or as JSON
+ * (--time-report=json). The phase names are single words, and the lines of
+ * the phases are the only ones that start with spaces, for the scripts that
+ * read the table.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bx {
+namespace timing {
+
+enum class Format { NONE, TABLE, JSON };
+
+/** The allocations made by operator new since the start */
+struct Allocations {
+  uint64_t count = 0, bytes = 0;
+};
+Allocations allocations();
+
+class Report {
+public:
+  explicit Report(Format format) : format{format} {}
+  ~Report();
+  Report(Report const &) = delete;
+  Report &operator=(Report const &) = delete;
+
+  /** End the current phase, if any, and start the phase name */
+  void phase(std::string const &name);
+  /** End the current phase */
+  void stop();
+
+  void print_table(std::ostream &out) const;
+  void print_json(std::ostream &out) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  struct Phase {
+    std::string name;
+    double seconds = 0, cpu_seconds = 0;
+    uint64_t allocations = 0, allocated_bytes = 0;
+    long peak_rss_kb = 0;
+  };
+  Format format;
+  std::vector<Phase> phases;
+  int current = -1;
+  Clock::time_point start;
+  double start_cpu = 0;
+  Allocations start_allocations;
+};
+
+} // namespace timing
+} // namespace bx
@@ -0,0 +1,187 @@
+/**
+ * Generator of large synthetic BX programs, to measure the throughput of
+ * the compiler.
+ *
+ *     bxgen [-n CALLABLES] [-d DEPTH] [-e TERMS] [-g GLOBALS] [-s SEED]
+ *
+ * writes to stdout a program with CALLABLES functions (default 100), whose
+ * statements nest DEPTH levels of if and while (default 4), with
+ * expressions of about TERMS leaves (default 8), over GLOBALS global
+ * variables (default: as many as functions). Every function calls the one
+ * before it at most once and every loop runs a few times, so the program
+ * also runs quickly. The same options and SEED give the same program.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+  int callables = 100, depth = 4, terms = 8, globals = -1;
+  uint64_t seed = 1;
+};
+
+class Generator {
+  Options const &opts;
+  std::ostream &out;
+  uint64_t state;
+  int loops = 0; // loop counters of the current function
+
+  /** A deterministic generator that does not depend on the C++ library */
+  int random(int n) {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    return static_cast<int>((state >> 33) % static_cast<uint64_t>(n));
+  }
+
+  void indent(int level) { out << std::string(2 * level, ' '); }
+
+  std::string leaf(int vars) {
+    switch (random(4)) {
+    case 0:
+      return std::to_string(random(1000));
+    case 1:
+      return "g" + std::to_string(random(opts.globals));
+    default:
+      return "v" + std::to_string(random(vars));
+    }
+  }
+
+  /** An int64 expression of about terms leaves over v0 .. v(vars-1) */
+  void expr(int terms, int vars) {
+    if (terms <= 1) {
+      out << leaf(vars);
+      return;
+    }
+    static char const *const ops[] = {"+", "-", "*", "&", "|", "^"};
+    int left = 1 + random(terms - 1);
+    out << '(';
+    expr(left, vars);
+    out << ' ' << ops[random(6)] << ' ';
+    expr(terms - left, vars);
+    out << ')';
+  }
+
+  void condition(int vars) {
+    static char const *const ops[] = {"<", "<=", ">", ">=", "==", "!="};
+    expr(opts.terms / 2, vars);
+    out << ' ' << ops[random(6)] << ' ';
+    expr(opts.terms / 2, vars);
+  }
+
+  /** Statements at nesting level, with vars variables in scope */
+  void block(int level, int vars) {
+    for (int i = 0; i < 3; i++) {
+      indent(level);
+      out << 'v' << random(vars) << " = ";
+      expr(opts.terms, vars);
+      out << ";\n";
+    }
+    if (random(4) == 0) {
+      indent(level);
+      out << 'g' << random(opts.globals) << " = ";
+      expr(opts.terms, vars);
+      out << ";\n";
+    }
+    if (level > opts.depth)
+      return;
+    indent(level);
+    if (random(2) == 0) {
+      out << "if (";
+      condition(vars);
+      out << ") {\n";
+      block(level + 1, vars);
+      indent(level);
+      out << "} else {\n";
+      block(level + 1, vars);
+      indent(level);
+      out << "}\n";
+    } else {
+      auto i = "i" + std::to_string(loops++);
+      out << "var " << i << " = 0 : int64;\n";
+      indent(level);
+      out << "while (" << i << " < 3) {\n";
+      block(level + 1, vars);
+      indent(level + 1);
+      out << i << " = " << i << " + 1;\n";
+      indent(level);
+      out << "}\n";
+    }
+  }
+
+  void function(int k) {
+    loops = 0;
+    out << "fun f" << k << "(v0, v1 : int64) : int64 {\n";
+    out << "  var v2 = ";
+    expr(opts.terms, 2);
+    out << ", v3 = ";
+    expr(opts.terms, 2);
+    out << " : int64;\n";
+    block(1, 4);
+    if (k > 0)
+      out << "  v0 = v0 + f" << k - 1 << "(v1, v2);\n";
+    out << "  return ";
+    expr(opts.terms, 4);
+    out << ";\n}\n\n";
+  }
+
+public:
+  Generator(Options const &opts, std::ostream &out)
+      : opts{opts}, out{out}, state{opts.seed} {}
+
+  void program() {
+    out << "// generated by bxgen -n " << opts.callables << " -d "
+        << opts.depth << " -e " << opts.terms << " -g " << opts.globals
+        << " -s " << opts.seed << "\n\n";
+    for (int g = 0; g < opts.globals; g++)
+      out << "var g" << g << " = " << random(100) << " : int64;\n";
+    out << '\n';
+    for (int k = 0; k < opts.callables; k++)
+      function(k);
+    out << "proc main() {\n  print f" << opts.callables - 1
+        << "(1, 2);\n}\n";
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options opts;
+  int c;
+  while ((c = getopt(argc, argv, "n:d:e:g:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      opts.callables = std::atoi(optarg);
+      break;
+    case 'd':
+      opts.depth = std::atoi(optarg);
+      break;
+    case 'e':
+      opts.terms = std::atoi(optarg);
+      break;
+    case 'g':
+      opts.globals = std::atoi(optarg);
+      break;
+    case 's':
+      opts.seed = std::strtoull(optarg, nullptr, 10);
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0]
+                << " [-n CALLABLES] [-d DEPTH] [-e TERMS] [-g GLOBALS]"
+                   " [-s SEED]\n";
+      return 1;
+    }
+  }
+  if (opts.globals < 0)
+    opts.globals = opts.callables;
+  if (opts.callables < 1 || opts.depth < 0 || opts.terms < 1 ||
+      opts.globals < 1) {
+    std::cerr << argv[0] << ": the sizes must be positive\n";
+    return 1;
+  }
+  Generator{opts, std::cout}.program();
+  return 0;
+}
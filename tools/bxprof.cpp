@@ -0,0 +1,102 @@
+/**
+ * Report of a profile recorded by a program compiled with bx --profile.
+ *
+ *     bxprof file.profmap [bxprof.out]
+ *
+ * prints, for every callable, how many times it was called and how many
+ * blocks it executed, then the hottest blocks and call sites.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include "profile.h"
+
+using namespace bx;
+
+namespace {
+
+constexpr std::size_t top = 10;
+
+struct CallableStats {
+  uint64_t calls = 0, blocks = 0, call_sites = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " file.profmap [bxprof.out]\n";
+    return 1;
+  }
+  std::vector<uint64_t> counts;
+  profile::Map map;
+  try {
+    std::ifstream map_in{argv[1]};
+    if (!map_in)
+      throw std::runtime_error(std::string{"cannot open "} + argv[1]);
+    map = profile::read_map(map_in);
+    char const *prof_file = argc == 3 ? argv[2] : "bxprof.out";
+    std::ifstream prof_in{prof_file, std::ios::binary};
+    if (!prof_in)
+      throw std::runtime_error(std::string{"cannot open "} + prof_file);
+    counts = profile::read_counts(prof_in, map);
+  } catch (std::exception const &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+
+  std::map<std::string, CallableStats> callables;
+  std::vector<std::size_t> blocks, calls;
+  for (std::size_t i = 0; i < map.sites.size(); i++) {
+    auto const &site = map.sites[i];
+    auto &st = callables[site.callable];
+    if (site.kind == profile::Site::BLOCK) {
+      if (site.position == 0)
+        st.calls = counts[i];
+      st.blocks += counts[i];
+      blocks.push_back(i);
+    } else {
+      st.call_sites += counts[i];
+      calls.push_back(i);
+    }
+  }
+  auto hotter = [&](std::size_t a, std::size_t b) {
+    return counts[a] > counts[b];
+  };
+  std::stable_sort(blocks.begin(), blocks.end(), hotter);
+  std::stable_sort(calls.begin(), calls.end(), hotter);
+  std::vector<std::pair<std::string, CallableStats>> by_blocks(
+      callables.begin(), callables.end());
+  std::stable_sort(by_blocks.begin(), by_blocks.end(),
+                   [](auto const &a, auto const &b) {
+                     return a.second.blocks > b.second.blocks;
+                   });
+
+  std::cout << std::left << std::setw(24) << "callable" << std::right
+            << std::setw(14) << "calls" << std::setw(14) << "blocks"
+            << std::setw(14) << "calls made" << '\n';
+  for (auto const &c : by_blocks)
+    std::cout << std::left << std::setw(24) << c.first << std::right
+              << std::setw(14) << c.second.calls << std::setw(14)
+              << c.second.blocks << std::setw(14) << c.second.call_sites
+              << '\n';
+
+  std::cout << "\nhottest blocks:\n";
+  for (std::size_t k = 0; k < blocks.size() && k < top; k++) {
+    auto const &site = map.sites[blocks[k]];
+    std::cout << std::setw(14) << counts[blocks[k]] << "  " << site.callable
+              << " @" << site.position << '\n';
+  }
+
+  std::cout << "\nhottest call sites:\n";
+  for (std::size_t k = 0; k < calls.size() && k < top; k++) {
+    auto const &site = map.sites[calls[k]];
+    std::cout << std::setw(14) << counts[calls[k]] << "  " << site.callable
+              << " @" << site.position << " -> " << site.callee << '\n';
+  }
+  return 0;
+}
@@ -2,7 +2,9 @@
 
 #include <typeinfo>
 #include <algorithm>
+#include <iostream>
 #include <map>
+#include <sstream>
 
 namespace bx {
 using namespace source;
@@ -58,6 +60,9 @@ public:
     for (auto const &gv : source_prog.global_vars)
       gv_map.insert_or_assign(gv.first,
                               new VarInfo(gv.second->ty, true));
+    for (auto const &gv : source_prog.extern_vars)
+      gv_map.insert_or_assign(gv.first,
+                              new VarInfo(gv.second->ty, true));
     symbol_map.push_back(std::move(gv_map));
   }
 
@@ -277,16 +282,16 @@ public:
   }
 
   void visit(Call const &ca) override {
-    auto const &cbl = source_prog.callables.find(ca.func);
-    if (cbl == source_prog.callables.end())
+    auto const *cbl = source_prog.find_callable(ca.func);
+    if (!cbl)
       panic("Unknown function/procedure: " + ca.func);
-    auto const &params = cbl->second->args;
+    auto const &params = cbl->args;
     if (ca.args.size() != params.size())
       panic("Expected " + std::to_string(params.size()) + " arguments, got " +
             std::to_string(ca.args.size()));
     for (size_t i = 0; i < ca.args.size(); i++)
       visit_checked(ca.args[i], params[i].second);
-    ca.meta->ty = cbl->second->return_ty;
+    ca.meta->ty = cbl->return_ty;
   }
 
   void visit(Alloc const &all) override{
@@ -332,6 +337,7 @@ public:
     drf.ptr->accept(*this);
     if (auto t = dynamic_cast<POINTER* const>(drf.ptr->meta->ty)){
       drf.meta->ty = t->typ;
+      drf.meta->assignable = true;
     }
     else{
       panic(std::string{"You tried to dereference"} +  
@@ -340,10 +346,12 @@ public:
     }
   }
 };
-void type_check(Program &src_prog) {
+void type_check(Program &src_prog, bool need_main) {
   TypeChecker tyc{src_prog};
   for (auto &cbl : src_prog.callables)
     tyc.visit(*cbl.second);
+  if (!need_main)
+    return;
   // check that the main() proc is present
   auto const &main_proc = src_prog.callables.find("main");
   if (main_proc == src_prog.callables.end() ||
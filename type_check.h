@@ -5,7 +5,11 @@
 namespace bx {
 namespace check {
 
-void type_check(bx::source::Program &);
+/**
+ * @param need_main whether prog must define main(); a module compiled with
+ * bx -c may leave it to another one
+ */
+void type_check(bx::source::Program &prog, bool need_main = true);
 
 }
 